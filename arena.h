@@ -0,0 +1,177 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Arena - stack-ordered allocator over one preallocated block
+ * Allocations are carved from the top of the block. A freed block is given
+ * back as soon as every block above it is free as well, so short-lived
+ * objects created and destroyed in LIFO order (popups, temporary canvases)
+ * never touch the heap. arena_reset() releases everything at once.
+ */
+typedef struct Arena Arena;
+typedef struct ArenaBlock ArenaBlock;
+
+struct Arena {
+    unsigned char *memory;   // Start of the preallocated block
+    size_t         capacity; // Size of the block in bytes
+    size_t         top;      // Offset of the first unused byte
+    size_t         last;     // Offset of the topmost block header (ARENA_NO_BLOCK if empty)
+    bool           owned;    // memory was allocated by arena_create
+};
+
+/*
+ * Header in front of every allocation.
+ */
+struct ArenaBlock {
+    Arena  *arena; // Owning arena, so blocks can be freed without it
+    size_t  size;  // Payload size in bytes
+    size_t  prev;  // Offset of the block below (ARENA_NO_BLOCK for the first one)
+    bool    free;  // Freed, waiting for the blocks above it
+};
+
+#define ARENA_ALIGN      16
+#define ARENA_NO_BLOCK   ((size_t)-1)
+#define ARENA_ALIGN_UP(n) (((n) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER_SIZE ARENA_ALIGN_UP(sizeof(ArenaBlock))
+
+
+// -----------------------------------------------------------------------------
+//  Arena Lifetime
+// -----------------------------------------------------------------------------
+/*
+ * Initializes an arena over caller-provided memory.
+ * The memory must stay valid (and aligned to ARENA_ALIGN) for the arena's lifetime.
+ */
+static inline void arena_init(Arena *arena, void *memory, size_t capacity) {
+    arena->memory   = (unsigned char *)memory;
+    arena->capacity = capacity;
+    arena->top      = 0;
+    arena->last     = ARENA_NO_BLOCK;
+    arena->owned    = false;
+}
+
+/*
+ * Creates an arena with its own block of the given size.
+ * This is the only heap allocation the arena ever makes.
+ */
+static inline Arena *arena_create(size_t capacity) {
+    Arena *arena = (Arena *)malloc(sizeof(Arena));
+    void *memory = malloc(capacity);
+    if (!arena || !memory) {
+        free(arena);
+        free(memory);
+        return NULL;
+    }
+
+    arena_init(arena, memory, capacity);
+    arena->owned = true;
+    return arena;
+}
+
+/*
+ * Releases every allocation at once.
+ */
+static inline void arena_reset(Arena *arena) {
+    arena->top  = 0;
+    arena->last = ARENA_NO_BLOCK;
+}
+
+/*
+ * Destroys an arena made by arena_create.
+ */
+static inline void arena_destroy(Arena *arena) {
+    if (!arena || !arena->owned) return;
+
+    free(arena->memory);
+    free(arena);
+}
+
+
+// -----------------------------------------------------------------------------
+//  Allocation
+// -----------------------------------------------------------------------------
+static inline ArenaBlock *arena_block_at(Arena *arena, size_t offset) {
+    return (ArenaBlock *)(void *)(arena->memory + offset);
+}
+
+static inline ArenaBlock *arena_block_of(void *ptr) {
+    return (ArenaBlock *)(void *)((unsigned char *)ptr - ARENA_HEADER_SIZE);
+}
+
+/*
+ * Allocates size bytes from the top of the arena.
+ * Returns NULL if the arena is full.
+ */
+static inline void *arena_alloc(Arena *arena, size_t size) {
+    if (!arena) return NULL;
+
+    size_t offset = arena->top;
+    size_t total  = ARENA_HEADER_SIZE + ARENA_ALIGN_UP(size);
+    if (total < size || total > arena->capacity - offset) return NULL;
+
+    ArenaBlock *block = arena_block_at(arena, offset);
+    block->arena = arena;
+    block->size  = ARENA_ALIGN_UP(size);
+    block->prev  = arena->last;
+    block->free  = false;
+
+    arena->last = offset;
+    arena->top  = offset + total;
+
+    return (unsigned char *)block + ARENA_HEADER_SIZE;
+}
+
+/*
+ * Frees a block allocated with arena_alloc.
+ * The space is reclaimed right away if the block is on top, together with
+ * any already freed blocks directly below it; otherwise once those above go.
+ */
+static inline void arena_free_block(void *ptr) {
+    if (!ptr) return;
+
+    ArenaBlock *block = arena_block_of(ptr);
+    Arena *arena = block->arena;
+    block->free = true;
+
+    while (arena->last != ARENA_NO_BLOCK) {
+        ArenaBlock *top = arena_block_at(arena, arena->last);
+        if (!top->free) break;
+
+        arena->top  = arena->last;
+        arena->last = top->prev;
+    }
+}
+
+/*
+ * Resizes a block. The topmost block grows or shrinks in place,
+ * any other block is moved to the top.
+ */
+static inline void *arena_realloc(Arena *arena, void *ptr, size_t size) {
+    if (!ptr) return arena_alloc(arena, size);
+
+    ArenaBlock *block = arena_block_of(ptr);
+    size_t offset = (size_t)((unsigned char *)block - arena->memory);
+
+    if (offset == arena->last) {
+        size_t total = ARENA_HEADER_SIZE + ARENA_ALIGN_UP(size);
+        if (total < size || total > arena->capacity - offset) return NULL;
+
+        block->size = ARENA_ALIGN_UP(size);
+        arena->top  = offset + total;
+        return ptr;
+    }
+
+    void *moved = arena_alloc(arena, size);
+    if (!moved) return NULL;
+
+    memcpy(moved, ptr, block->size < size ? block->size : size);
+    arena_free_block(ptr);
+    return moved;
+}
+
+#endif // ARENA_H
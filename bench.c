@@ -0,0 +1,176 @@
+/*
+ * tc_show benchmark
+ * Drives tc_show into a sink (/dev/null by default) for a matrix of canvas
+ * sizes, color modes and per-frame change rates, and reports frames/sec,
+ * bytes emitted per frame and ns per cell. Canvases are headless, so no
+ * terminal (or PTY) is needed.
+ *
+ * Usage: bench [-t ms_per_case] [-o sink_path] [-d] [-j threads]
+ *   -d  enable dirty tracking (tc_set_dirty_tracking)
+ *   -j  encode in row bands on that many threads (tc_set_encode_threads,
+ *       needs -DTC_USE_THREADS -pthread)
+ */
+#define TERMCANVAS_IMPLEMENTATION
+#include "termcanvas.h"
+
+#include <fcntl.h>
+#include <time.h>
+
+typedef struct {
+    int width;
+    int height;
+} BenchSize;
+
+typedef struct {
+    const char *name;
+    int percent; // Share of cells changed per frame
+} BenchScene;
+
+static const BenchSize bench_sizes[] = {
+    {80, 24},
+    {200, 60},
+    {300, 100},
+};
+
+static bool bench_dirty   = false; // -d: run with dirty tracking on
+static int  bench_threads = 0;     // -j: band encoding threads
+
+static const BenchScene bench_scenes[] = {
+    {"static",  0},
+    {"1%",      1},
+    {"10%",    10},
+    {"100%",  100},
+};
+
+static const struct {
+    const char *name;
+    TcTerminalColorMode mode;
+} bench_modes[] = {
+    {"rgb",  Color_RGB},
+    {"256",  Color_256},
+    {"base", Color_Base},
+};
+
+static const Color bench_palette[] = {
+    COLOR_RED, COLOR_GREEN, COLOR_BLUE, COLOR_YELLOW,
+    COLOR_CYAN, COLOR_MAGENTA, COLOR_ORANGE, COLOR_WHITE,
+};
+
+#define BENCH_COUNT(arr) ((int)(sizeof(arr) / sizeof((arr)[0])))
+
+/*
+ * Small deterministic PRNG (xorshift32), so every run changes the same cells.
+ */
+static uint32_t bench_rng = 0x12345678u;
+static inline uint32_t bench_rand(void) {
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 17;
+    bench_rng ^= bench_rng << 5;
+    return bench_rng;
+}
+
+static inline double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/*
+ * Changes the given share of cells. Every touched cell is guaranteed to
+ * differ from what it was, so it has to be emitted again.
+ */
+static void bench_mutate(TermCanvas *canvas, int percent, int frame) {
+    if (percent <= 0) return;
+
+    for (int y = 0; y < canvas->height; y++) {
+        for (int x = 0; x < canvas->width; x++) {
+            if (percent < 100 && (int)(bench_rand() % 100) >= percent) continue;
+
+            TcPixel px = canvas->pixels[y][x];
+            px.symbol     = (px.symbol == L'#') ? L'.' : L'#';
+            px.foreground = bench_palette[(unsigned)(x / 8 + frame) % (unsigned)BENCH_COUNT(bench_palette)];
+            tc_set_pixel(canvas, y, x, px);
+        }
+    }
+}
+
+/*
+ * Runs one benchmark case for at least budget_ms and prints a result line.
+ */
+static void bench_run(int sink_fd, BenchSize size, TcTerminalColorMode mode, const char *mode_name,
+                      BenchScene scene, double budget_ms) {
+    TcOptions options = TC_OPTIONS_HEADLESS;
+    options.mode = mode;
+    options.sink = (TcSink){Sink_Fd, sink_fd, NULL, NULL};
+
+    TermCanvas *canvas = tc_create_ex(size.width, size.height, L' ', COLOR_WHITE, COLOR_BLACK, &options);
+    if (!canvas) return;
+    tc_set_dirty_tracking(canvas, bench_dirty);
+    #ifdef TC_USE_THREADS
+    tc_set_encode_threads(canvas, bench_threads);
+    #endif
+    tc_show(canvas); // The first frame is a full redraw, keep it out of the numbers
+
+    double show_ns = 0.0;
+    long   bytes   = 0;
+    int    frames  = 0;
+    double start   = bench_now_ns();
+
+    while (frames < 10 || bench_now_ns() - start < budget_ms * 1e6) {
+        bench_mutate(canvas, scene.percent, frames);
+
+        double t0 = bench_now_ns();
+        tc_show(canvas);
+        show_ns += bench_now_ns() - t0;
+
+        bytes += tc_get_stats(canvas)->bytes_written;
+        frames++;
+    }
+
+    double cells = (double)size.width * (double)size.height;
+    printf("%4dx%-4d %-5s %-7s %12.0f %14.0f %10.2f\n",
+           size.width, size.height, mode_name, scene.name,
+           (double)frames / (show_ns / 1e9),
+           (double)bytes / frames,
+           show_ns / frames / cells);
+    fflush(stdout);
+
+    tc_destroy(canvas);
+}
+
+int main(int argc, char **argv) {
+    double budget_ms = 200.0;
+    const char *sink = "/dev/null";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) budget_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) sink = argv[++i];
+        else if (strcmp(argv[i], "-d") == 0) bench_dirty = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) bench_threads = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [-t ms_per_case] [-o sink_path] [-d] [-j threads]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int sink_fd = open(sink, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (sink_fd < 0) {
+        perror("bench: sink setup");
+        return 1;
+    }
+
+    printf("%-9s %-5s %-7s %12s %14s %10s\n",
+           "size", "mode", "scene", "frames/s", "bytes/frame", "ns/cell");
+
+    for (int s = 0; s < BENCH_COUNT(bench_sizes); s++) {
+        for (int m = 0; m < BENCH_COUNT(bench_modes); m++) {
+            for (int c = 0; c < BENCH_COUNT(bench_scenes); c++) {
+                bench_run(sink_fd, bench_sizes[s], bench_modes[m].mode, bench_modes[m].name,
+                          bench_scenes[c], budget_ms);
+            }
+        }
+    }
+
+    close(sink_fd);
+    return 0;
+}
@@ -196,8 +196,53 @@ static inline bool is_none(Color color) { return color.color == COLOR_NONE.color
 /*
  * Creates a 32-bit RGB color from individual red, green, and blue components.
  */
-inline Color create_color_rgb(int r, int g, int b) {
-    return (Color){0x00000000 | (uint32_t)((r & 0xFF) << 16) | (uint32_t)((g & 0xFF) << 8) | (uint32_t)(b & 0xFF << 0)};
+static inline Color create_color_rgb(int r, int g, int b) {
+    return (Color){(uint32_t)((r & 0xFF) << 16) | (uint32_t)((g & 0xFF) << 8) | (uint32_t)(b & 0xFF)};
+}
+
+
+// -----------------------------------------------------------------------------
+//  Color Math
+//  None of these know about COLOR_NONE, check is_none() first where it matters.
+// -----------------------------------------------------------------------------
+/*
+ * Mixes two colors: weight 0 gives a, 256 gives b.
+ * Red and blue are computed together in one multiply (they can't overflow
+ * into each other), green in another. Every channel gets
+ * (a * (256 - weight) + b * weight) >> 8, exactly like the batch kernels.
+ */
+static inline Color color_mix(Color a, Color b, unsigned weight) {
+    uint32_t inv = 256u - weight;
+    uint32_t rb  = ((a.color & 0xFF00FFu) * inv + (b.color & 0xFF00FFu) * weight) >> 8;
+    uint32_t g   = ((a.color & 0x00FF00u) * inv + (b.color & 0x00FF00u) * weight) >> 8;
+    return (Color){(rb & 0xFF00FFu) | (g & 0x00FF00u)};
+}
+
+/*
+ * Converts an 8-bit alpha (0-255) to a color_mix weight (0-256), so that
+ * 255 gives exactly the other color.
+ */
+static inline unsigned color_alpha_weight(uint8_t alpha) { return (unsigned)alpha + (alpha >> 7); }
+
+/*
+ * Blends over on top of base with the given alpha (0 keeps base, 255 gives over).
+ */
+static inline Color color_blend(Color base, Color over, uint8_t alpha) {
+    return color_mix(base, over, color_alpha_weight(alpha));
+}
+
+/*
+ * Darkens a color towards black (255 gives black).
+ */
+static inline Color color_darken(Color color, uint8_t amount) {
+    return color_blend(color, (Color){0x00000000}, amount);
+}
+
+/*
+ * Lightens a color towards white (255 gives white).
+ */
+static inline Color color_lighten(Color color, uint8_t amount) {
+    return color_blend(color, (Color){0x00FFFFFF}, amount);
 }
 
 #endif // COLOR_H
@@ -9,6 +9,8 @@ int main(void) {
         printf("Failed to create canvas.\n");
         return 1;
     }
+    tc_watch_resize(true); // Read the terminal size only after SIGWINCH
+    tc_set_target_fps(screen, 60, Pacing_Skip); // Present at most 60 frames per second
 
     int i = 0;
     while (i < 10000000) {
@@ -19,6 +21,9 @@ int main(void) {
         i++;
     }
 
+    // Skipped calls may have left the last update unpresented: send it with pacing off
+    tc_set_target_fps(screen, 0, Pacing_Skip);
+    tc_show(screen);
     tc_destroy(screen);
     
     return 0;
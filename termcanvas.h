@@ -9,9 +9,42 @@
 #include <sys/ioctl.h>
 #include <math.h>
 #include <locale.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/socket.h>
 
 #include "coords.h"
 #include "color.h"
+#ifdef USE_ARENA
+#include "arena.h"
+#endif
+#ifdef TC_USE_THREADS
+#include <pthread.h>
+#endif
+
+/*
+ * SIMD selection for the tc_show scans (compile time).
+ * Only the default 16-byte pixel layout is vectorized, one pixel per 128-bit lane group.
+ * Define TC_NO_SIMD to force the scalar code.
+ */
+#if !defined(TC_NO_SIMD) && !defined(TC_PACKED_PIXELS)
+    #if defined(__AVX2__)
+        #define TC_SIMD_AVX2
+        #include <immintrin.h>
+    #elif defined(__SSE2__)
+        #define TC_SIMD_SSE2
+        #include <emmintrin.h>
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        #define TC_SIMD_NEON
+        #include <arm_neon.h>
+    #endif
+#endif
 
 
 // -----------------------------------------------------------------------------
@@ -19,7 +52,23 @@
 // -----------------------------------------------------------------------------
 typedef enum TcEffect TcEffect;
 typedef struct TcPixel TcPixel;
+typedef struct TcStats TcStats;
+typedef struct TcDirtySpan TcDirtySpan;
+typedef struct TcPresenter TcPresenter;
+typedef struct TcBandPool TcBandPool;
+typedef struct TcStyleTable TcStyleTable;
 typedef struct TermCanvas TermCanvas;
+typedef struct TcCompositor TcCompositor;
+typedef struct TcRecorder TcRecorder;
+typedef struct TcPlayer TcPlayer;
+typedef struct TcBroadcast TcBroadcast;
+typedef struct TcRaster TcRaster;
+
+/*
+ * Called by tc_show when the terminal size changed, before the frame is
+ * presented, so the canvas can be resized (tc_resize) to fit.
+ */
+typedef void (*TcResizeCallback)(TermCanvas *canvas, int terminal_w, int terminal_h, void *user_data);
 
 /*
  * Text effects (bold, italic, etc.).
@@ -34,15 +83,68 @@ enum TcEffect {
     Effect_Conceal   = 8,  // Conceal (hide text, rarely supported)
 };
 
+/*
+ * Which colors of a pixel the color kernels (tc_blend_area, ...) touch.
+ */
+typedef enum {
+    Slot_Background = 1,
+    Slot_Foreground = 2,
+    Slot_Both       = 3,
+} TcColorSlot;
+
 /*
  * Represents a single pixel on the canvas.
+ * Defining TC_PACKED_PIXELS packs symbol and effect into one 32-bit word,
+ * which brings a pixel from 16 down to 12 bytes (less memory traffic when
+ * scanning and filling large canvases). Fields are accessed the same way
+ * in both layouts, only taking the address of symbol/effect is not possible.
+ * Neither layout has padding, so pixels can be compared as raw bytes.
  */
+#ifdef TC_PACKED_PIXELS
+struct TcPixel {
+    Color    background; // Background color
+    Color    foreground; // Foreground color
+    uint32_t symbol : 24; // Character to display (every Unicode code point fits)
+    uint32_t effect : 8;  // Text effect (TcEffect)
+};
+_Static_assert(sizeof(TcPixel) == 12, "packed TcPixel must be 12 bytes");
+#else
 struct TcPixel {
     Color    background; // Background color
     Color    foreground; // Foreground color
     wchar_t  symbol;     // Character to display
     TcEffect effect;     // Text effect (bold, italic, etc.)
 };
+_Static_assert(sizeof(TcPixel) == 16, "TcPixel must not contain padding");
+#endif
+
+/*
+ * Builds a pixel, independent of the pixel layout.
+ */
+static inline TcPixel tc_pixel(Color background, Color foreground, wchar_t symbol, TcEffect effect) {
+    TcPixel px;
+    px.background = background;
+    px.foreground = foreground;
+    #ifdef TC_PACKED_PIXELS
+    px.symbol = (uint32_t)symbol & 0xFFFFFF;
+    px.effect = (uint32_t)effect & 0xFF;
+    #else
+    px.symbol = symbol;
+    px.effect = effect;
+    #endif
+    return px;
+}
+
+/*
+ * Symbols past the last code point, with a meaning of their own.
+ * A wide glyph (tc_char_width 2) is followed by a TC_WIDE_CONT cell for
+ * the second column it covers; tc_draw_text writes both. Combining marks
+ * are kept with their base as a cluster (see tc_cluster).
+ */
+#define TC_CLUSTER_BASE  0x110000u // First cluster symbol
+#define TC_CLUSTER_MAX   4096      // Clusters per process, shared by every canvas; marks are dropped once full
+#define TC_CLUSTER_MARKS 2         // Combining marks kept per cluster
+#define TC_WIDE_CONT     0xFFFFFEu // Second column of a wide glyph
 
 /*
  * Terminal color modes
@@ -53,9 +155,127 @@ struct TcPixel {
 typedef enum {
     Color_Base, // Basic 8/16 colors
     Color_256,  // 256-color mode
-    Color_RGB   // TrueColor (RGB) mode
+    Color_RGB,  // TrueColor (RGB) mode
+    Color_Auto  // Detect the mode (TcOptions only, never a canvas mode)
 } TcTerminalColorMode;
 
+/*
+ * Where a canvas sends its output.
+ * Sink_Fd writes to a file descriptor (terminal, file, socket),
+ * Sink_Callback hands every frame to a function as one iovec list,
+ * Sink_Memory appends to a growing in-memory buffer (tc_sink_memory).
+ */
+typedef enum {
+    Sink_Fd,
+    Sink_Callback,
+    Sink_Memory,
+} TcSinkKind;
+
+typedef void (*TcSinkWrite)(const struct iovec *iov, int count, void *user_data);
+
+typedef struct {
+    TcSinkKind  kind;
+    int         fd;        // Sink_Fd
+    TcSinkWrite write;     // Sink_Callback
+    void       *user_data; // Sink_Callback
+} TcSink;
+
+#define TC_SINK_STDOUT ((TcSink){Sink_Fd, STDOUT_FILENO, NULL, NULL})
+#define TC_SINK_NONE   ((TcSink){Sink_Callback, -1, NULL, NULL}) // Output is discarded (offscreen canvases, layers)
+#define TC_SINK_MEMORY ((TcSink){Sink_Memory, -1, NULL, NULL})   // Output is kept (tc_sink_memory)
+
+/*
+ * What tc_show does when called faster than the target frame rate.
+ */
+typedef enum {
+    Pacing_Sleep, // Wait until the next frame is due, then present
+    Pacing_Skip,  // Return without presenting; changes are kept for the next frame
+} TcPacing;
+
+/*
+ * What tc_show does while the terminal is smaller than the canvas.
+ */
+typedef enum {
+    Overflow_Notice, // Show the terminal size instead (written once per size, nothing in between)
+    Overflow_Crop,   // Present the top-left part of the canvas that fits
+} TcOverflow;
+
+/*
+ * Optional escape sequences the renderer may use to shorten its output.
+ * None are used by default; enable them only for terminals that support them.
+ */
+enum {
+    Cap_Rep = 1 << 0, // CSI n b (REP): repeat the last character
+    Cap_Ech = 1 << 1, // CSI n X (ECH): erase characters (blank runs, needs background color erase)
+    Cap_Cuf = 1 << 2, // CSI n C (CUF): cursor forward, for jumps within a row
+    Cap_Sync = 1 << 3, // DEC mode 2026: frames are wrapped in synchronized update markers
+    Cap_Scroll = 1 << 4, // DECSTBM and CSI n S/T: tc_scroll moves rows on the terminal (whole lines)
+};
+#define TC_CAPS_ALL (Cap_Rep | Cap_Ech | Cap_Cuf | Cap_Sync | Cap_Scroll)
+
+/*
+ * Options for tc_create_ex.
+ * Anything given here is taken as is instead of being detected, which keeps
+ * startup free of terminfo lookups and terminal queries.
+ * A headless canvas has no terminal at all: no setlocale, no cursor or
+ * alternate buffer sequences on create and destroy, no size queries (the
+ * "terminal" is as large as the canvas unless a size is given) and
+ * Color_Auto means Color_RGB. Frames still go to the sink, so with
+ * TC_SINK_MEMORY they can be collected with tc_sink_memory.
+ */
+typedef struct {
+    TcTerminalColorMode mode; // Color mode, Color_Auto to detect it
+    int terminal_w;           // Fixed terminal size, 0 to query it (and follow resizes)
+    int terminal_h;
+    TcSink sink;              // Where output goes
+    unsigned caps;            // Cap_* flags the terminal supports
+    bool headless;            // No terminal side effects (servers, batch jobs, tests)
+} TcOptions;
+
+#define TC_OPTIONS_DEFAULT  ((TcOptions){Color_Auto, 0, 0, TC_SINK_STDOUT, 0, false})
+#define TC_OPTIONS_HEADLESS ((TcOptions){Color_RGB, 0, 0, TC_SINK_MEMORY, 0, true})
+
+
+/*
+ * Per-frame render statistics
+ * Filled in by every tc_show call, so the diff renderer can be tuned.
+ */
+struct TcStats {
+    int cells_scanned; // Cells compared against the front buffer
+    int cells_emitted; // Cells actually written to the terminal
+    int runs_emitted;  // Runs of consecutive cells (one cursor jump each at most)
+    int bytes_written; // Bytes sent to the terminal
+    int frames_dropped; // Snapshots replaced before the presenter thread took them (async mode)
+    int frames_skipped; // tc_show calls skipped by frame pacing before this frame
+    int sgr_emitted;   // SGR (attribute) sequences sent
+    int flushes;       // Mid-frame flushes (the frame buffer could not grow)
+    long long encode_ns; // Time spent scanning and encoding
+    long long write_ns;  // Time spent handing bytes to the sink
+    bool full_redraw;  // The whole canvas was sent (front buffer was invalid)
+    bool too_small;    // The terminal was too small, the size notice was shown instead
+    bool cropped;      // The terminal was too small, only the part that fits was sent (Overflow_Crop)
+};
+
+/*
+ * Dirty columns [x0, x1) of one canvas row.
+ * An empty span (x0 >= x1) means the row was not written since the last present.
+ */
+struct TcDirtySpan {
+    int x0;
+    int x1;
+};
+
+/*
+ * A tc_scroll of rows [top, bottom) by lines (up when positive), left for
+ * the next present to hand to the terminal (Cap_Scroll).
+ */
+typedef struct {
+    int top;
+    int bottom;
+    int lines;
+} TcScroll;
+
+#define TC_SCROLL_MAX 8 // Scrolls kept per frame; more are simply redrawn
 
 /*
  * canvas structure
@@ -65,27 +285,149 @@ struct TermCanvas {
     int height;        // canvas height in pixels
     int width;         // canvas width in pixels
     TcPixel **pixels;  // 2D array of pixel data
+    TcPixel **front;   // Last presented pixel data (what the terminal shows)
+    bool front_valid;  // false forces a full redraw on the next present
+    TcStats stats;     // Statistics of the last presented frame
+
+    TcDirtySpan *dirty; // Per-row dirty spans kept up by the drawing helpers
+    bool track_dirty;   // tc_show only scans dirty spans (pixels must be written through the helpers)
+    TcScroll scrolls[TC_SCROLL_MAX]; // tc_scroll calls since the last presented frame
+    int      scroll_count;
     
-    wchar_t *buffer;   // Render buffer for output
-    int buffer_size;   // Size of the render buffer
+    char *buffer;      // UTF-8 render buffer for output
+    int buffer_size;   // Size of the render buffer in bytes
 
     int terminal_w;    // Terminal width in pixels
     int terminal_h;    // Terminal height in pixels
     bool enough_space;
+    TcOverflow overflow;   // What to present while the terminal is too small
+    bool notice_shown;     // The size notice on the terminal is for terminal_w x terminal_h
+    int  shown_w;          // Part of the canvas presented last (all of it unless cropped)
+    int  shown_h;
+
+    int  size_w;           // Terminal size as last read by tc_show
+    int  size_h;
+    bool size_valid;       // size_w/size_h were read at least once
+    int  size_serial;      // Resize notification count when the size was read
+    TcResizeCallback on_resize; // Called when the terminal size changes
+    void *on_resize_data;
+    bool size_fixed;       // Size given in TcOptions, never queried
+    bool headless;         // No terminal (see TcOptions)
+    TcPixel fill;          // Pixel new cells get (as given to tc_create)
+    TcSink sink;           // Where output goes
+    char  *sink_memory;    // Sink_Memory contents
+    size_t sink_len;
+    size_t sink_cap;
 
     TcTerminalColorMode mode; // Terminal color mode
+    unsigned caps;            // Cap_* sequences the renderer may use
+
+    long long frame_interval_ns; // Frame pacing interval (0: present on every tc_show)
+    long long next_frame_ns;     // When the next frame is due (CLOCK_MONOTONIC)
+    TcPacing  pacing;
+    int       frames_skipped;    // tc_show calls skipped since the last presented frame
+
+    bool stats_overlay;  // Draw the stats of the previous frame over the top row
+    int  overlay_cells;  // Cells the overlay covered on the terminal last time
+
+    TcStyleTable *styles; // Cached SGR sequences (allocated on the first frame)
+    TcRecorder   *recorder; // Records every presented frame (tc_record_start)
+
+    #ifdef USE_ARENA
+    Arena *arena;      // Arena every allocation of the canvas comes from
+    #endif
+
+    #ifdef TC_USE_THREADS
+    TcPresenter *presenter; // Background presenter thread (NULL unless async)
+    TcBandPool  *bands;     // Row band encoders (NULL unless tc_set_encode_threads)
+    int          band_count; // Number of row bands (0 without band encoding)
+    #endif
 };
 
 // -----------------------------------------------------------------------------
 //  Constants and Macros
 // -----------------------------------------------------------------------------
-#define tc_clear()             wprintf(L"\033[H\033[J")          // Clear the entire canvas
-#define tc_gotoxy(x, y)        wprintf(L"\033[%d;%dH", (y), (x)) // Position cursor
-#define tc_hide_cursor()       wprintf(L"\033[?25l")             // Hide the cursor
-#define tc_show_cursor()       wprintf(L"\033[?25h")             // Show the cursor
-#define tc_swich_to_buffer()   wprintf(L"\033[?1049h");          // 
-#define tc_swich_from_buffer() wprintf(L"\033[?1049l");          // 
+#define tc_clear()             tc_write_str("\033[H\033[J")      // Clear the entire canvas
+#define tc_gotoxy(x, y)        tc_write_gotoxy((x), (y))         // Position cursor
+#define tc_hide_cursor()       tc_write_str("\033[?25l")         // Hide the cursor
+#define tc_show_cursor()       tc_write_str("\033[?25h")         // Show the cursor
+#define tc_swich_to_buffer()   tc_write_str("\033[?1049h");      // 
+#define tc_swich_from_buffer() tc_write_str("\033[?1049l");      // 
 #define MAX_ANSI_LENGTH 50 // Define a reasonable maximum for ANSI sequences
+#define TC_CELL_BYTES   10 // Longest a cell encodes to (a cluster: base and two BMP marks)
+#define TC_DIFF_MAX_GAP 4  // Unchanged cells shorter than this are rewritten instead of jumped over
+#define TC_SYNC_BEGIN "\033[?2026h" // Begin synchronized update (Cap_Sync)
+#define TC_SYNC_END   "\033[?2026l" // End synchronized update
+#ifndef IOV_MAX
+#define IOV_MAX 1024       // POSIX minimum is 16, every current system allows at least 1024
+#endif
+
+
+/*
+ * Writes the whole byte range to a file descriptor, retrying on partial writes.
+ * Output bypasses stdio, so nothing is left buffered or converted by libc.
+ */
+static inline bool tc_write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false; // Give up on real errors (closed terminal, etc.)
+        }
+        data += n;
+        len  -= (size_t)n;
+    }
+    return true;
+}
+
+/*
+ * Writes a list of byte ranges with as few writev calls as possible,
+ * retrying on partial writes. The iovec array is modified.
+ */
+static inline void tc_writev_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        int batch = count < IOV_MAX ? count : IOV_MAX;
+        ssize_t n = writev(fd, iov, batch);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return; // Give up on real errors (closed terminal, etc.)
+        }
+
+        // Drop what was written, finishing a partially written range
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+}
+
+/*
+ * Writes an escape sequence literal to a file descriptor.
+ */
+static inline void tc_write_str_fd(int fd, const char *str) {
+    tc_write_all(fd, str, strlen(str));
+}
+
+/*
+ * Writes an escape sequence literal to the terminal.
+ */
+static inline void tc_write_str(const char *str) {
+    tc_write_str_fd(STDOUT_FILENO, str);
+}
+
+/*
+ * Moves the terminal cursor (1-based coordinates).
+ */
+static inline void tc_write_gotoxy(int x, int y) {
+    char seq[32];
+    int len = snprintf(seq, sizeof(seq), "\033[%d;%dH", y, x);
+    if (len > 0) tc_write_all(STDOUT_FILENO, seq, (size_t)len);
+}
 
 
 // -----------------------------------------------------------------------------
@@ -93,71 +435,372 @@ struct TermCanvas {
 // -----------------------------------------------------------------------------
 #ifdef USE_ARENA
 TermCanvas *tc_create(Arena *arena, int width, int height, wchar_t symbol, Color foreground, Color background);
+TermCanvas *tc_create_ex(Arena *arena, int width, int height, wchar_t symbol, Color foreground, Color background,
+                         const TcOptions *options);
 #else
 TermCanvas *tc_create(int width, int height, wchar_t symbol, Color foreground, Color background);
+TermCanvas *tc_create_ex(int width, int height, wchar_t symbol, Color foreground, Color background,
+                         const TcOptions *options);
 #endif
 void tc_destroy(TermCanvas *canvas);
+bool tc_resize(TermCanvas *canvas, int width, int height);
+void tc_show(TermCanvas *canvas);
+void tc_invalidate(TermCanvas *canvas);
+void tc_set_caps(TermCanvas *canvas, unsigned caps);
+void tc_set_target_fps(TermCanvas *canvas, int fps, TcPacing pacing);
+void tc_set_overflow(TermCanvas *canvas, TcOverflow overflow);
+const TcStats *tc_get_stats(const TermCanvas *canvas);
+int  tc_format_stats(const TcStats *stats, char *out, size_t size);
+void tc_set_stats_overlay(TermCanvas *canvas, bool enabled);
+bool tc_set_sink(TermCanvas *canvas, TcSink sink);
+const char *tc_sink_memory(const TermCanvas *canvas, size_t *len);
+void tc_sink_memory_clear(TermCanvas *canvas);
+size_t tc_dump_text(const TermCanvas *canvas, char *out, size_t size);
+int  tc_dump_cells(const TermCanvas *canvas, TcPixel *out);
+bool tc_watch_resize(bool install_handler);
+void tc_notify_resize(void);
+void tc_set_resize_callback(TermCanvas *canvas, TcResizeCallback callback, void *user_data);
+#ifdef TC_USE_THREADS
+bool tc_set_async(TermCanvas *canvas, bool enabled);
+bool tc_set_encode_threads(TermCanvas *canvas, int threads);
+#endif
+
+
+// -----------------------------------------------------------------------------
+//  Drawing Methods
+//  Positions are given row first (y, x), like canvas->pixels[y][x].
+//  Everything is clipped to the canvas and marks what it touched as dirty.
+// -----------------------------------------------------------------------------
+void tc_set_pixel(TermCanvas *canvas, int y, int x, TcPixel pixel);
+void tc_fill_area(TermCanvas *canvas, int y, int x, int height, int width,
+                  wchar_t symbol, Color foreground, Color background, TcEffect effect);
+void tc_blit(TermCanvas *dst, int y, int x, const TermCanvas *src, int src_y, int src_x, int height, int width);
+void tc_blit_sprite(TermCanvas *dst, int y, int x, const TcPixel *sprite, int height, int width);
+void tc_scroll(TermCanvas *canvas, int y, int height, int lines);
+int  tc_draw_text(TermCanvas *canvas, int y, int x, const wchar_t *text,
+                  Color foreground, Color background, TcEffect effect);
+void tc_mark_dirty(TermCanvas *canvas, int y, int x, int height, int width);
+void tc_set_dirty_tracking(TermCanvas *canvas, bool enabled);
+int  tc_char_width(wchar_t symbol);
+wchar_t tc_cluster(wchar_t base, const wchar_t *marks, int count);
+
+
+// -----------------------------------------------------------------------------
+//  Color Kernels
+//  Batch versions of the color.h math over a rectangle of pixels. Colors that
+//  are COLOR_NONE (terminal default) are left alone by the blending kernels.
+// -----------------------------------------------------------------------------
+void tc_blend_area(TermCanvas *canvas, int y, int x, int height, int width,
+                   Color color, uint8_t alpha, TcColorSlot slots);
+void tc_darken_area(TermCanvas *canvas, int y, int x, int height, int width, uint8_t amount, TcColorSlot slots);
+void tc_gradient_area(TermCanvas *canvas, int y, int x, int height, int width,
+                      Color from, Color to, bool vertical, TcColorSlot slots);
+
+
+// -----------------------------------------------------------------------------
+//  Compositing
+//  Layers are canvases stacked onto a target canvas by Coords.z (higher on top),
+//  at Coords.y/x in the target. Create them with TC_SINK_NONE so they never
+//  write to the terminal; only the target is presented.
+// -----------------------------------------------------------------------------
+TcCompositor *tc_compositor_create(TermCanvas *target);
+void tc_compositor_destroy(TcCompositor *compositor);
+bool tc_compositor_add(TcCompositor *compositor, TermCanvas *layer, Coords position);
+void tc_compositor_remove(TcCompositor *compositor, TermCanvas *layer);
+void tc_compositor_move(TcCompositor *compositor, TermCanvas *layer, Coords position);
+void tc_compositor_set_visible(TcCompositor *compositor, TermCanvas *layer, bool visible);
+void tc_compositor_update(TcCompositor *compositor);
+
+
+// -----------------------------------------------------------------------------
+//  Recording and Playback
+//  Presented frames are recorded as keyframes and cell deltas; the player
+//  maps a recording and feeds it back through the canvas and tc_show.
+// -----------------------------------------------------------------------------
+bool tc_record_start(TermCanvas *canvas, int fd, int keyframe_interval);
+bool tc_record_stop(TermCanvas *canvas);
+TcPlayer *tc_player_open(const char *path);
+void tc_player_close(TcPlayer *player);
+int  tc_player_frame_count(const TcPlayer *player);
+bool tc_player_seek(TcPlayer *player, TermCanvas *canvas, int frame);
+bool tc_player_step(TcPlayer *player, TermCanvas *canvas, long long *delay_ns);
+int  tc_player_play(TcPlayer *player, TermCanvas *canvas, double speed);
+
+
+// -----------------------------------------------------------------------------
+//  Broadcast
+//  One canvas presented to many terminals: a frame is encoded once per color
+//  mode in use and the same bytes are written to every client of that mode.
+// -----------------------------------------------------------------------------
+TcBroadcast *tc_broadcast_create(TermCanvas *source);
+void tc_broadcast_destroy(TcBroadcast *broadcast);
+bool tc_broadcast_add(TcBroadcast *broadcast, int fd, TcTerminalColorMode mode);
+void tc_broadcast_remove(TcBroadcast *broadcast, int fd);
+bool tc_broadcast_connected(const TcBroadcast *broadcast, int fd);
+int  tc_broadcast_present(TcBroadcast *broadcast);
+int  tc_broadcast_flush(TcBroadcast *broadcast);
+
+
+// -----------------------------------------------------------------------------
+//  Raster Surfaces
+//  Pixels finer than a cell, drawn into a packed raster and converted into
+//  canvas cells by tc_raster_present (only the cells that changed).
+// -----------------------------------------------------------------------------
+typedef enum {
+    Raster_HalfBlock, // 1 x 2 pixels per cell, each with its own color (upper/lower half blocks)
+    Raster_Braille,   // 2 x 4 dots per cell, one color per cell (braille patterns)
+} TcRasterMode;
+
+TcRaster *tc_raster_create(TermCanvas *canvas, int y, int x, int height, int width, TcRasterMode mode,
+                           Color background);
+void tc_raster_destroy(TcRaster *raster);
+int  tc_raster_width(const TcRaster *raster);
+int  tc_raster_height(const TcRaster *raster);
+void tc_raster_clear(TcRaster *raster);
+void tc_raster_plot(TcRaster *raster, int py, int px, Color color);
+void tc_raster_line(TcRaster *raster, int y0, int x0, int y1, int x1, Color color);
+void tc_raster_present(TcRaster *raster);
 
 
 
 #ifdef TERMCANVAS_IMPLEMENTATION
+/*
+ * Monotonic clock in nanoseconds (frame pacing and stats timing).
+ */
+static inline long long tc_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
 // -----------------------------------------------------------------------------
 //  Terminal Capability Detection
 // -----------------------------------------------------------------------------
 /*
  * Gets the size of the terminal.
  * It gets the size of the terminal by checking the terminal size using ioctl.
+ * When fd is not a terminal, COLUMNS/LINES are used if set (80x24 otherwise).
  */
-static void tc_get_terminal_size(TermCanvas *canvas) {
+static void tc_query_terminal_size(int fd, int *width, int *height) {
     int w = 80;
     int h = 24;
 
-    if (isatty(STDOUT_FILENO)) {
+    if (isatty(fd)) {
         struct winsize ws;
-        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != -1 && ws.ws_col > 0 && ws.ws_row > 0) {
+        if (ioctl(fd, TIOCGWINSZ, &ws) != -1 && ws.ws_col > 0 && ws.ws_row > 0) {
             w = ws.ws_col;
             h = ws.ws_row;
         }
     }
+    else {
+        const char *columns = getenv("COLUMNS");
+        const char *lines   = getenv("LINES");
+        if (columns && atoi(columns) > 0) w = atoi(columns);
+        if (lines   && atoi(lines)   > 0) h = atoi(lines);
+    }
     
-    canvas->terminal_w = w;
-    canvas->terminal_h = h;
+    *width  = w;
+    *height = h;
+}
+
+/*
+ * Resize notifications (process wide, the terminal is shared).
+ * Once watching, the size is only read again after tc_notify_resize.
+ */
+static volatile sig_atomic_t tc_resize_serial  = 0;     // Bumped by every notification
+static bool                  tc_resize_watched = false; // false: read the size every frame
+static struct sigaction      tc_resize_previous;        // Handler replaced by ours
+
+/*
+ * Marks the cached terminal size as stale. Async-signal-safe, so it can be
+ * called from the application's own SIGWINCH handler.
+ */
+void tc_notify_resize(void) {
+    tc_resize_serial = tc_resize_serial + 1;
+}
+
+static void tc_resize_signal(int sig, siginfo_t *info, void *context) {
+    tc_notify_resize();
+
+    // Keep whatever handler was installed before working, in the form it was installed in
+    if (tc_resize_previous.sa_flags & SA_SIGINFO) {
+        if (tc_resize_previous.sa_sigaction) tc_resize_previous.sa_sigaction(sig, info, context);
+    }
+    else if (tc_resize_previous.sa_handler != SIG_DFL && tc_resize_previous.sa_handler != SIG_IGN) {
+        tc_resize_previous.sa_handler(sig);
+    }
+}
+
+/*
+ * Stops reading the terminal size on every frame.
+ * With install_handler, a SIGWINCH handler is installed that calls
+ * tc_notify_resize (chaining to the previous handler, SA_SIGINFO ones
+ * included); without it, the application must call tc_notify_resize itself
+ * when the terminal resizes.
+ * Returns false if the handler could not be installed.
+ */
+bool tc_watch_resize(bool install_handler) {
+    static bool installed = false;
+
+    if (install_handler && !installed) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = tc_resize_signal;
+        sa.sa_flags     = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGWINCH, &sa, &tc_resize_previous) != 0) return false;
+        installed = true;
+    }
+
+    tc_resize_watched = true;
+    tc_notify_resize(); // The window may have changed before we started watching
+    return true;
+}
+
+/*
+ * Reads the terminal size for tc_show unless the cached one is still good.
+ * Returns true if the size changed since the last read.
+ */
+static bool tc_poll_terminal_size(TermCanvas *canvas) {
+    if (canvas->size_fixed) return false;
+    if (canvas->headless) {
+        // No terminal, it is always as large as the canvas
+        canvas->size_w = canvas->width;
+        canvas->size_h = canvas->height;
+        canvas->size_valid = true;
+        return false;
+    }
+
+    int serial = tc_resize_serial;
+    if (tc_resize_watched && canvas->size_valid && canvas->size_serial == serial) return false;
+    canvas->size_serial = serial; // Taken before reading, so a resize during the read is not lost
+
+    int w, h;
+    tc_query_terminal_size(canvas->sink.kind == Sink_Fd ? canvas->sink.fd : -1, &w, &h);
+    bool changed = canvas->size_valid && (w != canvas->size_w || h != canvas->size_h);
+
+    canvas->size_w = w;
+    canvas->size_h = h;
+    canvas->size_valid = true;
+    return changed;
+}
+
+/*
+ * Opens the compiled terminfo entry of a terminal in one directory.
+ * Entries live in <dir>/<first letter>/<name>, or <dir>/<hex of first letter>/<name> on macOS.
+ */
+static FILE *tc_terminfo_open(const char *dir, const char *term) {
+    char path[1024];
+    FILE *fp = NULL;
+
+    if (snprintf(path, sizeof(path), "%s/%c/%s", dir, term[0], term) < (int)sizeof(path)) {
+        fp = fopen(path, "rb");
+    }
+    if (!fp && snprintf(path, sizeof(path), "%s/%02x/%s", dir, (unsigned char)term[0], term) < (int)sizeof(path)) {
+        fp = fopen(path, "rb");
+    }
+    return fp;
 }
 
 /*
- * Checks if the 'tput' command exists in the system.
- * It checks if the 'tput' command exists in the system by trying to access it.
+ * Finds the terminfo entry of a terminal, searching the same places ncurses does:
+ * $TERMINFO, ~/.terminfo, $TERMINFO_DIRS, then the system directories.
  */
-static inline int tput_exists(void) {
-    return access("/usr/bin/tput", X_OK) == 0 || access("/bin/tput", X_OK) == 0;
+static FILE *tc_terminfo_find(const char *term) {
+    FILE *fp = NULL;
+
+    const char *terminfo = getenv("TERMINFO");
+    if (terminfo && *terminfo) fp = tc_terminfo_open(terminfo, term);
+
+    const char *home = getenv("HOME");
+    if (!fp && home && *home) {
+        char dir[1024];
+        if (snprintf(dir, sizeof(dir), "%s/.terminfo", home) < (int)sizeof(dir)) fp = tc_terminfo_open(dir, term);
+    }
+
+    const char *dirs = getenv("TERMINFO_DIRS");
+    while (!fp && dirs && *dirs) {
+        const char *end = strchr(dirs, ':');
+        size_t len = end ? (size_t)(end - dirs) : strlen(dirs);
+        char dir[1024];
+        if (len > 0 && len < sizeof(dir)) {
+            memcpy(dir, dirs, len);
+            dir[len] = '\0';
+            fp = tc_terminfo_open(dir, term);
+        }
+        dirs = end ? end + 1 : NULL;
+    }
+
+    static const char *const system_dirs[] = {
+        "/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo", "/usr/lib/terminfo", "/usr/share/lib/terminfo",
+    };
+    for (size_t i = 0; !fp && i < sizeof(system_dirs) / sizeof(system_dirs[0]); i++) {
+        fp = tc_terminfo_open(system_dirs[i], term);
+    }
+    return fp;
 }
 
 /*
- * Executes a 'tput' command and returns the integer result.
+ * Reads the max_colors capability ("colors") from the compiled terminfo entry
+ * of $TERM without running tput. Handles the legacy format (16-bit numbers)
+ * and the extended one (32-bit numbers, needed for 2^24 colors).
+ * Returns -1 if the entry or the capability is missing.
  */
-static int tput_command(const char *command) {
-    FILE *fp = popen(command, "r");
-    if (!fp) return -1; // Return -1 on failure
+static int tc_terminfo_colors(void) {
+    const char *term = getenv("TERM");
+    if (!term || !*term || strchr(term, '/')) return -1;
+
+    FILE *fp = tc_terminfo_find(term);
+    if (!fp) return -1;
+
+    enum { TerminfoMagic16 = 0432, TerminfoMagic32 = 01036, TerminfoMaxColors = 13 };
+
+    unsigned char header[12];
+    int colors = -1;
+    if (fread(header, 1, sizeof(header), fp) == sizeof(header)) {
+        int field[6];
+        for (int i = 0; i < 6; i++) field[i] = header[2 * i] | (header[2 * i + 1] << 8);
 
-    int result = -1;
-    if (fscanf(fp, "%d", &result) != 1) { // Check for fscanf errors
-        result = -1;
+        int magic       = field[0];
+        int names_size  = field[1];
+        int bool_count  = field[2];
+        int num_count   = field[3];
+        int num_size    = magic == TerminfoMagic32 ? 4 : 2;
+
+        // Numbers follow the names and booleans, aligned to an even offset
+        long offset = (long)sizeof(header) + names_size + bool_count;
+        if (offset & 1) offset++;
+        offset += (long)TerminfoMaxColors * num_size;
+
+        unsigned char number[4];
+        if ((magic == TerminfoMagic16 || magic == TerminfoMagic32) && num_count > TerminfoMaxColors &&
+            fseek(fp, offset, SEEK_SET) == 0 && fread(number, 1, (size_t)num_size, fp) == (size_t)num_size) {
+            if (num_size == 2) {
+                int value = number[0] | (number[1] << 8);
+                colors = value >= 0x8000 ? -1 : value; // Negative: absent or cancelled
+            }
+            else {
+                uint32_t value = (uint32_t)number[0] | ((uint32_t)number[1] << 8) |
+                                 ((uint32_t)number[2] << 16) | ((uint32_t)number[3] << 24);
+                colors = value >= 0x80000000u ? -1 : (int)value;
+            }
+        }
     }
-    pclose(fp);
+    fclose(fp);
 
-    return result;
+    return colors;
 }
 
 /*
  * Retrieves and caches the number of colors supported by the terminal.
- * It checks if the tput command exists and uses it to get the number of colors,
- * caching the result to avoid repeated calls.
+ * The terminfo entry is parsed once, later calls return the cached result.
  */
-static int get_cached_tput_colors(void) {
-    static int cached_colors = -2; // -2: uninitialized, -1: tput failed
+static int get_cached_terminfo_colors(void) {
+    static int cached_colors = -2; // -2: uninitialized, -1: not known
 
     if (cached_colors == -2) {
-        cached_colors = tput_exists() ? tput_command("tput colors 2>/dev/null") : -1;
+        cached_colors = tc_terminfo_colors();
     }
 
     return cached_colors;
@@ -166,9 +809,9 @@ static int get_cached_tput_colors(void) {
 /*
  * Checks if the terminal supports RGB (TrueColor) mode.
  * It checks if the COLORTERM environment variable matches common terminal types that often support TrueColor,
- * and uses tput if available to check for TrueColor support.
+ * and uses terminfo if available to check for TrueColor support.
  */
-static int supports_rgb(int tput_colors) {
+static int supports_rgb(int colors) {
     const char *colorterm = getenv("COLORTERM");
     if (colorterm && strstr(colorterm, "truecolor")) return 1;
 
@@ -177,8 +820,8 @@ static int supports_rgb(int tput_colors) {
                  strstr(term, "xterm-direct") || strstr(term, "xterm-truecolor"))) {
         return 1;
     }
-    if (tput_colors > 0) {
-        return tput_colors >= (1 << 24); // TrueColor requires at least 2^24 colors
+    if (colors > 0) {
+        return colors >= (1 << 24); // TrueColor requires at least 2^24 colors
     }
     return 0;
 }
@@ -186,9 +829,9 @@ static int supports_rgb(int tput_colors) {
 /*
  * Checks if the terminal supports 256 colors.
  * It checks if the TERM environment variable matches common terminal types that often support 256 colors,
- * and uses tput if available to check for 256-color support.
+ * and uses terminfo if available to check for 256-color support.
  */
-static int supports_256(int tput_colors) {
+static int supports_256(int colors) {
     const char *term = getenv("TERM");
     if (term && strstr(term, "256color")) return 1;
 
@@ -199,12 +842,12 @@ static int supports_256(int tput_colors) {
             strstr(term, "vt220")  || strstr(term, "ansi")  || strstr(term, "konsole")   ||
             strstr(term, "Eterm")  || strstr(term, "gnome") || strstr(term, "alacritty") ||
             strstr(term, "st")     || strstr(term, "foot")  || strstr(term, "kitty")) {
-            if (tput_colors > 0) return tput_colors >= 256; // Use tput if available
+            if (colors > 0) return colors >= 256; // Use terminfo if available
             return 1; // Assume 256-color support if TERM matches
         }
     }
 
-    if (tput_colors >= 256) return 1; // Fallback to tput result
+    if (colors >= 256) return 1; // Fallback to terminfo result
 
     return 0;
 }
@@ -215,10 +858,10 @@ static int supports_256(int tput_colors) {
  * and returns the appropriate TerminalMode enum value.
  */
 static TcTerminalColorMode get_terminal_mode(void) {
-    int tput_colors = get_cached_tput_colors();
+    int colors = get_cached_terminfo_colors();
 
-    if (supports_rgb(tput_colors)) return Color_RGB;
-    if (supports_256(tput_colors)) return Color_256;
+    if (supports_rgb(colors)) return Color_RGB;
+    if (supports_256(colors)) return Color_256;
 
     return Color_Base;
 }
@@ -229,384 +872,4536 @@ static TcTerminalColorMode get_terminal_mode(void) {
 //  ANSI Escape Code Generation (Color Conversion and Effect)
 // -----------------------------------------------------------------------------
 /*
- * Generates an ANSI escape sequence for text effects.
- * It formats the text effect into the ANSI escape sequence.
+ * Decimal representation of 0..255, built once for the SGR encoder.
+ * Color components are always in this range, so no printf is needed.
  */
-static char* get_effect_ansi(TcEffect effect) {
-    static char ansi_str[16];             // Buffer for the ANSI escape sequence
-    if (effect == Effect_None) return ""; // Return empty string if no effect
-
-    snprintf(ansi_str, sizeof(ansi_str), "\033[%dm", (int)effect);
-    return ansi_str;
-}
+static char          tc_digits[256][3];
+static unsigned char tc_digits_len[256];
+static bool          tc_digits_ready = false;
 
 /*
- * Converts RGB color to an ANSI escape sequence for TrueColor terminals.
- * It formats the RGB values into the ANSI escape sequence for TrueColor terminals.
+ * Fills the decimal digit table.
  */
-static char* rgb_to_ansi(Color fg_color, Color bg_color) {
-    static char ansi_str[128]; // Buffer for the ANSI escape sequence
-
-    snprintf(ansi_str, sizeof(ansi_str), "\033[38;2;%d;%d;%d;48;2;%d;%d;%dm",
-             get_red(fg_color), get_green(fg_color), get_blue(fg_color),
-             get_red(bg_color), get_green(bg_color), get_blue(bg_color));
+static void tc_init_digits(void) {
+    if (tc_digits_ready) return;
 
-    return ansi_str;
+    for (int i = 0; i < 256; i++) {
+        int len = 0;
+        if (i >= 100) tc_digits[i][len++] = (char)('0' + i / 100);
+        if (i >= 10)  tc_digits[i][len++] = (char)('0' + (i / 10) % 10);
+        tc_digits[i][len++] = (char)('0' + i % 10);
+        tc_digits_len[i] = (unsigned char)len;
+    }
+    tc_digits_ready = true;
 }
 
 /*
- * Converts RGB color to the nearest index in the 256-color palette.
- * It first checks for grayscale colors and maps them to the corresponding index,
- * then maps the RGB values to the 6x6x6 color cube and returns the corresponding index.
+ * Appends a byte value in decimal.
  */
-static int rgb_to_256_index(Color color) {
-    int r = get_red(color);
-    int g = get_green(color);
-    int b = get_blue(color);
+static inline int tc_put_u8(char *out, unsigned char value) {
+    const char *digits = tc_digits[value];
+    int len = tc_digits_len[value];
+    for (int i = 0; i < len; i++) out[i] = digits[i];
+    return len;
+}
 
-    // Check for grayscale colors first
-    int gray_index = -1;
-    float gray_step = 255.0f / 24.0f;
-    for (int i = 0; i < 24; i++) {
-        int gray_val = 8 + i * 10;
+/*
+ * Appends an unsigned integer in decimal (cursor positions, counts).
+ */
+static inline int tc_put_uint(char *out, unsigned int value) {
+    if (value < 256) return tc_put_u8(out, (unsigned char)value);
 
-        if (fabsf((float)(r - gray_val)) <= gray_step &&
-            fabsf((float)(g - gray_val)) <= gray_step &&
-            fabsf((float)(b - gray_val)) <= gray_step) {
-            gray_index = 232 + i;
-            break;
-        }
+    char tmp[10];
+    int len = 0;
+    while (value > 0) {
+        tmp[len++] = (char)('0' + value % 10);
+        value /= 10;
     }
-    if (gray_index >= 0) return gray_index;
+    for (int i = 0; i < len; i++) out[i] = tmp[len - 1 - i];
+    return len;
+}
 
-    // If not grayscale, map to the 6x6x6 color cube
-    int r_6 = (int)lroundf((float)r / 255.0f * 5.0f);
-    int g_6 = (int)lroundf((float)g / 255.0f * 5.0f);
-    int b_6 = (int)lroundf((float)b / 255.0f * 5.0f);
+/*
+ * Appends a plain ASCII string (escape sequence literals).
+ */
+static inline int tc_put_str(char *out, const char *str) {
+    int len = 0;
+    while (str[len]) {
+        out[len] = str[len];
+        len++;
+    }
+    return len;
+}
 
-    return 16 + 36 * r_6 + 6 * g_6 + b_6;
+/*
+ * Number of decimal digits tc_put_uint writes.
+ */
+static inline int tc_uint_digits(unsigned int value) {
+    int len = 1;
+    while (value >= 10) {
+        value /= 10;
+        len++;
+    }
+    return len;
 }
 
 /*
- * Converts RGB colors to the nearest ANSI escape sequence for 256-color terminals.
- * It first converts the RGB values to the nearest index in the 256-color palette,
- * then returns the corresponding ANSI escape sequence.
+ * Length of the UTF-8 sequence tc_put_utf8 writes for a symbol.
  */
-static char* rgb_to_ansi_256(Color fg_color, Color bg_color) {
-    static char ansi_str[64]; // Buffer for the ANSI escape sequence
+static inline int tc_utf8_len(wchar_t symbol) {
+    uint32_t cp = (uint32_t)symbol;
+    if (cp < 0x80)  return 1;
+    if (cp < 0x800) return 2;
+    if (cp >= 0x110000 || (cp >= 0xD800 && cp <= 0xDFFF)) return 3; // Replacement character
+    return cp < 0x10000 ? 3 : 4;
+}
 
-    snprintf(ansi_str, sizeof(ansi_str), "\033[38;5;%d;48;5;%dm",
-             rgb_to_256_index(fg_color), rgb_to_256_index(bg_color));
+/*
+ * Appends a symbol encoded as UTF-8.
+ * Control characters and invalid code points are replaced so they can't
+ * move the cursor or break the terminal state.
+ */
+static inline int tc_put_utf8(char *out, wchar_t symbol) {
+    uint32_t cp = (uint32_t)symbol;
 
-    return ansi_str;
+    if (cp < 0x80) {
+        out[0] = (cp < 0x20 || cp == 0x7F) ? ' ' : (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp >= 0x110000 || (cp >= 0xD800 && cp <= 0xDFFF)) cp = 0xFFFD; // Replacement character
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
 }
 
+
+// -----------------------------------------------------------------------------
+//  Symbol Width
+// -----------------------------------------------------------------------------
 /*
- * Converts RGB colors to the nearest ANSI escape sequence for basic 8/16 color terminals.
- * It first calculates the Euclidean distance between the RGB values and the basic colors,
- * then selects the closest color and returns the corresponding ANSI escape sequence.
+ * Code point ranges that don't take one column. Built into a 2-bit table
+ * of the BMP on first use, so widths never depend on the locale and cost
+ * one load per lookup. Covers combining marks of the common scripts, East
+ * Asian wide and fullwidth forms, and emoji.
  */
-static char *rgb_to_ansi_base(Color fg_color, Color bg_color) {
-    static char ansi_str[32];  // Buffer for the ANSI escape sequence
-    int r_fg = get_red(fg_color);
-    int g_fg = get_green(fg_color);
-    int b_fg = get_blue(fg_color);
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} TcRange;
 
-    int r_bg = get_red(bg_color);
-    int g_bg = get_green(bg_color);
-    int b_bg = get_blue(bg_color);
+static const TcRange tc_zero_width_ranges[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2},
+    {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670},
+    {0x06D6, 0x06DC}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711},
+    {0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x07EB, 0x07F3}, {0x0816, 0x082D}, {0x0859, 0x085B},
+    {0x08D3, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D},
+    {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981}, {0x09BC, 0x09BC}, {0x09C1, 0x09C4},
+    {0x09CD, 0x09CD}, {0x09E2, 0x09E3}, {0x0A01, 0x0A02}, {0x0A3C, 0x0A3C}, {0x0A41, 0x0A51},
+    {0x0A70, 0x0A71}, {0x0A81, 0x0A82}, {0x0ABC, 0x0ABC}, {0x0AC1, 0x0AC8}, {0x0ACD, 0x0ACD},
+    {0x0B01, 0x0B01}, {0x0B3C, 0x0B3C}, {0x0B41, 0x0B44}, {0x0B4D, 0x0B4D}, {0x0BC0, 0x0BC0},
+    {0x0BCD, 0x0BCD}, {0x0C3E, 0x0C40}, {0x0C46, 0x0C56}, {0x0CBC, 0x0CBC}, {0x0CCC, 0x0CCD},
+    {0x0D41, 0x0D44}, {0x0D4D, 0x0D4D}, {0x0DCA, 0x0DCA}, {0x0DD2, 0x0DD6}, {0x0E31, 0x0E31},
+    {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECD},
+    {0x0F18, 0x0F19}, {0x0F35, 0x0F35}, {0x0F37, 0x0F37}, {0x0F39, 0x0F39}, {0x0F71, 0x0F7E},
+    {0x0F80, 0x0F84}, {0x0F86, 0x0F87}, {0x0F8D, 0x0FBC}, {0x102D, 0x1030}, {0x1032, 0x1037},
+    {0x1039, 0x103A}, {0x1160, 0x11FF}, {0x135D, 0x135F}, {0x1712, 0x1714}, {0x17B4, 0x17B5},
+    {0x17B7, 0x17BD}, {0x17C6, 0x17C6}, {0x17C9, 0x17D3}, {0x180B, 0x180F}, {0x1AB0, 0x1AFF},
+    {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x2028, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20F0},
+    {0x302A, 0x302D}, {0x3099, 0x309A}, {0xA66F, 0xA672}, {0xA674, 0xA67D}, {0xA69E, 0xA69F},
+    {0xA8E0, 0xA8F1}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF},
+    {0x1D167, 0x1D169}, {0x1D17B, 0x1D182}, {0xE0000, 0xE0FFF},
+};
 
-    // Find the closest basic color index for foreground
-    int index_fg = 0;
-    float min_dist_fg = 1e9f; // Initialize with a large value
+static const TcRange tc_wide_ranges[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+    {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+    {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+    {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+    {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+    {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+    {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+    {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+    {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6},
+    {0x16FE0, 0x16FE4}, {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF},
+    {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251}, {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF},
+    {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
 
-    // Find the closest basic color index for background
-    int index_bg = 0;
-    float min_dist_bg = 1e9f;
+#define TC_RANGE_COUNT(ranges) ((int)(sizeof(ranges) / sizeof((ranges)[0])))
 
-    // Standard 8 colors (black, red, green, yellow, blue, magenta, cyan, white)
-    int basic_colors[8][3] = {
-        {0, 0, 0},      // Black
-        {128, 0, 0},    // Red
-        {0, 128, 0},    // Green
-        {128, 128, 0},  // Yellow
-        {0, 0, 128},    // Blue
-        {128, 0, 128},  // Magenta
-        {0, 128, 128},  // Cyan
-        {192, 192, 192} // Light Gray (NOT White)
-    };
+static uint8_t tc_width_table[0x10000 / 4]; // 2 bits per BMP code point
+static bool    tc_width_ready = false;
 
-    // Bright 8 colors (corresponding bright versions)
-    int bright_colors[8][3] = {
-        {128, 128, 128},  // Dark Gray (Bright Black)
-        {255, 0, 0},      // Bright Red
-        {0, 255, 0},      // Bright Green
-        {255, 255, 0},    // Bright Yellow
-        {0, 0, 255},      // Bright Blue
-        {255, 0, 255},    // Bright Magenta
-        {0, 255, 255},    // Bright Cyan
-        {255, 255, 255}   // Bright White
-    };
+static void tc_init_width_table(void) {
+    if (tc_width_ready) return;
 
-    // Calculate Euclidean distance to find the closest basic color (foreground)
-    for (int i = 0; i < 8; i++) {
-        float dist = (float)sqrt(pow(r_fg - basic_colors[i][0], 2) +
-                                 pow(g_fg - basic_colors[i][1], 2) +
-                                 pow(b_fg - basic_colors[i][2], 2));
-        if (dist < min_dist_fg) {
-            min_dist_fg = dist;
-            index_fg = i;
-        }
-        // Calculate Euclidean distance for background
-        dist = (float)sqrt(pow(r_bg - basic_colors[i][0], 2) +
-                           pow(g_bg - basic_colors[i][1], 2) +
-                           pow(b_bg - basic_colors[i][2], 2));
-        if (dist < min_dist_bg) {
-            min_dist_bg = dist;
-            index_bg = i;
-        }
-    }
+    memset(tc_width_table, 0x55, sizeof(tc_width_table)); // Every code point one column
+    for (int pass = 0; pass < 2; pass++) {
+        // Wide first: zero-width marks inside wide blocks (kana voicing marks) win
+        const TcRange *ranges = pass == 0 ? tc_wide_ranges : tc_zero_width_ranges;
+        int count = pass == 0 ? TC_RANGE_COUNT(tc_wide_ranges) : TC_RANGE_COUNT(tc_zero_width_ranges);
+        uint8_t width = pass == 0 ? 2 : 0;
 
-    // Calculate Euclidean distance to find the closest bright color (foreground)
-    for (int i = 0; i < 8; i++) {
-        float dist = (float)sqrt(pow(r_fg - bright_colors[i][0], 2) +
-                                 pow(g_fg - bright_colors[i][1], 2) +
-                                 pow(b_fg - bright_colors[i][2], 2));
-        if (dist < min_dist_fg) {
-            min_dist_fg = dist;
-            index_fg = i + 8; // Offset index for bright colors
-        }
-        //background
-        dist = (float)sqrt(pow(r_bg - bright_colors[i][0], 2) +
-                           pow(g_bg - bright_colors[i][1], 2) +
-                           pow(b_bg - bright_colors[i][2], 2));
-        if (dist < min_dist_bg) {
-            min_dist_bg = dist;
-            index_bg = i + 8;
+        for (int i = 0; i < count && ranges[i].first < 0x10000; i++) {
+            for (uint32_t cp = ranges[i].first; cp <= ranges[i].last; cp++) {
+                int shift = (int)(cp & 3) * 2;
+                tc_width_table[cp >> 2] = (uint8_t)((tc_width_table[cp >> 2] & ~(3 << shift)) | (width << shift));
+            }
         }
     }
-    // Determine ANSI color codes based on foreground and background indices
-    int fg_code = (index_fg < 8) ? (30 + index_fg) : (90 + (index_fg - 8));  // 30-37 or 90-97
-    int bg_code = (index_bg < 8) ? (40 + index_bg) : (100 + (index_bg - 8)); // 40-47 or 100-107
+    tc_width_ready = true;
+}
 
-    snprintf(ansi_str, sizeof(ansi_str), "\033[%d;%dm", fg_code, bg_code);
-    return ansi_str;
+static inline bool tc_in_ranges(const TcRange *ranges, int count, uint32_t cp) {
+    for (int i = 0; i < count; i++) {
+        if (cp >= ranges[i].first && cp <= ranges[i].last) return true;
+    }
+    return false;
 }
 
 /*
- * Selects the appropriate ANSI escape sequence based on the terminal color mode.
- * Uses different conversion functions based on the color mode:
- * - Color_RGB: Uses rgb_to_ansi for TrueColor terminals
- * - Color_256: Uses rgb_to_ansi_256 for 256-color terminals
- * - Color_Base: Uses rgb_to_ansi_base for basic 8/16 color terminals
+ * Combining marks stored with their base symbol. A cluster is named by a
+ * symbol from TC_CLUSTER_BASE on; clusters are kept for the whole process
+ * and never freed, since any canvas (or frame snapshot) may show them.
+ * Entries don't change once added, so lookups take no lock: tc_cluster
+ * fills in an entry before it publishes the new count (release), and
+ * tc_cluster_of reads the count first (acquire), so a presenter thread
+ * never sees an id without its entry.
  */
-static char* get_color_ansi(Color fg_color, Color bg_color, TcTerminalColorMode mode) {
-    switch (mode) {
-        case Color_RGB:   return rgb_to_ansi(fg_color, bg_color);
-        case Color_256:   return rgb_to_ansi_256(fg_color, bg_color);
-        case Color_Base:  return rgb_to_ansi_base(fg_color, bg_color);
-        default:          return ""; // Should not happen, but return empty string for safety
-    }
+typedef struct {
+    wchar_t base;
+    wchar_t marks[TC_CLUSTER_MARKS];
+    int     count;
+} TcCluster;
+
+static TcCluster tc_clusters[TC_CLUSTER_MAX];
+static int       tc_cluster_count = 0;
+static uint16_t  tc_cluster_index[2 * TC_CLUSTER_MAX]; // Open addressing, id + 1 (0: empty)
+#ifdef TC_USE_THREADS
+static pthread_mutex_t tc_cluster_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline int tc_clusters_published(void) {
+    #ifdef TC_USE_THREADS
+    return __atomic_load_n(&tc_cluster_count, __ATOMIC_ACQUIRE);
+    #else
+    return tc_cluster_count;
+    #endif
 }
 
+static inline void tc_clusters_publish(int count) {
+    #ifdef TC_USE_THREADS
+    __atomic_store_n(&tc_cluster_count, count, __ATOMIC_RELEASE);
+    #else
+    tc_cluster_count = count;
+    #endif
+}
 
+static inline const TcCluster *tc_cluster_of(uint32_t cp) {
+    uint32_t id = cp - TC_CLUSTER_BASE;
+    return cp >= TC_CLUSTER_BASE && id < (uint32_t)tc_clusters_published() ? &tc_clusters[id] : NULL;
+}
 
-// -----------------------------------------------------------------------------
-//  Canvas Functionality
-// -----------------------------------------------------------------------------
 /*
- * Initializes an empty canvas.
- * Creates the canvas structure with cleared buffers
+ * Columns a symbol takes on the terminal: 2 for wide glyphs, 0 for
+ * combining marks and continuation cells, 1 for everything else
+ * (control characters too, they are written as spaces).
  */
-#ifdef USE_ARENA
-TermCanvas *tc_create(Arena *arena, int width, int height, wchar_t symbol, Color foreground, Color background) {
+static inline int tc_symbol_width(uint32_t cp) {
+    if (cp < 0x300) return 1;
+    if (cp < 0x10000) {
+        if (!tc_width_ready) tc_init_width_table();
+        return (tc_width_table[cp >> 2] >> ((cp & 3) * 2)) & 3;
+    }
+    if (cp < TC_CLUSTER_BASE) {
+        if (tc_in_ranges(tc_wide_ranges, TC_RANGE_COUNT(tc_wide_ranges), cp)) return 2;
+        return tc_in_ranges(tc_zero_width_ranges, TC_RANGE_COUNT(tc_zero_width_ranges), cp) ? 0 : 1;
+    }
+    if (cp == TC_WIDE_CONT) return 0;
+
+    const TcCluster *cluster = tc_cluster_of(cp);
+    return cluster ? tc_symbol_width((uint32_t)cluster->base) : 1;
+}
+
+/*
+ * Public width lookup, for laying out text the way the renderer will.
+ */
+int tc_char_width(wchar_t symbol) {
+    return tc_symbol_width((uint32_t)symbol);
+}
+
+/*
+ * Returns the symbol for base followed by count combining marks (as
+ * tc_draw_text builds them). base may already be a cluster, the marks
+ * are added to it. Marks past TC_CLUSTER_MARKS and marks outside the BMP
+ * are dropped. The table is process-wide and holds TC_CLUSTER_MAX distinct
+ * clusters for the life of the process; once it is full, clusters already
+ * in it are still found, but any new one comes back as its bare base.
+ */
+wchar_t tc_cluster(wchar_t base, const wchar_t *marks, int count) {
+    TcCluster cluster = {base, {0}, 0};
+    const TcCluster *existing = tc_cluster_of((uint32_t)base);
+    if (existing) cluster = *existing;
+    if (tc_symbol_width((uint32_t)cluster.base) == 0) return base; // Marks need something to sit on
+
+    for (int i = 0; i < count && cluster.count < TC_CLUSTER_MARKS; i++) {
+        if ((uint32_t)marks[i] < 0x10000) cluster.marks[cluster.count++] = marks[i];
+    }
+    if (cluster.count == 0 || (existing && cluster.count == existing->count)) return base;
+
+    uint32_t hash = (uint32_t)cluster.base * 0x9E3779B1u;
+    for (int i = 0; i < cluster.count; i++) hash = (hash ^ (uint32_t)cluster.marks[i]) * 0x9E3779B1u;
+
+    #ifdef TC_USE_THREADS
+    pthread_mutex_lock(&tc_cluster_lock);
+    #endif
+    wchar_t symbol = base;
+    uint32_t mask = 2 * TC_CLUSTER_MAX - 1;
+    for (uint32_t slot = hash >> 16; ; slot++) {
+        uint16_t entry = tc_cluster_index[slot & mask];
+        if (entry == 0) {
+            int id = tc_cluster_count; // Only written under the lock
+            if (id == TC_CLUSTER_MAX) break; // Full: the marks are dropped
+            tc_clusters[id] = cluster;
+            tc_cluster_index[slot & mask] = (uint16_t)(id + 1);
+            tc_clusters_publish(id + 1); // After the entry, for lock-free tc_cluster_of
+            symbol = (wchar_t)(TC_CLUSTER_BASE + (uint32_t)(id));
+            break;
+        }
+
+        const TcCluster *other = &tc_clusters[entry - 1];
+        if (other->base == cluster.base && other->count == cluster.count &&
+            memcmp(other->marks, cluster.marks, sizeof(wchar_t) * (size_t)(cluster.count)) == 0) {
+            symbol = (wchar_t)(TC_CLUSTER_BASE + (uint32_t)(entry - 1));
+            break;
+        }
+    }
+    #ifdef TC_USE_THREADS
+    pthread_mutex_unlock(&tc_cluster_lock);
+    #endif
+    return symbol;
+}
+
+/*
+ * Appends the symbol of a cell that is not printable ASCII (at most
+ * TC_CELL_BYTES), keeping the terminal cursor at one column per cell:
+ * a wide glyph only goes out when its continuation cell follows, and
+ * the continuation cell writes nothing after it. Half a wide glyph is
+ * written as a space, a lone combining mark on one.
+ * cell points into a row of width cells, at the given column.
+ */
+static inline int tc_put_cell(char *out, const TcPixel *cell, int column, int width) {
+    uint32_t cp = (uint32_t)cell->symbol;
+
+    if (cp == TC_WIDE_CONT) {
+        if (column > 0 && tc_symbol_width((uint32_t)cell[-1].symbol) == 2) return 0; // Covered by the glyph before
+        out[0] = ' ';
+        return 1;
+    }
+
+    int symbol_width = tc_symbol_width(cp);
+    if (symbol_width == 2 && !(column + 1 < width && (uint32_t)cell[1].symbol == TC_WIDE_CONT)) {
+        out[0] = ' ';
+        return 1;
+    }
+
+    int len = 0;
+    if (symbol_width == 0) out[len++] = ' ';
+
+    const TcCluster *cluster = tc_cluster_of(cp);
+    if (!cluster) return len + tc_put_utf8(out + len, (wchar_t)cp);
+
+    len += tc_put_utf8(out + len, cluster->base);
+    for (int i = 0; i < cluster->count; i++) len += tc_put_utf8(out + len, cluster->marks[i]);
+    return len;
+}
+
+/*
+ * Converts RGB color to the nearest index of the basic 8/16 color palette.
+ * It calculates the Euclidean distance between the RGB values and the basic colors,
+ * and returns the closest one (0-7 normal, 8-15 bright).
+ */
+static int rgb_to_base_index(Color color) {
+    int r = get_red(color);
+    int g = get_green(color);
+    int b = get_blue(color);
+
+    // Standard 8 colors followed by their bright versions
+    static const int palette[16][3] = {
+        {0, 0, 0},        // Black
+        {128, 0, 0},      // Red
+        {0, 128, 0},      // Green
+        {128, 128, 0},    // Yellow
+        {0, 0, 128},      // Blue
+        {128, 0, 128},    // Magenta
+        {0, 128, 128},    // Cyan
+        {192, 192, 192},  // Light Gray (NOT White)
+        {128, 128, 128},  // Dark Gray (Bright Black)
+        {255, 0, 0},      // Bright Red
+        {0, 255, 0},      // Bright Green
+        {255, 255, 0},    // Bright Yellow
+        {0, 0, 255},      // Bright Blue
+        {255, 0, 255},    // Bright Magenta
+        {0, 255, 255},    // Bright Cyan
+        {255, 255, 255}   // Bright White
+    };
+
+    int index = 0;
+    int min_dist = 1 << 30; // Squared distance, no need for sqrt to compare
+
+    for (int i = 0; i < 16; i++) {
+        int dr = r - palette[i][0];
+        int dg = g - palette[i][1];
+        int db = b - palette[i][2];
+        int dist = dr * dr + dg * dg + db * db;
+        if (dist < min_dist) {
+            min_dist = dist;
+            index = i;
+        }
+    }
+    return index;
+}
+
+/*
+ * Palette lookup tables, built once and read-only afterwards.
+ * - 256 colors: per-channel tables for the 6x6x6 cube step and the range
+ *   of grayscale ramp entries a channel is close enough to.
+ * - 16 colors: a 15-bit table (5 bits per channel). Palette regions are
+ *   convex, so a bucket whose 8 corners agree maps entirely to that entry;
+ *   the few buckets on a region border fall back to rgb_to_base_index.
+ */
+#define TC_LUT_SIZE (1 << 15)
+#define TC_LUT_MISS 0xFF
+static unsigned char tc_lut_cube[256];
+static signed char   tc_lut_gray_lo[256];
+static signed char   tc_lut_gray_hi[256];
+static unsigned char tc_lut_base[TC_LUT_SIZE];
+static bool          tc_lut_256_ready  = false;
+static bool          tc_lut_base_ready = false;
+
+/*
+ * Reduces a color to its 15-bit lookup table key.
+ */
+static inline int tc_lut_key(Color color) {
+    return ((get_red(color) >> 3) << 10) | ((get_green(color) >> 3) << 5) | (get_blue(color) >> 3);
+}
+
+/*
+ * Fills the palette lookup tables needed by the given color mode.
+ * The 16-color table takes a few milliseconds, so it is only built for Color_Base.
+ */
+static void tc_init_color_luts(TcTerminalColorMode mode) {
+    for (int c = 0; c < 256 && !tc_lut_256_ready; c++) {
+        // Nearest cube step, round(c / 255 * 5) in integers
+        tc_lut_cube[c] = (unsigned char)((10 * c + 255) / 510);
+
+        // Gray entries i with |c - (8 + 10i)| <= 255/24, scaled by 8 to stay exact
+        int lo = (8 * c - 149 + 79) / 80;
+        int hi = (8 * c + 21) / 80;
+        if (8 * c - 149 < 0) lo = 0;
+        if (hi > 23) hi = 23;
+        tc_lut_gray_lo[c] = (signed char)lo;
+        tc_lut_gray_hi[c] = (signed char)hi;
+    }
+    tc_lut_256_ready = true;
+
+    if (mode != Color_Base || tc_lut_base_ready) return;
+
+    for (int key = 0; key < TC_LUT_SIZE; key++) {
+        int r = ((key >> 10) & 0x1F) << 3;
+        int g = ((key >> 5)  & 0x1F) << 3;
+        int b = (key         & 0x1F) << 3;
+
+        int index = -1;
+        for (int corner = 0; corner < 8; corner++) {
+            Color color = (Color){(uint32_t)((r + (corner & 1 ? 7 : 0)) << 16 |
+                                             (g + (corner & 2 ? 7 : 0)) << 8  |
+                                             (b + (corner & 4 ? 7 : 0)))};
+            int corner_index = rgb_to_base_index(color);
+            if (index == -1) index = corner_index;
+            if (index != corner_index) {
+                index = TC_LUT_MISS;
+                break;
+            }
+        }
+        tc_lut_base[key] = (unsigned char)index;
+    }
+    tc_lut_base_ready = true;
+}
+
+/*
+ * Converts RGB color to the nearest index in the 256-color palette.
+ * Grayscale ramp entries (232-255) win if one is close to all three channels,
+ * otherwise the color is mapped to the 6x6x6 color cube (16-231).
+ */
+static inline int rgb_to_256_index(Color color) {
+    int r = get_red(color);
+    int g = get_green(color);
+    int b = get_blue(color);
+
+    // Grayscale if some ramp entry is close to all three channels (lowest one wins)
+    int lo = tc_lut_gray_lo[r];
+    int hi = tc_lut_gray_hi[r];
+    if (tc_lut_gray_lo[g] > lo) lo = tc_lut_gray_lo[g];
+    if (tc_lut_gray_lo[b] > lo) lo = tc_lut_gray_lo[b];
+    if (tc_lut_gray_hi[g] < hi) hi = tc_lut_gray_hi[g];
+    if (tc_lut_gray_hi[b] < hi) hi = tc_lut_gray_hi[b];
+    if (lo <= hi) return 232 + lo;
+
+    return 16 + 36 * tc_lut_cube[r] + 6 * tc_lut_cube[g] + tc_lut_cube[b];
+}
+
+/*
+ * Table driven version of rgb_to_base_index.
+ */
+static inline int tc_color_to_base(Color color) {
+    int index = tc_lut_base[tc_lut_key(color)];
+    return index != TC_LUT_MISS ? index : rgb_to_base_index(color);
+}
+
+/*
+ * Appends the SGR parameters selecting a foreground or background color.
+ * Uses different encodings based on the color mode:
+ * - Color_RGB:  38;2;r;g;b / 48;2;r;g;b for TrueColor terminals
+ * - Color_256:  38;5;n / 48;5;n for 256-color terminals
+ * - Color_Base: 30-37, 90-97 / 40-47, 100-107 for basic 8/16 color terminals
+ */
+static int tc_encode_color(char *out, Color color, bool background, TcTerminalColorMode mode) {
+    int len = 0;
+
+    switch (mode) {
+        case Color_RGB:
+            out[len++] = background ? '4' : '3';
+            out[len++] = '8';
+            out[len++] = ';';
+            out[len++] = '2';
+            out[len++] = ';';
+            len += tc_put_u8(out + len, get_red(color));
+            out[len++] = ';';
+            len += tc_put_u8(out + len, get_green(color));
+            out[len++] = ';';
+            len += tc_put_u8(out + len, get_blue(color));
+            break;
+        case Color_256:
+            out[len++] = background ? '4' : '3';
+            out[len++] = '8';
+            out[len++] = ';';
+            out[len++] = '5';
+            out[len++] = ';';
+            len += tc_put_u8(out + len, (unsigned char)rgb_to_256_index(color));
+            break;
+        case Color_Base: {
+            int index = tc_color_to_base(color);
+            int code  = (index < 8) ? (30 + index) : (90 + (index - 8)); // 30-37 or 90-97
+            if (background) code += 10;                                  // 40-47 or 100-107
+            len += tc_put_u8(out + len, (unsigned char)code);
+            break;
+        }
+        default:
+            out[len++] = background ? '4' : '3'; // Should not happen, fall back to the default color
+            out[len++] = '9';
+            break;
+    }
+    return len;
+}
+
+/*
+ * Appends a complete SGR sequence: reset, effect, foreground and background.
+ * Everything is combined into a single "ESC [ ... m" sequence.
+ * COLOR_NONE stands for the terminal's default color, which the reset
+ * already selects, so it is left out.
+ */
+static int tc_encode_sgr(char *out, Color fg_color, Color bg_color, TcEffect effect, TcTerminalColorMode mode) {
+    int len = 0;
+
+    out[len++] = '\033';
+    out[len++] = '[';
+    out[len++] = '0';
+    if (effect != Effect_None) {
+        out[len++] = ';';
+        len += tc_put_u8(out + len, (unsigned char)effect);
+    }
+    if (!is_none(fg_color)) {
+        out[len++] = ';';
+        len += tc_encode_color(out + len, fg_color, false, mode);
+    }
+    if (!is_none(bg_color)) {
+        out[len++] = ';';
+        len += tc_encode_color(out + len, bg_color, true, mode);
+    }
+    out[len++] = 'm';
+
+    return len;
+}
+
+/*
+ * SGR code that turns an effect off again (0 for Effect_None).
+ */
+static unsigned char tc_effect_off_code(TcEffect effect) {
+    switch (effect) {
+        case Effect_Bold:      return 22;
+        case Effect_Italic:    return 23;
+        case Effect_Underline: return 24;
+        case Effect_Blink:     return 25;
+        case Effect_Reverse:   return 27;
+        case Effect_Conceal:   return 28;
+        default:               return 0;
+    }
+}
+
+/*
+ * Appends the shortest SGR sequence that takes the terminal from one set of
+ * attributes to another: only what differs is sent (effect off/on codes,
+ * 39/49 for default colors), unless a full reset-then-set is shorter.
+ * Nothing is appended if the attributes are the same.
+ */
+static int tc_encode_sgr_transition(char *out, Color from_fg, Color from_bg, TcEffect from_effect,
+                                    Color fg_color, Color bg_color, TcEffect effect, TcTerminalColorMode mode) {
+    bool effect_changed = effect != from_effect;
+    bool fg_changed     = fg_color.color != from_fg.color;
+    bool bg_changed     = bg_color.color != from_bg.color;
+    if (!effect_changed && !fg_changed && !bg_changed) return 0;
+
+    int  len       = 0;
+    bool turns_off = false; // Only then can a full reset come out shorter
+    out[len++] = '\033';
+    out[len++] = '[';
+
+    if (effect_changed) {
+        if (from_effect != Effect_None) {
+            len += tc_put_u8(out + len, tc_effect_off_code(from_effect));
+            out[len++] = ';';
+            turns_off = true;
+        }
+        if (effect != Effect_None) {
+            len += tc_put_u8(out + len, (unsigned char)effect);
+            out[len++] = ';';
+        }
+    }
+    if (fg_changed) {
+        if (is_none(fg_color)) {
+            out[len++] = '3';
+            out[len++] = '9';
+            turns_off = true;
+        }
+        else len += tc_encode_color(out + len, fg_color, false, mode);
+        out[len++] = ';';
+    }
+    if (bg_changed) {
+        if (is_none(bg_color)) {
+            out[len++] = '4';
+            out[len++] = '9';
+            turns_off = true;
+        }
+        else len += tc_encode_color(out + len, bg_color, true, mode);
+        out[len++] = ';';
+    }
+    out[len - 1] = 'm'; // Replaces the last separator
+
+    if (turns_off) {
+        char full[MAX_ANSI_LENGTH];
+        int full_len = tc_encode_sgr(full, fg_color, bg_color, effect, mode);
+        if (full_len < len) {
+            memcpy(out, full, (size_t)(full_len));
+            len = full_len;
+        }
+    }
+    return len;
+}
+
+// -----------------------------------------------------------------------------
+//  Style Table
+// -----------------------------------------------------------------------------
+#define TC_STYLE_MAX         512    // Styles interned per frame before the cache gives up
+#define TC_STYLE_INDEX       1024   // Hash slots (power of two, twice TC_STYLE_MAX)
+#define TC_STYLE_TRANSITIONS 512    // Cached style to style sequences (power of two)
+#define TC_STYLE_NONE        0xFFFF // No style id
+#define TC_STYLE_SGR_BYTES   48     // Stored sequence size; always copied whole (a fixed-size
+                                    // copy is much cheaper than an exact one), only len counts
+_Static_assert(TC_STYLE_SGR_BYTES <= MAX_ANSI_LENGTH, "cached sequences must fit the room tc_emit_run reserves");
+
+/*
+ * An interned (foreground, background, effect) combination and its full
+ * reset-then-set SGR sequence, as tc_encode_sgr builds it.
+ */
+typedef struct {
+    Color    fg;
+    Color    bg;
+    TcEffect effect;
+    uint8_t  len;
+    char     sgr[TC_STYLE_SGR_BYTES];
+} TcStyle;
+
+/*
+ * Cached tc_encode_sgr_transition result for one pair of styles.
+ */
+typedef struct {
+    uint32_t key; // from << 16 | to (UINT32_MAX: empty)
+    uint8_t  len;
+    char     sgr[TC_STYLE_SGR_BYTES];
+} TcStyleTransition;
+
+/*
+ * Style registry of one encoder.
+ * Frames use few distinct attribute combinations, so each one gets a 16-bit
+ * id and its sequences are built once; a style change while rendering is
+ * then a hash lookup and a memcpy. Everything is encoded for one color mode
+ * and thrown away when the mode changes, or at the start of a frame once the
+ * table is full (until then, styles past TC_STYLE_MAX are encoded directly).
+ */
+struct TcStyleTable {
+    TcTerminalColorMode mode;
+    int               count;
+    uint16_t          index[TC_STYLE_INDEX]; // Style id + 1 (0: empty slot)
+    TcStyle           styles[TC_STYLE_MAX];
+    TcStyleTransition transitions[TC_STYLE_TRANSITIONS];
+};
+
+static void tc_style_table_reset(TcStyleTable *table, TcTerminalColorMode mode) {
+    table->mode  = mode;
+    table->count = 0;
+    memset(table->index, 0, sizeof(table->index));
+    for (int i = 0; i < TC_STYLE_TRANSITIONS; i++) table->transitions[i].key = UINT32_MAX;
+}
+
+/*
+ * Prepares a table for a frame in the given mode.
+ */
+static inline void tc_style_table_begin(TcStyleTable *table, TcTerminalColorMode mode) {
+    if (table && (table->mode != mode || table->count == TC_STYLE_MAX)) tc_style_table_reset(table, mode);
+}
+
+static inline uint32_t tc_style_hash(Color fg, Color bg, TcEffect effect) {
+    uint32_t h = fg.color * 0x9E3779B1u ^ bg.color * 0x85EBCA77u ^ (uint32_t)effect * 0xC2B2AE3Du;
+    return h ^ (h >> 15);
+}
+
+/*
+ * Returns the id of a style, interning it (and building its sequence) if new.
+ * Returns TC_STYLE_NONE once the table is full.
+ */
+static uint16_t tc_style_intern(TcStyleTable *table, Color fg, Color bg, TcEffect effect) {
+    uint32_t slot = tc_style_hash(fg, bg, effect) & (TC_STYLE_INDEX - 1);
+    for (;;) {
+        uint16_t entry = table->index[slot];
+        if (entry == 0) break;
+
+        const TcStyle *style = &table->styles[entry - 1];
+        if (style->fg.color == fg.color && style->bg.color == bg.color && style->effect == effect) {
+            return (uint16_t)(entry - 1);
+        }
+        slot = (slot + 1) & (TC_STYLE_INDEX - 1);
+    }
+    if (table->count == TC_STYLE_MAX) return TC_STYLE_NONE;
+
+    uint16_t id = (uint16_t)(table->count++);
+    TcStyle *style = &table->styles[id];
+    style->fg     = fg;
+    style->bg     = bg;
+    style->effect = effect;
+    style->len    = (uint8_t)tc_encode_sgr(style->sgr, fg, bg, effect, table->mode);
+    table->index[slot] = (uint16_t)(id + 1);
+    return id;
+}
+
+/*
+ * Appends the sequence that switches the terminal from style `from` to style
+ * `to`, building and caching it on first use.
+ */
+static int tc_style_transition(TcStyleTable *table, char *out, uint16_t from, uint16_t to) {
+    uint32_t key = (uint32_t)from << 16 | to;
+    TcStyleTransition *entry = &table->transitions[(from * 31u + to) & (TC_STYLE_TRANSITIONS - 1)];
+
+    if (entry->key != key) {
+        const TcStyle *a = &table->styles[from];
+        const TcStyle *b = &table->styles[to];
+        entry->key = key;
+        entry->len = (uint8_t)tc_encode_sgr_transition(entry->sgr, a->fg, a->bg, a->effect,
+                                                       b->fg, b->bg, b->effect, table->mode);
+    }
+    memcpy(out, entry->sgr, TC_STYLE_SGR_BYTES);
+    return entry->len;
+}
+
+/*
+ * Appends a cursor position sequence (0-based coordinates).
+ */
+static int tc_encode_cursor(char *out, int x, int y) {
+    int len = 0;
+
+    out[len++] = '\033';
+    out[len++] = '[';
+    len += tc_put_uint(out + len, (unsigned int)(y + 1));
+    out[len++] = ';';
+    len += tc_put_uint(out + len, (unsigned int)(x + 1));
+    out[len++] = 'H';
+
+    return len;
+}
+
+
+
+// -----------------------------------------------------------------------------
+//  Canvas Functionality
+// -----------------------------------------------------------------------------
+/*
+ * Memory helpers.
+ * Everything a canvas owns is carved from its arena when built with USE_ARENA,
+ * and comes from the heap otherwise.
+ */
+static inline void *tc_alloc(TermCanvas *canvas, size_t size) {
+    #ifdef USE_ARENA
+    return arena_alloc(canvas->arena, size);
+    #else
+    (void)canvas;
+    return malloc(size);
+    #endif
+}
+
+static inline void *tc_realloc(TermCanvas *canvas, void *ptr, size_t size) {
+    #ifdef USE_ARENA
+    return arena_realloc(canvas->arena, ptr, size);
+    #else
+    (void)canvas;
+    return realloc(ptr, size);
+    #endif
+}
+
+static inline void tc_free(void *ptr) {
+    #ifdef USE_ARENA
+    arena_free_block(ptr);
+    #else
+    free(ptr);
+    #endif
+}
+
+/*
+ * Whether the presenting thread may reallocate canvas memory.
+ * An arena is not thread-safe, so it is left alone while the presenter
+ * thread runs next to the application.
+ */
+static inline bool tc_can_grow(const TermCanvas *canvas) {
+    #if defined(USE_ARENA) && defined(TC_USE_THREADS)
+    return canvas->presenter == NULL;
+    #else
+    (void)canvas;
+    return true;
+    #endif
+}
+
+/*
+ * Allocates a style table (see TcStyleTable). NULL is fine, frames are then encoded directly.
+ */
+static TcStyleTable *tc_style_table_create(TermCanvas *canvas, TcTerminalColorMode mode) {
+    TcStyleTable *table = (TcStyleTable *)tc_alloc(canvas, sizeof(TcStyleTable));
+    if (table) tc_style_table_reset(table, mode);
+    return table;
+}
+
+/*
+ * Sends byte ranges to the canvas's sink, in order and as one unit:
+ * a single writev for fds, a single call for callbacks.
+ */
+static void tc_sink_writev(TermCanvas *canvas, struct iovec *iov, int count) {
+    switch (canvas->sink.kind) {
+        case Sink_Fd:
+            tc_writev_all(canvas->sink.fd, iov, count);
+            break;
+        case Sink_Callback:
+            if (canvas->sink.write) canvas->sink.write(iov, count, canvas->sink.user_data);
+            break;
+        case Sink_Memory: {
+            size_t total = 0;
+            for (int i = 0; i < count; i++) total += iov[i].iov_len;
+
+            if (canvas->sink_len + total > canvas->sink_cap) {
+                if (!tc_can_grow(canvas)) return; // The frame is lost
+                size_t cap = canvas->sink_cap ? canvas->sink_cap : 4096;
+                while (cap < canvas->sink_len + total) cap *= 2;
+                char *memory = (char *)tc_realloc(canvas, canvas->sink_memory, cap);
+                if (!memory) return; // Out of memory: the frame is lost
+                canvas->sink_memory = memory;
+                canvas->sink_cap    = cap;
+            }
+            for (int i = 0; i < count; i++) {
+                memcpy(canvas->sink_memory + canvas->sink_len, iov[i].iov_base, iov[i].iov_len);
+                canvas->sink_len += iov[i].iov_len;
+            }
+            break;
+        }
+    }
+}
+
+static void tc_sink_write(TermCanvas *canvas, const char *data, size_t len) {
+    struct iovec iov = {(void *)data, len};
+    tc_sink_writev(canvas, &iov, 1);
+}
+
+static void tc_sink_write_str(TermCanvas *canvas, const char *str) {
+    tc_sink_write(canvas, str, strlen(str));
+}
+
+/*
+ * Size of a pixel grid allocation: the row pointer table plus the rows.
+ */
+static inline size_t tc_grid_size(int width, int height) {
+    return (size_t)(width) * (size_t)(height) * sizeof(TcPixel) + sizeof(TcPixel *) * (size_t)(height);
+}
+
+/*
+ * Lays out a pixel grid inside a single allocation.
+ * The row pointer table comes first, followed by the rows themselves.
+ */
+static TcPixel **tc_grid_init(void *blob, int width, int height) {
+    TcPixel **rows = (TcPixel **)blob;
+    for (int i = 0; i < height; i++) {
+        rows[i] = (TcPixel *)(void *)((char *)blob + sizeof(TcPixel *) * (size_t)(height) + (size_t)(i) * (size_t)(width) * sizeof(TcPixel));
+    }
+    return rows;
+}
+
+/*
+ * Initializes an empty canvas.
+ * Creates the canvas structure with cleared buffers.
+ * Anything set in options (NULL for TC_OPTIONS_DEFAULT) is used instead of
+ * being detected.
+ * Returns NULL if memory (or arena space) runs out.
+ */
+#ifdef USE_ARENA
+TermCanvas *tc_create_ex(Arena *arena, int width, int height, wchar_t symbol, Color foreground, Color background,
+                         const TcOptions *options) {
     TermCanvas *canvas = (TermCanvas *)arena_alloc(arena, sizeof(TermCanvas));
+    if (!canvas) return NULL;
+    *canvas = (TermCanvas){0};
+    canvas->arena = arena;
 #else
-TermCanvas *tc_create(int width, int height, wchar_t symbol, Color foreground, Color background) {
+TermCanvas *tc_create_ex(int width, int height, wchar_t symbol, Color foreground, Color background,
+                         const TcOptions *options) {
     TermCanvas *canvas = (TermCanvas *)malloc(sizeof(TermCanvas));
+    if (!canvas) return NULL;
+    *canvas = (TermCanvas){0};
 #endif
+    TcOptions opts = options ? *options : TC_OPTIONS_DEFAULT;
+
     canvas->width = width;
     canvas->height = height;
-    canvas->mode = get_terminal_mode();
-    
-    #ifdef USE_ARENA
-    void *blob = arena_alloc(arena, (size_t)(width * height) * sizeof(Pixel) + sizeof(Pixel *) * (size_t)(height));
-    #else
-    void *blob = malloc((size_t)(width * height) * sizeof(TcPixel) + sizeof(TcPixel *) * (size_t)(height));
-    #endif
+    canvas->sink = opts.sink;
+    canvas->caps = opts.caps;
+    canvas->headless = opts.headless;
+    if (opts.mode == Color_Auto) canvas->mode = opts.headless ? Color_RGB : get_terminal_mode();
+    else                         canvas->mode = opts.mode;
+    if (opts.terminal_w > 0 && opts.terminal_h > 0) {
+        canvas->size_w     = opts.terminal_w;
+        canvas->size_h     = opts.terminal_h;
+        canvas->size_valid = true;
+        canvas->size_fixed = true;
+    }
+    tc_init_digits();
+    tc_init_color_luts(canvas->mode);
+    tc_init_width_table(); // Before any presenter thread can look a width up
+
+    // Room for a full redraw of mostly uniform cells (symbol plus occasional attributes)
+    canvas->buffer_size = 8 * canvas->width * canvas->height + 16 * canvas->height + 2 * MAX_ANSI_LENGTH;
+
+    void *blob  = tc_alloc(canvas, tc_grid_size(width, height));
+    void *front = tc_alloc(canvas, tc_grid_size(width, height));
+    canvas->dirty  = (TcDirtySpan *)tc_alloc(canvas, sizeof(TcDirtySpan) * (size_t)(height));
+    canvas->buffer = (char *)tc_alloc(canvas, (size_t)(canvas->buffer_size));
+
+    if (!blob || !front || !canvas->dirty || !canvas->buffer) {
+        tc_free(canvas->buffer);
+        tc_free(canvas->dirty);
+        tc_free(front);
+        tc_free(blob);
+        tc_free(canvas);
+        return NULL;
+    }
+
+    canvas->pixels = tc_grid_init(blob, width, height);
+    canvas->front  = tc_grid_init(front, width, height);
+    canvas->front_valid = false;
+    canvas->enough_space = true;
+
+    TcPixel pixel = tc_pixel(background, foreground, symbol, Effect_None);
+    canvas->fill = pixel;
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            canvas->pixels[i][j] = pixel;
+        }
+        canvas->dirty[i] = (TcDirtySpan){0, width};
+    }
+
+    if (!canvas->headless) {
+        setlocale(LC_ALL, "");
+        tc_sink_write_str(canvas, "\033[?25l\033[?1049h"); // Hide the cursor, switch to the alternate buffer
+    }
+
+    return canvas;
+}
+
+/*
+ * Initializes an empty canvas with everything detected (see tc_create_ex).
+ */
+#ifdef USE_ARENA
+TermCanvas *tc_create(Arena *arena, int width, int height, wchar_t symbol, Color foreground, Color background) {
+    return tc_create_ex(arena, width, height, symbol, foreground, background, NULL);
+}
+#else
+TermCanvas *tc_create(int width, int height, wchar_t symbol, Color foreground, Color background) {
+    return tc_create_ex(width, height, symbol, foreground, background, NULL);
+}
+#endif
+
+/*
+ * Shuts down the canvas.
+ * Restores from buffer and clears the canvas.
+ */
+void tc_destroy(TermCanvas *canvas) {
+    if (!canvas) return;
+
+    #ifdef TC_USE_THREADS
+    tc_set_async(canvas, false);        // Present what is pending and stop the thread
+    tc_set_encode_threads(canvas, 0);   // Stop the band encoders
+    #endif
+    tc_record_stop(canvas);
+
+    tc_free(canvas->styles);  // free style table
+    tc_free(canvas->buffer);  // free buffer
+    tc_free(canvas->dirty);   // free dirty spans
+    tc_free(canvas->front);   // free front buffer
+    tc_free(canvas->pixels);  // free pixels
+
+    // Clear the canvas, restore from the alternate buffer and show the cursor
+    if (!canvas->headless) tc_sink_write_str(canvas, "\033[H\033[J\033[?1049l\033[?25h");
+
+    tc_free(canvas->sink_memory);
+    tc_free(canvas);
+}
+
+/*
+ * Changes the canvas size, keeping the pixels that still fit.
+ * New cells get the pixel the canvas was created with. The next tc_show
+ * redraws everything. Returns false (leaving the canvas as it was) if
+ * memory runs out.
+ */
+bool tc_resize(TermCanvas *canvas, int width, int height) {
+    if (!canvas || width <= 0 || height <= 0) return false;
+    if (width == canvas->width && height == canvas->height) return true;
+
+    #ifdef TC_USE_THREADS
+    // The presenter and the band encoders are sized for the old canvas
+    bool async = canvas->presenter != NULL;
+    int  bands = canvas->band_count;
+    tc_set_async(canvas, false);
+    tc_set_encode_threads(canvas, 0);
+    #endif
+
+    int buffer_size = 8 * width * height + 16 * height + 2 * MAX_ANSI_LENGTH;
+
+    void *blob  = tc_alloc(canvas, tc_grid_size(width, height));
+    void *front = tc_alloc(canvas, tc_grid_size(width, height));
+    TcDirtySpan *dirty = (TcDirtySpan *)tc_alloc(canvas, sizeof(TcDirtySpan) * (size_t)(height));
+    char *buffer = (char *)tc_alloc(canvas, (size_t)(buffer_size));
+
+    bool ok = blob && front && dirty && buffer;
+    if (ok) {
+        TcPixel **pixels = tc_grid_init(blob, width, height);
+        int copy_w = width  < canvas->width  ? width  : canvas->width;
+        for (int y = 0; y < height; y++) {
+            int x = 0;
+            if (y < canvas->height) {
+                memcpy(pixels[y], canvas->pixels[y], (size_t)(copy_w) * sizeof(TcPixel));
+                x = copy_w;
+            }
+            for (; x < width; x++) pixels[y][x] = canvas->fill;
+            dirty[y] = (TcDirtySpan){0, width};
+        }
+
+        tc_free(canvas->buffer);
+        tc_free(canvas->dirty);
+        tc_free(canvas->front);
+        tc_free(canvas->pixels);
+
+        canvas->width       = width;
+        canvas->height      = height;
+        canvas->pixels      = pixels;
+        canvas->front       = tc_grid_init(front, width, height);
+        canvas->dirty       = dirty;
+        canvas->buffer      = buffer;
+        canvas->buffer_size = buffer_size;
+        canvas->front_valid = false;
+        canvas->scroll_count = 0; // Everything is redrawn anyway
+    }
+    else {
+        tc_free(buffer);
+        tc_free(dirty);
+        tc_free(front);
+        tc_free(blob);
+    }
+
+    #ifdef TC_USE_THREADS
+    if (bands) tc_set_encode_threads(canvas, bands);
+    if (async) tc_set_async(canvas, true);
+    #endif
+
+    return ok;
+}
+
+/*
+ * Clears the screen and writes the terminal size in its middle, each
+ * dimension red if it is too small for the canvas and green otherwise.
+ * The output doesn't grow with the terminal.
+ */
+static int tc_show_too_small(TermCanvas *canvas) {
+    if (!canvas) return 0;
+
+    char buffer[4 * MAX_ANSI_LENGTH + 32];
+    int buf_idx = tc_put_str(buffer, "\033[0m\033[H\033[J");
+
+    char width[12];
+    char height[12];
+    int width_len  = snprintf(width, sizeof(width), "%d", canvas->terminal_w);
+    int height_len = snprintf(height, sizeof(height), "%d", canvas->terminal_h);
+
+    int x = canvas->terminal_w / 2 - 1 - (width_len + height_len) / 2;
+    int y = canvas->terminal_h / 2;
+    buf_idx += tc_encode_cursor(buffer + buf_idx, x > 0 ? x : 0, y > 0 ? y : 0);
+
+    buf_idx += tc_encode_sgr(buffer + buf_idx,
+        canvas->terminal_w < canvas->width ? COLOR_RED : COLOR_GREEN, COLOR_BLACK, Effect_None, canvas->mode);
+    buf_idx += tc_put_str(buffer + buf_idx, width);
+    buf_idx += tc_encode_sgr(buffer + buf_idx, COLOR_WHITE, COLOR_BLACK, Effect_None, canvas->mode);
+    buffer[buf_idx++] = 'x';
+    buf_idx += tc_encode_sgr(buffer + buf_idx,
+        canvas->terminal_h < canvas->height ? COLOR_RED : COLOR_GREEN, COLOR_BLACK, Effect_None, canvas->mode);
+    buf_idx += tc_put_str(buffer + buf_idx, height);
+    buf_idx += tc_put_str(buffer + buf_idx, "\033[0m");
+
+    tc_sink_write(canvas, buffer, (size_t)buf_idx);
+    return buf_idx;
+}
+
+
+/*
+ * Render state of a single frame.
+ * Tracks what the terminal currently has set so that redundant
+ * color changes and cursor jumps are not emitted.
+ */
+typedef struct {
+    char    *buffer;      // Render buffer
+    int      buffer_size; // Size of the render buffer in bytes
+    int      buf_idx;     // Write position in the render buffer
+    TermCanvas *canvas;   // Canvas whose sink the buffer is flushed to
+    bool     grow;        // Grow canvas->buffer when full instead of flushing mid-frame
+    TcTerminalColorMode mode; // Color mode the frame is encoded for
+    unsigned caps;        // Cap_* sequences that may be used
+    int      frame_start; // Bytes at the buffer start that open the frame (sync marker)
+    TcStats *stats;       // Counters of the frame being rendered
+
+    Color    fg;          // Foreground currently set on the terminal
+    Color    bg;          // Background currently set on the terminal
+    TcEffect effect;      // Effect currently set on the terminal
+    bool     attrs_known; // fg/bg/effect reflect the terminal (false: unknown, send everything)
+    TcStyleTable *styles; // SGR cache of this encoder (NULL: encode every sequence)
+    uint16_t style;       // Style id of fg/bg/effect (TC_STYLE_NONE: not interned)
+    int      cursor_x;    // Column the next symbol will be written to
+    int      cursor_y;    // Row the next symbol will be written to
+} TcRenderState;
+
+/*
+ * Compares two pixels as raw bytes (TcPixel has no padding).
+ * Compiles down to a couple of word compares.
+ */
+static inline bool tc_pixel_equal(TcPixel a, TcPixel b) {
+    return memcmp(&a, &b, sizeof(TcPixel)) == 0;
+}
+
+/*
+ * Checks whether a whole row matches the front buffer.
+ * memcmp is vectorized by libc, so static rows cost a fraction of a per-cell scan.
+ */
+static inline bool tc_row_equal(const TcPixel *row, const TcPixel *front, int width) {
+    return memcmp(row, front, (size_t)(width) * sizeof(TcPixel)) == 0;
+}
+
+/*
+ * Writes the render buffer to the sink and resets it.
+ */
+static void tc_flush_buffer(TcRenderState *state) {
+    if (state->buf_idx == 0) return;
+
+    long long start = tc_now_ns();
+    tc_sink_write(state->canvas, state->buffer, (size_t)state->buf_idx); // One write for the whole buffer
+    state->stats->write_ns += tc_now_ns() - start;
+    state->stats->bytes_written += state->buf_idx;
+    state->buf_idx = 0;                                                  // Reset the index
+    state->frame_start = 0;
+}
+
+/*
+ * Makes room for bytes more bytes in the render buffer.
+ * The canvas buffer is grown (doubling) so the frame still goes out in one
+ * write; only if that is not possible is the buffer flushed mid-frame.
+ */
+static void tc_reserve(TcRenderState *state, int bytes) {
+    if (state->buf_idx + bytes <= state->buffer_size) return;
+
+    if (state->grow) {
+        int size = state->buffer_size * 2;
+        while (size < state->buf_idx + bytes) size *= 2;
+
+        char *buffer = (char *)tc_realloc(state->canvas, state->buffer, (size_t)(size));
+        if (buffer) {
+            state->canvas->buffer      = buffer;
+            state->canvas->buffer_size = size;
+            state->buffer      = buffer;
+            state->buffer_size = size;
+            return;
+        }
+    }
+    if (state->buf_idx > 0) state->stats->flushes++;
+    tc_flush_buffer(state);
+}
+
+/*
+ * Appends a CSI sequence with one numeric parameter ("ESC [ n <final>").
+ */
+static inline int tc_encode_csi_n(char *out, unsigned int n, char final) {
+    int len = 0;
+    out[len++] = '\033';
+    out[len++] = '[';
+    len += tc_put_uint(out + len, n);
+    out[len++] = final;
+    return len;
+}
+
+/*
+ * Erased cells only show the background, so ECH can stand in for spaces
+ * whose effect doesn't draw anything on a blank cell.
+ */
+static inline bool tc_blank_erasable(const TcPixel *px) {
+    return (px->symbol == L' ' || (uint32_t)px->symbol < 0x20) && // Control characters are written as spaces
+           px->effect != Effect_Underline && px->effect != Effect_Reverse;
+}
+
+/*
+ * Appends the symbols of a run, replacing repeats with whatever is shortest:
+ * the literal symbols, the symbol once plus REP, or (for blanks) ECH plus
+ * a cursor forward. Starts at state->cursor_x and leaves the cursor after the run.
+ */
+static void tc_emit_symbols_compressed(TcRenderState *state, const TcPixel *run, int count) {
+    for (int i = 0; i < count; ) {
+        int repeat = 1;
+        uint32_t cp = (uint32_t)run[i].symbol;
+        if (cp >= 0x300) {
+            // Wide glyphs, marks and clusters depend on their neighbours, they are never repeated
+            tc_reserve(state, MAX_ANSI_LENGTH);
+            state->buf_idx += tc_put_cell(state->buffer + state->buf_idx, &run[i], state->cursor_x + i,
+                                          state->canvas->shown_w);
+            i++;
+            continue;
+        }
+        while (i + repeat < count && run[i + repeat].symbol == run[i].symbol) repeat++;
+
+        tc_reserve(state, 2 * MAX_ANSI_LENGTH + 4 * (repeat < 16 ? repeat : 16));
+        char *out = state->buffer + state->buf_idx;
+        int symbol_len = tc_utf8_len(run[i].symbol);
+
+        int literal = symbol_len * repeat;
+        int rep = (state->caps & Cap_Rep) && repeat > 1
+                ? symbol_len + 3 + tc_uint_digits((unsigned int)(repeat - 1)) : INT_MAX;
+        // CUF stops at the right margin, so ECH is only used where the cursor can move past the run
+        int ech = (state->caps & Cap_Ech) && tc_blank_erasable(&run[i]) &&
+                  state->cursor_x + i + repeat < state->canvas->terminal_w
+                ? 2 * (3 + tc_uint_digits((unsigned int)repeat)) : INT_MAX;
+
+        if (rep < literal && rep <= ech) {
+            int len = tc_put_utf8(out, run[i].symbol);
+            len += tc_encode_csi_n(out + len, (unsigned int)(repeat - 1), 'b');
+            state->buf_idx += len;
+        }
+        else if (ech < literal) {
+            int len = tc_encode_csi_n(out, (unsigned int)repeat, 'X');
+            len += tc_encode_csi_n(out + len, (unsigned int)repeat, 'C');
+            state->buf_idx += len;
+        }
+        else if (repeat * 4 <= state->buffer_size - state->buf_idx - MAX_ANSI_LENGTH) {
+            int len = 0;
+            for (int j = 0; j < repeat; j++) len += tc_put_utf8(out + len, run[i].symbol);
+            state->buf_idx += len;
+        }
+        else {
+            // Longer than the buffer can take at once; only possible when growing failed
+            for (int j = 0; j < repeat; j++) {
+                tc_reserve(state, MAX_ANSI_LENGTH);
+                state->buf_idx += tc_put_utf8(state->buffer + state->buf_idx, run[i].symbol);
+            }
+        }
+        i += repeat;
+    }
+}
+
+/*
+ * Appends a run of pixels sharing the same attributes to the render buffer.
+ * Attributes are only re-sent if they differ from the current terminal state,
+ * the symbols are then copied in bulk (with a fast path for printable ASCII).
+ */
+static void tc_emit_run(TcRenderState *state, const TcPixel *run, int count) {
+    // Room for the attributes and every symbol at its longest
+    tc_reserve(state, MAX_ANSI_LENGTH + TC_CELL_BYTES * count);
+
+    // Send only the attributes that differ from what the terminal has set
+    TcPixel px = run[0];
+    char *sgr = state->buffer + state->buf_idx;
+    uint16_t style = state->styles ? tc_style_intern(state->styles, px.foreground, px.background,
+                                                     (TcEffect)px.effect)
+                                   : TC_STYLE_NONE;
+    int sgr_len;
+    if (!state->attrs_known) {
+        if (style != TC_STYLE_NONE) {
+            const TcStyle *cached = &state->styles->styles[style];
+            memcpy(sgr, cached->sgr, TC_STYLE_SGR_BYTES);
+            sgr_len = cached->len;
+        }
+        else sgr_len = tc_encode_sgr(sgr, px.foreground, px.background, (TcEffect)px.effect, state->mode);
+        state->attrs_known = true;
+    }
+    else if (style != TC_STYLE_NONE && state->style != TC_STYLE_NONE) {
+        sgr_len = style == state->style ? 0 : tc_style_transition(state->styles, sgr, state->style, style);
+    }
+    else {
+        sgr_len = tc_encode_sgr_transition(sgr, state->fg, state->bg, state->effect,
+                                           px.foreground, px.background, (TcEffect)px.effect, state->mode);
+    }
+    state->buf_idx += sgr_len;
+    state->style = style;
+    if (sgr_len > 0) state->stats->sgr_emitted++;
+    // Update last known colors/effect
+    state->bg = px.background;
+    state->fg = px.foreground;
+    state->effect = (TcEffect)px.effect;
+
+    if (state->caps & (Cap_Rep | Cap_Ech)) {
+        tc_emit_symbols_compressed(state, run, count);
+        state->cursor_x += count;
+        return;
+    }
+
+    // Add the characters to the buffer, making room whenever the longest symbols might not fit
+    for (int i = 0; i < count; ) {
+        int room  = (state->buffer_size - state->buf_idx - MAX_ANSI_LENGTH) / TC_CELL_BYTES;
+        if (room <= 0) {
+            tc_reserve(state, MAX_ANSI_LENGTH + TC_CELL_BYTES * (count - i));
+            continue;
+        }
+
+        int chunk = count - i < room ? count - i : room;
+        char *out = state->buffer + state->buf_idx;
+        int len = 0;
+        for (int j = i; j < i + chunk; j++) {
+            uint32_t cp = (uint32_t)run[j].symbol;
+            if (cp >= 0x20 && cp < 0x7F) out[len++] = (char)cp;
+            else if (cp < 0x300)         len += tc_put_utf8(out + len, (wchar_t)cp);
+            else                         len += tc_put_cell(out + len, &run[j], state->cursor_x + j, state->canvas->shown_w);
+        }
+        state->buf_idx += len;
+        i += chunk;
+    }
+    state->cursor_x += count;
+}
+
+// -----------------------------------------------------------------------------
+//  Row Scanning (SIMD with scalar fallback)
+// -----------------------------------------------------------------------------
+/*
+ * Compares the attributes (colors and effect) of two pixels, ignoring the symbol.
+ */
+static inline bool tc_attrs_equal(TcPixel a, TcPixel b) {
+    return a.background.color == b.background.color &&
+           a.foreground.color == b.foreground.color &&
+           a.effect           == b.effect;
+}
+
+#if defined(TC_SIMD_AVX2)
+/*
+ * AVX2: two pixels per register, eight per iteration.
+ * A pixel matches when all 16 of its compare mask bytes are set.
+ */
+#define TC_SIMD_STEP 8
+static inline bool tc_simd_all_equal(__m256i a0, __m256i a1, __m256i a2, __m256i a3,
+                                     __m256i b0, __m256i b1, __m256i b2, __m256i b3, __m256i ignore) {
+    __m256i e = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi32(a0, b0), _mm256_cmpeq_epi32(a1, b1)),
+                                 _mm256_and_si256(_mm256_cmpeq_epi32(a2, b2), _mm256_cmpeq_epi32(a3, b3)));
+    return _mm256_movemask_epi8(_mm256_or_si256(e, ignore)) == -1;
+}
+#elif defined(TC_SIMD_SSE2)
+/*
+ * SSE2: one pixel per register, four per iteration.
+ */
+#define TC_SIMD_STEP 4
+static inline bool tc_simd_all_equal(__m128i a0, __m128i a1, __m128i a2, __m128i a3,
+                                     __m128i b0, __m128i b1, __m128i b2, __m128i b3, __m128i ignore) {
+    __m128i e = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi32(a0, b0), _mm_cmpeq_epi32(a1, b1)),
+                              _mm_and_si128(_mm_cmpeq_epi32(a2, b2), _mm_cmpeq_epi32(a3, b3)));
+    return _mm_movemask_epi8(_mm_or_si128(e, ignore)) == 0xFFFF;
+}
+#elif defined(TC_SIMD_NEON)
+/*
+ * NEON: one pixel per register, four per iteration.
+ */
+#define TC_SIMD_STEP 4
+static inline bool tc_simd_all_equal(uint32x4_t a0, uint32x4_t a1, uint32x4_t a2, uint32x4_t a3,
+                                     uint32x4_t b0, uint32x4_t b1, uint32x4_t b2, uint32x4_t b3, uint32x4_t ignore) {
+    uint32x4_t e = vandq_u32(vandq_u32(vceqq_u32(a0, b0), vceqq_u32(a1, b1)),
+                             vandq_u32(vceqq_u32(a2, b2), vceqq_u32(a3, b3)));
+    return vminvq_u32(vorrq_u32(e, ignore)) == 0xFFFFFFFFu;
+}
+#endif
+
+#if defined(TC_SIMD_AVX2)
+    #define TC_SIMD_VEC           __m256i
+    #define TC_SIMD_LOAD(px, i)   _mm256_loadu_si256((const __m256i *)(const void *)((px) + 2 * (i)))
+    #define TC_SIMD_SPLAT(px)     _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(const void *)(px)))
+    #define TC_SIMD_NONE()        _mm256_setzero_si256()
+    #define TC_SIMD_SYMBOL_MASK() _mm256_set_epi32(0, -1, 0, 0, 0, -1, 0, 0)
+#elif defined(TC_SIMD_SSE2)
+    #define TC_SIMD_VEC           __m128i
+    #define TC_SIMD_LOAD(px, i)   _mm_loadu_si128((const __m128i *)(const void *)((px) + (i)))
+    #define TC_SIMD_SPLAT(px)     _mm_loadu_si128((const __m128i *)(const void *)(px))
+    #define TC_SIMD_NONE()        _mm_setzero_si128()
+    #define TC_SIMD_SYMBOL_MASK() _mm_set_epi32(0, -1, 0, 0)
+#elif defined(TC_SIMD_NEON)
+    #define TC_SIMD_VEC           uint32x4_t
+    #define TC_SIMD_LOAD(px, i)   vld1q_u32((const uint32_t *)(const void *)((px) + (i)))
+    #define TC_SIMD_SPLAT(px)     vld1q_u32((const uint32_t *)(const void *)(px))
+    #define TC_SIMD_NONE()        vdupq_n_u32(0)
+    #define TC_SIMD_SYMBOL_MASK() ((uint32x4_t){0, 0, 0xFFFFFFFFu, 0})
+#endif
+
+/*
+ * Counts the pixels starting at x that match the front buffer.
+ */
+static inline int tc_scan_unchanged(const TcPixel *row, const TcPixel *front, int x, int end) {
+    int i = x;
+
+    #ifdef TC_SIMD_STEP
+    TC_SIMD_VEC none = TC_SIMD_NONE();
+    for (; i + TC_SIMD_STEP <= end; i += TC_SIMD_STEP) {
+        const TcPixel *r = row + i;
+        const TcPixel *f = front + i;
+        if (!tc_simd_all_equal(TC_SIMD_LOAD(r, 0), TC_SIMD_LOAD(r, 1), TC_SIMD_LOAD(r, 2), TC_SIMD_LOAD(r, 3),
+                               TC_SIMD_LOAD(f, 0), TC_SIMD_LOAD(f, 1), TC_SIMD_LOAD(f, 2), TC_SIMD_LOAD(f, 3),
+                               none)) break;
+    }
+    #endif
+
+    while (i < end && tc_pixel_equal(row[i], front[i])) i++;
+    return i - x;
+}
+
+/*
+ * Counts the pixels starting at x that differ from the front buffer.
+ * Runs of changed cells are short and irregular, so this one stays scalar.
+ */
+static inline int tc_scan_changed(const TcPixel *row, const TcPixel *front, int x, int end) {
+    int i = x;
+    while (i < end && !tc_pixel_equal(row[i], front[i])) i++;
+    return i - x;
+}
+
+/*
+ * Counts the pixels starting at x that share the attributes of row[x].
+ * This is the length of the run that can be written with a single SGR sequence.
+ */
+static inline int tc_scan_attrs(const TcPixel *row, int x, int end) {
+    int i = x + 1;
+
+    #ifdef TC_SIMD_STEP
+    TC_SIMD_VEC ref    = TC_SIMD_SPLAT(row + x);
+    TC_SIMD_VEC ignore = TC_SIMD_SYMBOL_MASK();
+    for (; i + TC_SIMD_STEP <= end; i += TC_SIMD_STEP) {
+        const TcPixel *r = row + i;
+        if (!tc_simd_all_equal(TC_SIMD_LOAD(r, 0), TC_SIMD_LOAD(r, 1), TC_SIMD_LOAD(r, 2), TC_SIMD_LOAD(r, 3),
+                               ref, ref, ref, ref, ignore)) break;
+    }
+    #endif
+
+    while (i < end && tc_attrs_equal(row[i], row[x])) i++;
+    return i - x;
+}
+
+/*
+ * Finds the end of a changed run starting at x.
+ * Unchanged gaps shorter than TC_DIFF_MAX_GAP are included, since rewriting
+ * them is cheaper than a cursor jump.
+ */
+static inline int tc_changed_run_end(const TcPixel *row, const TcPixel *front, int x, int width) {
+    int end = x;
+
+    while (end < width) {
+        end += tc_scan_changed(row, front, end, width);
+        if (end >= width) break;
+
+        int gap = tc_scan_unchanged(row, front, end, width);
+        if (gap >= TC_DIFF_MAX_GAP || end + gap == width) break;
+        end += gap;
+    }
+    return end;
+}
+
+
+
+/*
+ * A frame handed to the renderer: the pixels to present and what is known
+ * about which of them changed.
+ */
+typedef struct {
+    TcPixel     **pixels;      // Pixels to present
+    TcDirtySpan  *dirty;       // Dirty spans of those pixels (cleared while rendering)
+    bool          track_dirty; // Only scan the dirty spans
+    TcTerminalColorMode mode;  // Color mode to encode for
+    unsigned      caps;        // Cap_* sequences that may be used
+    bool          overlay;     // Draw the stats overlay
+    TcOverflow    overflow;    // What to present if the terminal is too small
+    int           terminal_w;  // Terminal size to present for
+    int           terminal_h;
+    TcScroll      scrolls[TC_SCROLL_MAX]; // Row moves the terminal can do (Cap_Scroll)
+    int           scroll_count;
+} TcFrame;
+
+/*
+ * Appends the shortest cursor movement to (x, y): a forward move within
+ * the row when CUF is allowed, an absolute position otherwise.
+ */
+static int tc_encode_move(TcRenderState *state, int x, int y) {
+    char *out = state->buffer + state->buf_idx;
+
+    if ((state->caps & Cap_Cuf) && state->cursor_y == y && state->cursor_x >= 0 && x > state->cursor_x) {
+        int forward = 3 + tc_uint_digits((unsigned int)(x - state->cursor_x));
+        int absolute = 4 + tc_uint_digits((unsigned int)(y + 1)) + tc_uint_digits((unsigned int)(x + 1));
+        if (forward < absolute) return tc_encode_csi_n(out, (unsigned int)(x - state->cursor_x), 'C');
+    }
+    return tc_encode_cursor(out, x, y);
+}
+
+/*
+ * Encodes rows [y0, y1) of a frame into the render state, updating the
+ * front buffer and clearing the dirty spans of those rows.
+ * Only touches the given rows, so disjoint row ranges can be encoded
+ * concurrently into separate render states.
+ */
+static void tc_encode_rows(TermCanvas *canvas, TcFrame *frame, TcRenderState *state, int y0, int y1, bool full) {
+    for (int y = y0; y < y1; ++y) {
+        TcPixel *row   = frame->pixels[y];
+        TcPixel *front = canvas->front[y];
+
+        // Columns to look at: the whole row, or only its dirty span
+        int x     = 0;
+        int limit = canvas->shown_w;
+        if (!full && frame->track_dirty) {
+            x     = frame->dirty[y].x0;
+            limit = frame->dirty[y].x1 < canvas->shown_w ? frame->dirty[y].x1 : canvas->shown_w;
+        }
+        frame->dirty[y] = (TcDirtySpan){canvas->width, 0};
+        if (x >= limit) continue;
+
+        state->stats->cells_scanned += limit - x;
+        if (!full && tc_row_equal(row + x, front + x, limit - x)) continue;
+
+        while (x < limit) {
+            // Skip cells the terminal already shows
+            if (!full) {
+                x += tc_scan_unchanged(row, front, x, limit);
+                if (x >= limit) break;
+            }
+
+            // The run bridges unchanged gaps shorter than a cursor jump. A wide
+            // glyph and its continuation cell always go out together, both the
+            // new one and the one on the terminal (writing over either half of
+            // it erases the other)
+            int end = full ? limit : tc_changed_run_end(row, front, x, limit);
+            while (x > 0 && ((uint32_t)row[x].symbol == TC_WIDE_CONT || (uint32_t)front[x].symbol == TC_WIDE_CONT)) x--;
+            while (end < canvas->shown_w &&
+                   ((uint32_t)row[end].symbol == TC_WIDE_CONT || (uint32_t)front[end].symbol == TC_WIDE_CONT)) end++;
+
+            // Jump to the start of the changed run
+            if (state->cursor_y != y || state->cursor_x != x) {
+                tc_reserve(state, MAX_ANSI_LENGTH);
+                state->buf_idx += tc_encode_move(state, x, y);
+                state->cursor_y = y;
+                state->cursor_x = x;
+            }
+            state->stats->runs_emitted++;
+
+            // Emit it in pieces that share the same attributes
+            while (x < end) {
+                int count = tc_scan_attrs(row, x, end);
+                tc_emit_run(state, row + x, count);
+                memcpy(front + x, row + x, (size_t)(count) * sizeof(TcPixel));
+                state->stats->cells_emitted += count;
+                x += count;
+            }
+        }
+
+        if (full) {
+            // Reset attributes and clear whatever is right of the canvas (if the row didn't reach the edge)
+            tc_reserve(state, MAX_ANSI_LENGTH);
+            state->buf_idx += tc_put_str(state->buffer + state->buf_idx,
+                                         canvas->shown_w < canvas->terminal_w ? "\033[0m\033[K" : "\033[0m");
+            state->fg = COLOR_NONE; // Default colors, as set by the reset
+            state->bg = COLOR_NONE;
+            state->effect = Effect_None;
+            state->attrs_known = true;
+            state->style = TC_STYLE_NONE;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+//  Stats Overlay
+// -----------------------------------------------------------------------------
+#define TC_OVERLAY_BYTES 512 // Room for the overlay sequence (one short line of text)
+
+/*
+ * Formats stats as one line of text ("scan 1200 emit 40 ...").
+ * Returns the length, like snprintf.
+ */
+int tc_format_stats(const TcStats *stats, char *out, size_t size) {
+    if (!stats || !out || size == 0) return 0;
+
+    return snprintf(out, size, "scan %d emit %d runs %d sgr %d bytes %d flush %d enc %lldus wr %lldus%s%s",
+                    stats->cells_scanned, stats->cells_emitted, stats->runs_emitted, stats->sgr_emitted,
+                    stats->bytes_written, stats->flushes, stats->encode_ns / 1000, stats->write_ns / 1000,
+                    stats->full_redraw ? " full" : "", stats->too_small ? " small" : stats->cropped ? " crop" : "");
+}
+
+/*
+ * Makes the cells the overlay covered last frame differ from the front
+ * buffer (and dirty), so the diff puts the canvas back underneath it.
+ */
+static void tc_overlay_restore(TermCanvas *canvas, TcFrame *frame) {
+    if (canvas->overlay_cells <= 0) return;
+
+    int cells = canvas->overlay_cells < canvas->width ? canvas->overlay_cells : canvas->width;
+    TcPixel stale = tc_pixel(COLOR_NONE, COLOR_NONE, (wchar_t)0xFFFFFF, Effect_None); // Matches no real pixel
+    for (int x = 0; x < cells; x++) canvas->front[0][x] = stale;
+
+    if (frame->dirty[0].x0 > 0)     frame->dirty[0].x0 = 0;
+    if (frame->dirty[0].x1 < cells) frame->dirty[0].x1 = cells;
+    canvas->overlay_cells = 0;
+}
+
+/*
+ * Draws the stats over the start of the top row. The canvas underneath is
+ * left alone and restored on the next frame by tc_overlay_restore.
+ */
+static void tc_overlay_draw(TermCanvas *canvas, TcRenderState *state, const TcStats *stats) {
+    char text[160];
+    int len = tc_format_stats(stats, text, sizeof(text));
+    if (len > (int)sizeof(text) - 1) len = (int)sizeof(text) - 1;
+    if (len > canvas->shown_w) len = canvas->shown_w;
+    if (len <= 0) return;
+
+    tc_reserve(state, 2 * MAX_ANSI_LENGTH + len);
+    state->buf_idx += tc_encode_cursor(state->buffer + state->buf_idx, 0, 0);
+    state->buf_idx += tc_encode_sgr(state->buffer + state->buf_idx, COLOR_BLACK, COLOR_YELLOW, Effect_None, state->mode);
+    memcpy(state->buffer + state->buf_idx, text, (size_t)(len));
+    state->buf_idx += len;
+
+    state->fg = COLOR_BLACK;
+    state->bg = COLOR_YELLOW;
+    state->effect = Effect_None;
+    state->attrs_known = true;
+    state->style = TC_STYLE_NONE;
+    state->cursor_y = 0;
+    state->cursor_x = len;
+    canvas->overlay_cells = len;
+}
+
+/*
+ * Rotates count row pointers so that row i ends up where row i - shift was
+ * (shift > 0 moves rows up). Pixels stay where they are.
+ */
+static void tc_rotate_rows(TcPixel **rows, int count, int shift) {
+    shift %= count;
+    if (shift < 0) shift += count;
+    if (shift == 0) return;
+
+    // Three reversals rotate in place
+    int spans[3][2] = {{0, shift}, {shift, count}, {0, count}};
+    for (int s = 0; s < 3; s++) {
+        for (int a = spans[s][0], b = spans[s][1] - 1; a < b; a++, b--) {
+            TcPixel *row = rows[a];
+            rows[a] = rows[b];
+            rows[b] = row;
+        }
+    }
+}
+
+/*
+ * Lets the terminal do the frame's scrolls: each one is a scroll region
+ * (DECSTBM) and CSI n S/T, reset again right after. The front buffer is
+ * moved the same way and the lines that came in are marked stale, so
+ * only those are sent by the diff.
+ */
+static void tc_encode_scrolls(TermCanvas *canvas, TcFrame *frame, TcRenderState *state) {
+    TcPixel stale = tc_pixel(COLOR_NONE, COLOR_NONE, (wchar_t)0xFFFFFF, Effect_None); // Matches no real pixel
+
+    for (int i = 0; i < frame->scroll_count; i++) {
+        TcScroll scroll = frame->scrolls[i];
+        int height = scroll.bottom - scroll.top;
+        int lines  = scroll.lines > 0 ? scroll.lines : -scroll.lines;
+        if (scroll.bottom > canvas->shown_h || lines >= height) continue;
+
+        tc_reserve(state, 4 * MAX_ANSI_LENGTH);
+        char *out = state->buffer + state->buf_idx;
+        int len = 0;
+        out[len++] = '\033';
+        out[len++] = '[';
+        len += tc_put_uint(out + len, (unsigned int)(scroll.top + 1));
+        out[len++] = ';';
+        len += tc_put_uint(out + len, (unsigned int)(scroll.bottom));
+        out[len++] = 'r';
+        out[len++] = '\033';
+        out[len++] = '[';
+        len += tc_put_uint(out + len, (unsigned int)(lines));
+        out[len++] = scroll.lines > 0 ? 'S' : 'T';
+        len += tc_put_str(out + len, "\033[r");
+        state->buf_idx += len;
+
+        tc_rotate_rows(canvas->front + scroll.top, height, scroll.lines);
+        int first = scroll.lines > 0 ? scroll.bottom - lines : scroll.top;
+        for (int y = first; y < first + lines; y++) {
+            for (int x = 0; x < canvas->width; x++) canvas->front[y][x] = stale;
+        }
+    }
+
+    // DECSTBM homes the cursor
+    if (frame->scroll_count > 0) {
+        state->cursor_x = -1;
+        state->cursor_y = -1;
+    }
+}
+
+/*
+ * Turns the stats overlay on or off.
+ * While on, every frame shows the stats of the frame before it in the top-left
+ * corner of the terminal (drawn over the canvas, not into it).
+ */
+void tc_set_stats_overlay(TermCanvas *canvas, bool enabled) {
+    if (canvas) canvas->stats_overlay = enabled;
+}
+
+
+
+#ifdef TC_USE_THREADS
+// -----------------------------------------------------------------------------
+//  Parallel Band Encoding
+// -----------------------------------------------------------------------------
+#define TC_MAX_BANDS 64 // Upper limit for tc_set_encode_threads
+
+/*
+ * One row band and the buffer it is encoded into.
+ * Bands start from an unknown terminal state (no cursor position, no
+ * attributes), so each one can be encoded without knowing what the band
+ * above it ends with.
+ */
+typedef struct {
+    char   *buffer; // Encoded bytes of the band
+    int     size;   // Size of buffer (large enough for the worst case, never flushed)
+    int     len;    // Bytes encoded this frame
+    TcStats stats;  // Counters of this band
+    TcStyleTable *styles; // SGR cache of this band (the band's thread is its only user)
+} TcBand;
+
+/*
+ * Worker pool for band encoding. Band 0 is encoded by the presenting thread,
+ * band i by worker i - 1.
+ */
+struct TcBandPool {
+    pthread_t      *threads;
+    TcBand         *bands;
+    int             count;      // Number of bands
+    pthread_mutex_t lock;
+    pthread_cond_t  start;      // A new frame was published
+    pthread_cond_t  done;       // A band finished
+    unsigned        generation; // Incremented for every frame
+    int             remaining;  // Worker bands still being encoded
+    bool            quit;
+
+    // Job of the current frame
+    TermCanvas *canvas;
+    TcFrame    *frame;
+    bool        full;
+};
+
+typedef struct {
+    TcBandPool *pool;
+    int         band;
+} TcBandWorker;
+
+/*
+ * Encodes one band of the current job into its own buffer.
+ */
+static void tc_band_encode(TcBandPool *pool, int band) {
+    TermCanvas *canvas = pool->canvas;
+    TcBand *b = &pool->bands[band];
+
+    b->stats = (TcStats){0};
+    tc_style_table_begin(b->styles, pool->frame->mode);
+    TcRenderState state = {
+        .buffer      = b->buffer,
+        .buffer_size = b->size,
+        .buf_idx     = 0,
+        .canvas      = canvas,
+        .grow        = false, // The buffer is sized so it never needs to grow or flush
+        .mode        = pool->frame->mode,
+        .caps        = pool->frame->caps,
+        .stats       = &b->stats,
+        .fg          = COLOR_NONE,
+        .bg          = COLOR_NONE,
+        .effect      = Effect_None,
+        .attrs_known = false,
+        .styles      = b->styles,
+        .style       = TC_STYLE_NONE,
+        .cursor_x    = -1,
+        .cursor_y    = -1,
+    };
+
+    int y0 = canvas->shown_h * band / pool->count;
+    int y1 = canvas->shown_h * (band + 1) / pool->count;
+    tc_encode_rows(canvas, pool->frame, &state, y0, y1, pool->full);
+    b->len = state.buf_idx;
+}
+
+static void *tc_band_worker_main(void *arg) {
+    TcBandPool *pool = ((TcBandWorker *)arg)->pool;
+    int band = ((TcBandWorker *)arg)->band;
+    free(arg);
+
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->quit) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->quit) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        tc_band_encode(pool, band);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->remaining == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/*
+ * Encodes a frame band by band on the worker pool and writes the result
+ * (whatever is pending in state, then every band) with a single writev.
+ */
+static void tc_bands_present(TermCanvas *canvas, TcFrame *frame, TcRenderState *state, bool full,
+                             const TcStats *overlay) {
+    TcBandPool *pool = canvas->bands;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->canvas    = canvas;
+    pool->frame     = frame;
+    pool->full      = full;
+    pool->remaining = pool->count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    tc_band_encode(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->remaining > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    // The overlay goes after every band, so it is encoded into a buffer of its own
+    char overlay_buffer[TC_OVERLAY_BYTES];
+    TcRenderState overlay_state = *state;
+    overlay_state.buffer      = overlay_buffer;
+    overlay_state.buffer_size = (int)sizeof(overlay_buffer);
+    overlay_state.buf_idx     = 0;
+    overlay_state.grow        = false;
+    if (overlay) tc_overlay_draw(canvas, &overlay_state, overlay);
+
+    static const char reset[]    = "\033[0m";
+    static const char sync_end[] = TC_SYNC_END;
+    struct iovec iov[TC_MAX_BANDS + 4];
+    int    count   = 0;
+    size_t total   = 0;
+    int    emitted = 0;
+
+    for (int i = 0; i < pool->count; i++) {
+        TcBand *b = &pool->bands[i];
+        state->stats->cells_scanned += b->stats.cells_scanned;
+        state->stats->cells_emitted += b->stats.cells_emitted;
+        state->stats->runs_emitted  += b->stats.runs_emitted;
+        state->stats->sgr_emitted   += b->stats.sgr_emitted;
+        state->stats->flushes       += b->stats.flushes; // Only if the band size above is wrong
+        state->stats->bytes_written += b->stats.bytes_written;
+        emitted += b->len;
+    }
+    emitted += overlay_state.buf_idx;
+    if (emitted == 0 && state->buf_idx == state->frame_start && state->stats->bytes_written == 0) {
+        state->buf_idx = 0;
+        return; // Nothing changed since the last frame
+    }
+
+    if (state->buf_idx > 0) {
+        iov[count++] = (struct iovec){state->buffer, (size_t)(state->buf_idx)};
+        total += (size_t)(state->buf_idx);
+    }
+    for (int i = 0; i < pool->count; i++) {
+        TcBand *b = &pool->bands[i];
+        if (b->len == 0) continue;
+
+        iov[count++] = (struct iovec){b->buffer, (size_t)(b->len)};
+        total += (size_t)(b->len);
+    }
+    if (overlay_state.buf_idx > 0) {
+        iov[count++] = (struct iovec){overlay_buffer, (size_t)(overlay_state.buf_idx)};
+        total += (size_t)(overlay_state.buf_idx);
+    }
+    if (emitted > 0) {
+        iov[count++] = (struct iovec){(void *)reset, sizeof(reset) - 1}; // Reset attributes
+        total += sizeof(reset) - 1;
+    }
+    if (state->caps & Cap_Sync) {
+        iov[count++] = (struct iovec){(void *)sync_end, sizeof(sync_end) - 1};
+        total += sizeof(sync_end) - 1;
+    }
+
+    long long start = tc_now_ns();
+    tc_sink_writev(canvas, iov, count);
+    state->stats->write_ns += tc_now_ns() - start;
+    state->stats->bytes_written += (int)total;
+    state->buf_idx = 0;
+}
+
+/*
+ * Stops the workers and frees the pool.
+ */
+static void tc_bands_destroy(TermCanvas *canvas, TcBandPool *pool, int started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < started; i++) pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    for (int i = pool->count - 1; i >= 0; i--) {
+        tc_free(pool->bands[i].styles);
+        tc_free(pool->bands[i].buffer);
+    }
+    tc_free(pool->bands);
+    tc_free(pool->threads);
+    tc_free(pool);
+    (void)canvas;
+}
+
+/*
+ * Splits encoding into row bands handled by the given number of threads
+ * (the calling thread included). 0 or 1 turns band encoding off.
+ * Each band gets a buffer large enough for its worst case, so the frame is
+ * written with one writev once every band is done.
+ * Can't be changed while async presenting is on. Returns false on failure.
+ */
+bool tc_set_encode_threads(TermCanvas *canvas, int threads) {
+    if (!canvas || canvas->presenter) return false;
+
+    if (canvas->bands) {
+        tc_bands_destroy(canvas, canvas->bands, canvas->bands->count - 1);
+        canvas->bands = NULL;
+        canvas->band_count = 0;
+    }
+    if (threads > TC_MAX_BANDS)  threads = TC_MAX_BANDS;
+    if (threads > canvas->height) threads = canvas->height;
+    if (threads <= 1) return true;
+
+    TcBandPool *pool = (TcBandPool *)tc_alloc(canvas, sizeof(TcBandPool));
+    if (!pool) return false;
+    *pool = (TcBandPool){0};
+    pool->count   = threads;
+    pool->threads = (pthread_t *)tc_alloc(canvas, sizeof(pthread_t) * (size_t)(threads));
+    pool->bands   = (TcBand *)tc_alloc(canvas, sizeof(TcBand) * (size_t)(threads));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    if (!pool->threads || !pool->bands) {
+        pool->count = 0;
+        tc_bands_destroy(canvas, pool, 0);
+        return false;
+    }
+
+    // Worst case per cell: a cursor jump, an SGR sequence and a cluster (TC_CELL_BYTES)
+    int rows = (canvas->height + threads - 1) / threads;
+    int size = (2 * MAX_ANSI_LENGTH + TC_CELL_BYTES) * canvas->width * rows + MAX_ANSI_LENGTH * (rows + 2);
+    for (int i = 0; i < threads; i++) {
+        pool->bands[i] = (TcBand){0};
+        pool->bands[i].size   = size;
+        pool->bands[i].buffer = (char *)tc_alloc(canvas, (size_t)(size));
+        pool->bands[i].styles = tc_style_table_create(canvas, canvas->mode); // Optional, NULL just encodes
+        if (!pool->bands[i].buffer) {
+            pool->count = i;
+            tc_bands_destroy(canvas, pool, 0);
+            return false;
+        }
+    }
+
+    for (int i = 1; i < threads; i++) {
+        TcBandWorker *worker = (TcBandWorker *)malloc(sizeof(TcBandWorker));
+        if (worker) *worker = (TcBandWorker){pool, i};
+        if (!worker || pthread_create(&pool->threads[i - 1], NULL, tc_band_worker_main, worker) != 0) {
+            free(worker);
+            tc_bands_destroy(canvas, pool, i - 1);
+            return false;
+        }
+    }
+
+    canvas->bands = pool;
+    canvas->band_count = threads;
+    return true;
+}
+#endif // TC_USE_THREADS
+
+/*
+ * Renders a frame into the canvas's render buffer and writes it out.
+ * Only cells that differ from the front buffer (what was presented last time)
+ * are sent; unchanged spans are skipped with a cursor jump. If the front buffer
+ * is invalid, the whole canvas is redrawn.
+ * Uses the canvas's front buffer, render buffer and terminal state, so only one
+ * thread may present a canvas at a time.
+ */
+static void tc_present_frame(TermCanvas *canvas, TcFrame *frame, TcStats *stats) {
+    TcStats previous = *stats; // Shown by the overlay
+    long long start = tc_now_ns();
+    *stats = (TcStats){0};
+
+    bool resized = canvas->terminal_w != frame->terminal_w || canvas->terminal_h != frame->terminal_h;
+    canvas->terminal_w = frame->terminal_w;
+    canvas->terminal_h = frame->terminal_h;
+    bool small = canvas->width > canvas->terminal_w || canvas->height > canvas->terminal_h;
+    if (small && frame->overflow == Overflow_Notice) {
+        // The notice only depends on the terminal size: write it once, then present nothing
+        stats->too_small = true;
+        if (resized || !canvas->notice_shown) {
+            stats->bytes_written = tc_show_too_small(canvas);
+            stats->write_ns = tc_now_ns() - start;
+            canvas->notice_shown = true;
+        }
+        canvas->enough_space = false;
+        canvas->front_valid = false; // The notice overwrote whatever the terminal showed
+        canvas->overlay_cells = 0;
+        return;
+    }
+
+    // Cropped, a different part of the canvas fits after a resize: draw all of it again
+    int shown_w = canvas->width  < canvas->terminal_w ? canvas->width  : canvas->terminal_w;
+    int shown_h = canvas->height < canvas->terminal_h ? canvas->height : canvas->terminal_h;
+    if (shown_w != canvas->shown_w || shown_h != canvas->shown_h) {
+        canvas->shown_w = shown_w;
+        canvas->shown_h = shown_h;
+        canvas->front_valid = false;
+    }
+    stats->cropped = small;
+
+    // The style table is allocated on first use, except where the arena can't be touched here
+    if (!canvas->styles && tc_can_grow(canvas)) canvas->styles = tc_style_table_create(canvas, frame->mode);
+    tc_style_table_begin(canvas->styles, frame->mode);
+
+    TcRenderState state = {
+        .buffer      = canvas->buffer,
+        .buffer_size = canvas->buffer_size,
+        .buf_idx     = 0,
+        .canvas      = canvas,
+        .grow        = tc_can_grow(canvas),
+        .mode        = frame->mode,
+        .caps        = frame->caps,
+        .stats       = stats,
+        .fg          = COLOR_NONE, // Unknown until the first SGR sequence is sent
+        .bg          = COLOR_NONE,
+        .effect      = Effect_None,
+        .attrs_known = false,
+        .styles      = canvas->styles,
+        .style       = TC_STYLE_NONE,
+        .cursor_x    = -1,
+        .cursor_y    = -1,
+    };
+
+    if (frame->caps & Cap_Sync) {
+        state.buf_idx += tc_put_str(state.buffer + state.buf_idx, TC_SYNC_BEGIN); // Dropped again if nothing changed
+        state.frame_start = state.buf_idx;
+    }
+    
+    if (!canvas->enough_space) {
+        state.buf_idx += tc_put_str(state.buffer + state.buf_idx, "\033[0m\033[H\033[J"); // Clear the notice
+        canvas->enough_space = true;
+        canvas->notice_shown = false;
+    }
+
+    bool full = !canvas->front_valid;
+    stats->full_redraw = full;
+    if (!full) tc_overlay_restore(canvas, frame);
+    else       canvas->overlay_cells = 0; // Everything is redrawn anyway
+    if (!full && (frame->caps & Cap_Scroll)) tc_encode_scrolls(canvas, frame, &state);
+
+    #ifdef TC_USE_THREADS
+    if (canvas->bands) {
+        tc_bands_present(canvas, frame, &state, full, frame->overlay ? &previous : NULL);
+        canvas->front_valid = true;
+        stats->encode_ns = tc_now_ns() - start - stats->write_ns;
+        return;
+    }
+    #endif
+
+    tc_encode_rows(canvas, frame, &state, 0, canvas->shown_h, full);
+    canvas->front_valid = true;
+    if (frame->overlay) tc_overlay_draw(canvas, &state, &previous);
+
+    stats->encode_ns = tc_now_ns() - start - stats->write_ns;
+    if (state.buf_idx == state.frame_start && stats->bytes_written == 0) return; // Nothing changed since the last frame
+
+    tc_reserve(&state, MAX_ANSI_LENGTH);
+    state.buf_idx += tc_put_str(state.buffer + state.buf_idx, "\033[0m"); // Reset attributes
+    if (frame->caps & Cap_Sync) state.buf_idx += tc_put_str(state.buffer + state.buf_idx, TC_SYNC_END);
+    tc_flush_buffer(&state);
+    stats->encode_ns = tc_now_ns() - start - stats->write_ns;
+}
+
+static void tc_record_frame(TermCanvas *canvas);
+#ifdef TC_USE_THREADS
+static void tc_async_submit(TermCanvas *canvas);
+static void tc_async_invalidate(TermCanvas *canvas);
+#endif
+
+
+/*
+ * Frame pacing for tc_show. Returns false if this call should not present
+ * (Pacing_Skip before the frame is due); with Pacing_Sleep it waits instead.
+ */
+static bool tc_pace_frame(TermCanvas *canvas) {
+    if (canvas->frame_interval_ns <= 0) return true;
+
+    long long now = tc_now_ns();
+    if (now < canvas->next_frame_ns) {
+        if (canvas->pacing == Pacing_Skip) {
+            canvas->frames_skipped++;
+            return false;
+        }
+
+        struct timespec due = {
+            .tv_sec  = (time_t)(canvas->next_frame_ns / 1000000000LL),
+            .tv_nsec = (long)(canvas->next_frame_ns % 1000000000LL),
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) {}
+        now = canvas->next_frame_ns;
+    }
+
+    // Keep a steady cadence, but don't try to catch up after falling behind
+    canvas->next_frame_ns += canvas->frame_interval_ns;
+    if (canvas->next_frame_ns < now) canvas->next_frame_ns = now + canvas->frame_interval_ns;
+    return true;
+}
+
+/*
+ * Presents the canvas.
+ * Renders on the calling thread, or hands a snapshot to the presenter
+ * thread when async presenting is on (see tc_set_async).
+ */
+void tc_show(TermCanvas *canvas) {
+    if (!canvas) return;
+
+    tc_init_color_luts(canvas->mode); // No-op unless the mode was changed since tc_create
+
+    if (!tc_pace_frame(canvas)) return; // Not due yet; changes wait for the next frame
+    int skipped = canvas->frames_skipped;
+    canvas->frames_skipped = 0;
+
+    // Give the application a chance to fit the canvas to a new terminal size
+    if (tc_poll_terminal_size(canvas) && canvas->on_resize) {
+        canvas->on_resize(canvas, canvas->size_w, canvas->size_h, canvas->on_resize_data);
+    }
+
+    if (canvas->recorder) tc_record_frame(canvas);
+
+    #ifdef TC_USE_THREADS
+    if (canvas->presenter) {
+        tc_async_submit(canvas);
+        canvas->stats.frames_skipped = skipped;
+        return;
+    }
+    #endif
+
+    TcFrame frame = {
+        .pixels      = canvas->pixels,
+        .dirty       = canvas->dirty,
+        .track_dirty = canvas->track_dirty,
+        .mode        = canvas->mode,
+        .caps        = canvas->caps,
+        .overlay     = canvas->stats_overlay,
+        .overflow    = canvas->overflow,
+        .terminal_w  = canvas->size_w,
+        .terminal_h  = canvas->size_h,
+    };
+    frame.scroll_count = canvas->scroll_count;
+    memcpy(frame.scrolls, canvas->scrolls, sizeof(TcScroll) * (size_t)(canvas->scroll_count));
+    canvas->scroll_count = 0;
+    tc_present_frame(canvas, &frame, &canvas->stats);
+    canvas->stats.frames_skipped = skipped;
+}
+
+/*
+ * Forces the next tc_show to redraw the whole canvas.
+ * Use it when something other than the canvas wrote to the terminal.
+ */
+void tc_invalidate(TermCanvas *canvas) {
+    if (!canvas) return;
+
+    #ifdef TC_USE_THREADS
+    if (canvas->presenter) {
+        tc_async_invalidate(canvas);
+        return;
+    }
+    #endif
+
+    canvas->front_valid  = false;
+    canvas->notice_shown = false;
+}
+
+/*
+ * Sets the optional sequences (Cap_* flags) the renderer may use.
+ * 0 turns output compression off.
+ */
+void tc_set_caps(TermCanvas *canvas, unsigned caps) {
+    if (canvas) canvas->caps = caps;
+}
+
+/*
+ * Limits tc_show to the given frame rate (0 turns pacing off).
+ * Pacing_Sleep blocks until the next frame is due, Pacing_Skip returns right
+ * away so several updates get coalesced into one presented frame. With
+ * Pacing_Skip, the last update before a pause may stay unpresented: turn
+ * pacing off (or call again later) to make sure it goes out.
+ */
+void tc_set_target_fps(TermCanvas *canvas, int fps, TcPacing pacing) {
+    if (!canvas) return;
+
+    canvas->frame_interval_ns = fps > 0 ? 1000000000LL / fps : 0;
+    canvas->next_frame_ns     = 0; // The next tc_show presents right away
+    canvas->pacing            = pacing;
+    canvas->frames_skipped    = 0;
+}
+
+/*
+ * Chooses what tc_show presents while the terminal is smaller than the
+ * canvas: the size notice (the default), written once per terminal size,
+ * or the part of the canvas that fits, diffed like any other frame.
+ */
+void tc_set_overflow(TermCanvas *canvas, TcOverflow overflow) {
+    if (canvas) canvas->overflow = overflow;
+}
+
+/*
+ * Points the canvas output somewhere else (a socket for a remote viewer,
+ * an in-memory buffer, ...). The next frame is a full redraw, so a new
+ * destination starts from a complete picture.
+ * Sink_Memory contents are only safe to read while async presenting is off.
+ * Returns false if async presenting could not be restarted.
+ */
+bool tc_set_sink(TermCanvas *canvas, TcSink sink) {
+    if (!canvas) return false;
+
+    #ifdef TC_USE_THREADS
+    bool async = canvas->presenter != NULL;
+    tc_set_async(canvas, false); // The presenter writes to the sink
+    #endif
+
+    canvas->sink = sink;
+    canvas->front_valid = false;
+
+    #ifdef TC_USE_THREADS
+    if (async) return tc_set_async(canvas, true);
+    #endif
+    return true;
+}
+
+/*
+ * Returns what a Sink_Memory canvas produced so far (NULL if nothing).
+ */
+const char *tc_sink_memory(const TermCanvas *canvas, size_t *len) {
+    if (len) *len = canvas ? canvas->sink_len : 0;
+    return canvas && canvas->sink_len > 0 ? canvas->sink_memory : NULL;
+}
+
+/*
+ * Drops the contents of a Sink_Memory canvas, keeping the allocation.
+ */
+void tc_sink_memory_clear(TermCanvas *canvas) {
+    if (canvas) canvas->sink_len = 0;
+}
+
+/*
+ * Writes the symbols of the canvas as UTF-8 text, one line per row.
+ * Works like snprintf: out is always NUL-terminated (if size > 0) and the
+ * return value is the full length, so tc_dump_text(canvas, NULL, 0) + 1
+ * is the size needed.
+ */
+size_t tc_dump_text(const TermCanvas *canvas, char *out, size_t size) {
+    if (!canvas) {
+        if (size > 0) out[0] = '\0';
+        return 0;
+    }
+
+    size_t len = 0;
+    for (int y = 0; y < canvas->height; y++) {
+        for (int x = 0; x <= canvas->width; x++) {
+            char utf8[TC_CELL_BYTES];
+            int n = 1;
+            if (x < canvas->width) n = tc_put_cell(utf8, &canvas->pixels[y][x], x, canvas->width);
+            else utf8[0] = '\n';
+
+            if (len + (size_t)(n) < size) memcpy(out + len, utf8, (size_t)(n));
+            else if (len < size) size = len + 1; // Never cut a symbol in half
+            len += (size_t)(n);
+        }
+    }
+    if (size > 0) out[len < size ? len : size - 1] = '\0';
+    return len;
+}
+
+/*
+ * Copies the raw cell grid row by row into out (width * height pixels).
+ * Returns the number of pixels copied.
+ */
+int tc_dump_cells(const TermCanvas *canvas, TcPixel *out) {
+    if (!canvas || !out) return 0;
+
+    for (int y = 0; y < canvas->height; y++) {
+        memcpy(out + (size_t)(y) * (size_t)(canvas->width), canvas->pixels[y], (size_t)(canvas->width) * sizeof(TcPixel));
+    }
+    return canvas->width * canvas->height;
+}
+
+/*
+ * Sets the function tc_show calls when the terminal size changed
+ * (NULL to remove it). Without one, a canvas larger than the terminal
+ * shows the "too small" notice until the terminal grows again.
+ */
+void tc_set_resize_callback(TermCanvas *canvas, TcResizeCallback callback, void *user_data) {
+    if (!canvas) return;
+
+    canvas->on_resize      = callback;
+    canvas->on_resize_data = user_data;
+}
+
+/*
+ * Returns the statistics of the last presented frame.
+ * In async mode, that is the last frame the presenter thread finished,
+ * as of the latest tc_show call.
+ */
+const TcStats *tc_get_stats(const TermCanvas *canvas) {
+    return canvas ? &canvas->stats : NULL;
+}
+
+
+
+#ifdef TC_USE_THREADS
+// -----------------------------------------------------------------------------
+//  Asynchronous Presenter
+// -----------------------------------------------------------------------------
+/*
+ * Presenter thread state (triple buffering).
+ * The application draws into canvas->pixels; tc_show copies them into the
+ * pending slot; the thread swaps pending with its in-flight slot and renders
+ * that. If the thread is still busy when the next snapshot arrives, the
+ * pending one is overwritten: frames are dropped, never queued.
+ * While the presenter runs it owns the front buffer, the render buffer and
+ * the terminal state of the canvas.
+ */
+struct TcPresenter {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+    TcFrame pending;      // Latest snapshot, waiting for the thread
+    TcFrame inflight;     // Snapshot the thread is rendering
+    bool    has_pending;  // pending holds a frame that was not taken yet
+    bool    invalidate;   // tc_invalidate was called
+    bool    quit;         // Stop after presenting what is pending
+    int     dropped;      // Snapshots replaced since the last presented frame
+    TcStats stats;        // Stats of the last frame the thread finished
+};
+
+/*
+ * Presenter thread: waits for snapshots and renders them.
+ */
+static void *tc_presenter_main(void *arg) {
+    TermCanvas *canvas = (TermCanvas *)arg;
+    TcPresenter *presenter = canvas->presenter;
+
+    pthread_mutex_lock(&presenter->lock);
+    for (;;) {
+        while (!presenter->has_pending && !presenter->quit) {
+            pthread_cond_wait(&presenter->wake, &presenter->lock);
+        }
+        if (!presenter->has_pending) break; // Quit with nothing left to present
+
+        TcFrame frame = presenter->pending;
+        presenter->pending  = presenter->inflight;
+        presenter->inflight = frame;
+        presenter->has_pending = false;
+
+        int  dropped    = presenter->dropped;
+        bool invalidate = presenter->invalidate;
+        presenter->dropped    = 0;
+        presenter->invalidate = false;
+        pthread_mutex_unlock(&presenter->lock);
+
+        if (invalidate) {
+            canvas->front_valid  = false;
+            canvas->notice_shown = false;
+        }
+
+        TcStats stats = presenter->stats; // Only this thread writes it
+        tc_present_frame(canvas, &presenter->inflight, &stats);
+        stats.frames_dropped = dropped;
+
+        pthread_mutex_lock(&presenter->lock);
+        presenter->stats = stats;
+    }
+    pthread_mutex_unlock(&presenter->lock);
+
+    return NULL;
+}
+
+/*
+ * Hands a snapshot of the canvas to the presenter thread (called by tc_show).
+ * Copies the pixels and merges the dirty spans into the pending slot.
+ */
+static void tc_async_submit(TermCanvas *canvas) {
+    TcPresenter *presenter = canvas->presenter;
+
+    pthread_mutex_lock(&presenter->lock);
+
+    if (presenter->has_pending) presenter->dropped++;
+
+    TcFrame *pending = &presenter->pending;
+    for (int y = 0; y < canvas->height; y++) {
+        memcpy(pending->pixels[y], canvas->pixels[y], (size_t)(canvas->width) * sizeof(TcPixel));
+
+        TcDirtySpan span = canvas->dirty[y];
+        if (span.x0 < pending->dirty[y].x0) pending->dirty[y].x0 = span.x0;
+        if (span.x1 > pending->dirty[y].x1) pending->dirty[y].x1 = span.x1;
+        canvas->dirty[y] = (TcDirtySpan){canvas->width, 0};
+    }
+    pending->track_dirty   = canvas->track_dirty;
+    pending->mode          = canvas->mode;
+    pending->caps          = canvas->caps;
+    pending->overlay       = canvas->stats_overlay;
+    pending->overflow      = canvas->overflow;
+    pending->terminal_w    = canvas->size_w;
+    pending->terminal_h    = canvas->size_h;
+    if (!presenter->has_pending) pending->scroll_count = 0;
+    for (int i = 0; i < canvas->scroll_count && pending->scroll_count < TC_SCROLL_MAX; i++) {
+        pending->scrolls[pending->scroll_count++] = canvas->scrolls[i]; // Frames that get merged keep their scrolls in order
+    }
+    canvas->scroll_count   = 0;
+    presenter->has_pending = true;
+
+    canvas->stats = presenter->stats;
+
+    pthread_cond_signal(&presenter->wake);
+    pthread_mutex_unlock(&presenter->lock);
+}
+
+/*
+ * Makes the presenter thread redraw the whole canvas on its next frame.
+ */
+static void tc_async_invalidate(TermCanvas *canvas) {
+    TcPresenter *presenter = canvas->presenter;
+
+    pthread_mutex_lock(&presenter->lock);
+    presenter->invalidate = true;
+    pthread_mutex_unlock(&presenter->lock);
+}
+
+/*
+ * Allocates one snapshot slot (pixels and dirty spans).
+ */
+static bool tc_frame_alloc(TermCanvas *canvas, TcFrame *frame) {
+    void *blob   = tc_alloc(canvas, tc_grid_size(canvas->width, canvas->height));
+    frame->dirty = (TcDirtySpan *)tc_alloc(canvas, sizeof(TcDirtySpan) * (size_t)(canvas->height));
+    if (!blob || !frame->dirty) {
+        tc_free(frame->dirty);
+        tc_free(blob);
+        return false;
+    }
+
+    frame->pixels = tc_grid_init(blob, canvas->width, canvas->height);
+    for (int y = 0; y < canvas->height; y++) {
+        frame->dirty[y] = (TcDirtySpan){0, canvas->width};
+    }
+    return true;
+}
+
+/*
+ * Turns async presenting on or off.
+ * While on, tc_show only snapshots the canvas and returns; a background thread
+ * encodes and writes the frames, dropping intermediate ones if the terminal
+ * can't keep up. Turning it off (or tc_destroy) presents the last pending
+ * snapshot and joins the thread.
+ * Returns false if the thread could not be started.
+ */
+bool tc_set_async(TermCanvas *canvas, bool enabled) {
+    if (!canvas) return false;
+    if (enabled == (canvas->presenter != NULL)) return true;
+
+    if (!enabled) {
+        TcPresenter *presenter = canvas->presenter;
+
+        pthread_mutex_lock(&presenter->lock);
+        presenter->quit = true;
+        pthread_cond_signal(&presenter->wake);
+        pthread_mutex_unlock(&presenter->lock);
+        pthread_join(presenter->thread, NULL);
+
+        canvas->stats = presenter->stats;
+        canvas->presenter = NULL;
+
+        pthread_cond_destroy(&presenter->wake);
+        pthread_mutex_destroy(&presenter->lock);
+        tc_free(presenter->inflight.dirty);
+        tc_free(presenter->inflight.pixels);
+        tc_free(presenter->pending.dirty);
+        tc_free(presenter->pending.pixels);
+        tc_free(presenter);
+        return true;
+    }
+
+    // The presenter thread can't allocate from an arena, so the style table is made up front
+    if (!canvas->styles) canvas->styles = tc_style_table_create(canvas, canvas->mode);
+
+    TcPresenter *presenter = (TcPresenter *)tc_alloc(canvas, sizeof(TcPresenter));
+    if (!presenter) return false;
+    *presenter = (TcPresenter){0};
+
+    if (!tc_frame_alloc(canvas, &presenter->pending)) {
+        tc_free(presenter);
+        return false;
+    }
+    if (!tc_frame_alloc(canvas, &presenter->inflight)) {
+        tc_free(presenter->pending.dirty);
+        tc_free(presenter->pending.pixels);
+        tc_free(presenter);
+        return false;
+    }
+
+    pthread_mutex_init(&presenter->lock, NULL);
+    pthread_cond_init(&presenter->wake, NULL);
+    presenter->stats = canvas->stats;
+
+    canvas->presenter = presenter;
+    if (pthread_create(&presenter->thread, NULL, tc_presenter_main, canvas) != 0) {
+        canvas->presenter = NULL;
+        pthread_cond_destroy(&presenter->wake);
+        pthread_mutex_destroy(&presenter->lock);
+        tc_free(presenter->inflight.dirty);
+        tc_free(presenter->inflight.pixels);
+        tc_free(presenter->pending.dirty);
+        tc_free(presenter->pending.pixels);
+        tc_free(presenter);
+        return false;
+    }
+    return true;
+}
+#endif // TC_USE_THREADS
+
+
+
+// -----------------------------------------------------------------------------
+//  Dirty Tracking and Drawing
+// -----------------------------------------------------------------------------
+/*
+ * Extends the dirty span of one row (no clipping, callers clip).
+ */
+static inline void tc_dirty_row(TermCanvas *canvas, int y, int x0, int x1) {
+    TcDirtySpan *span = &canvas->dirty[y];
+    if (x0 < span->x0) span->x0 = x0;
+    if (x1 > span->x1) span->x1 = x1;
+}
+
+/*
+ * Marks a rectangle as changed.
+ * Call it after writing canvas->pixels directly while dirty tracking is on.
+ */
+void tc_mark_dirty(TermCanvas *canvas, int y, int x, int height, int width) {
+    if (!canvas) return;
+
+    int x0 = x < 0 ? 0 : x;
+    int y0 = y < 0 ? 0 : y;
+    int x1 = x + width  > canvas->width  ? canvas->width  : x + width;
+    int y1 = y + height > canvas->height ? canvas->height : y + height;
+    if (x0 >= x1) return;
+
+    for (int row = y0; row < y1; row++) tc_dirty_row(canvas, row, x0, x1);
+}
+
+/*
+ * Turns dirty tracking on or off.
+ * While on, tc_show only scans the rows and columns marked dirty by the
+ * drawing helpers and tc_mark_dirty, instead of comparing every cell against
+ * the front buffer. Canvases whose pixels are modified directly without
+ * tc_mark_dirty should keep it off (the default).
+ */
+void tc_set_dirty_tracking(TermCanvas *canvas, bool enabled) {
+    if (!canvas) return;
+
+    canvas->track_dirty = enabled;
+    tc_mark_dirty(canvas, 0, 0, canvas->height, canvas->width); // Nothing was tracked before
+}
+
+/*
+ * Writes a single pixel and marks it dirty.
+ */
+void tc_set_pixel(TermCanvas *canvas, int y, int x, TcPixel pixel) {
+    if (!canvas || x < 0 || y < 0 || x >= canvas->width || y >= canvas->height) return;
+
+    canvas->pixels[y][x] = pixel;
+    tc_dirty_row(canvas, y, x, x + 1);
+}
+
+/*
+ * Clips a rectangle to [0, width) x [0, height).
+ * Shifts src_y/src_x along when the destination corner is cut off.
+ * Returns false if nothing is left.
+ */
+static inline bool tc_clip_rect(int canvas_w, int canvas_h, int *y, int *x, int *height, int *width,
+                                int *src_y, int *src_x) {
+    if (*y < 0) { *height += *y; if (src_y) *src_y -= *y; *y = 0; }
+    if (*x < 0) { *width  += *x; if (src_x) *src_x -= *x; *x = 0; }
+    if (*y + *height > canvas_h) *height = canvas_h - *y;
+    if (*x + *width  > canvas_w) *width  = canvas_w - *x;
+
+    return *height > 0 && *width > 0;
+}
+
+/*
+ * Fills a rectangle with one pixel value.
+ * The first row is filled with a plain store loop (vectorized by the compiler),
+ * the remaining rows are memcpy'd from it.
+ */
+void tc_fill_area(TermCanvas *canvas, int y, int x, int height, int width,
+                  wchar_t symbol, Color foreground, Color background, TcEffect effect) {
+    if (!canvas || !tc_clip_rect(canvas->width, canvas->height, &y, &x, &height, &width, NULL, NULL)) return;
+
+    TcPixel pixel = tc_pixel(background, foreground, symbol, effect);
+    TcPixel *first = canvas->pixels[y] + x;
+    for (int i = 0; i < width; i++) first[i] = pixel;
+    tc_dirty_row(canvas, y, x, x + width);
+
+    for (int row = y + 1; row < y + height; row++) {
+        memcpy(canvas->pixels[row] + x, first, (size_t)(width) * sizeof(TcPixel));
+        tc_dirty_row(canvas, row, x, x + width);
+    }
+}
+
+/*
+ * Copies a rectangle of pixels from another canvas (or the same one).
+ * Overlapping copies within one canvas are handled like memmove.
+ */
+void tc_blit(TermCanvas *dst, int y, int x, const TermCanvas *src, int src_y, int src_x, int height, int width) {
+    if (!dst || !src) return;
+
+    // Clip against the source first, then against the destination
+    if (!tc_clip_rect(src->width, src->height, &src_y, &src_x, &height, &width, &y, &x)) return;
+    if (!tc_clip_rect(dst->width, dst->height, &y, &x, &height, &width, &src_y, &src_x)) return;
+
+    // Copy bottom-up when moving rows down inside the same canvas
+    bool backwards = (dst == src && y > src_y);
+    for (int i = 0; i < height; i++) {
+        int row = backwards ? height - 1 - i : i;
+        memmove(dst->pixels[y + row] + x, src->pixels[src_y + row] + src_x, (size_t)(width) * sizeof(TcPixel));
+        tc_dirty_row(dst, y + row, x, x + width);
+    }
+}
+
+/*
+ * Copies a sprite (height rows of width pixels, stored contiguously).
+ */
+void tc_blit_sprite(TermCanvas *dst, int y, int x, const TcPixel *sprite, int height, int width) {
+    if (!dst || !sprite) return;
+
+    int stride = width;
+    int sprite_y = 0;
+    int sprite_x = 0;
+    if (!tc_clip_rect(dst->width, dst->height, &y, &x, &height, &width, &sprite_y, &sprite_x)) return;
+
+    for (int row = 0; row < height; row++) {
+        const TcPixel *line = sprite + (size_t)(sprite_y + row) * (size_t)(stride) + sprite_x;
+        memcpy(dst->pixels[y + row] + x, line, (size_t)(width) * sizeof(TcPixel));
+        tc_dirty_row(dst, y + row, x, x + width);
+    }
+}
+
+/*
+ * Scrolls rows [y, y + height) by lines: up when positive, down when
+ * negative. The rows that come in get the canvas fill. Only row pointers
+ * move, and with Cap_Scroll the terminal moves the lines as well, so the
+ * next frame sends just the new lines (and whatever else changed).
+ * Hardware scrolls move whole terminal lines, so anything right of the
+ * canvas moves along with them.
+ */
+void tc_scroll(TermCanvas *canvas, int y, int height, int lines) {
+    if (!canvas || lines == 0) return;
+
+    if (y < 0) {
+        height += y;
+        y = 0;
+    }
+    if (height > canvas->height - y) height = canvas->height - y;
+    if (height <= 0) return;
+
+    int count = lines > 0 ? lines : -lines;
+    if (count > height) count = height;
+
+    if (count < height) {
+        tc_rotate_rows(canvas->pixels + y, height, lines);
+
+        // Consecutive scrolls of one region the same way are sent as one
+        TcScroll *last = canvas->scroll_count > 0 ? &canvas->scrolls[canvas->scroll_count - 1] : NULL;
+        if (last && last->top == y && last->bottom == y + height && (last->lines > 0) == (lines > 0) &&
+            (last->lines > 0 ? last->lines : -last->lines) + count < height) {
+            last->lines += lines > 0 ? count : -count;
+        }
+        else if (canvas->scroll_count < TC_SCROLL_MAX) {
+            canvas->scrolls[canvas->scroll_count++] = (TcScroll){y, y + height, lines > 0 ? count : -count};
+        }
+    }
+
+    int first = lines > 0 ? y + height - count : y;
+    for (int row = first; row < first + count; row++) {
+        for (int x = 0; x < canvas->width; x++) canvas->pixels[row][x] = canvas->fill;
+    }
+    for (int row = y; row < y + height; row++) tc_dirty_row(canvas, row, 0, canvas->width);
+}
+
+/*
+ * Draws a single line of text. Wide glyphs take two cells (the second one
+ * TC_WIDE_CONT), combining marks join the symbol before them.
+ * Returns the number of cells written (text past the right edge is dropped).
+ */
+int tc_draw_text(TermCanvas *canvas, int y, int x, const wchar_t *text,
+                 Color foreground, Color background, TcEffect effect) {
+    if (!canvas || !text || y < 0 || y >= canvas->height) return 0;
+
+    TcPixel *row = canvas->pixels[y];
+    TcPixel blank = tc_pixel(background, foreground, L' ', effect);
+
+    // Skip the part left of the canvas (a wide glyph cut in half leaves a blank)
+    bool clipped = x < 0;
+    while (x < 0 && *text) x += tc_symbol_width((uint32_t)*text++);
+    int start = x;
+    if (clipped && x > 0 && canvas->width > 0) {
+        row[0] = blank;
+        start = 0;
+    }
+
+    int last = -1; // Cell of the previous symbol, where combining marks go
+    for (; *text; text++) {
+        int width = tc_symbol_width((uint32_t)*text);
+        if (width == 0) {
+            if (last >= 0) row[last] = tc_pixel(background, foreground, tc_cluster((wchar_t)row[last].symbol, text, 1), effect);
+            continue;
+        }
+        if (x >= canvas->width) break;
+        if (width == 2 && x + 1 == canvas->width) {
+            row[x++] = blank; // Only half of the glyph would fit
+            break;
+        }
+
+        row[x] = tc_pixel(background, foreground, *text, effect);
+        last = x++;
+        if (width == 2) row[x++] = tc_pixel(background, foreground, (wchar_t)TC_WIDE_CONT, effect);
+    }
+
+    if (x > start) tc_dirty_row(canvas, y, start, x);
+    return x - start;
+}
+
+
+
+// -----------------------------------------------------------------------------
+//  Color Kernels
+// -----------------------------------------------------------------------------
+/*
+ * Blends the selected colors of count pixels towards color (weight 0-256).
+ * The vector paths work on whole pixels in place: the two color words of a
+ * pixel are widened to 16-bit channels, mixed, narrowed back and merged
+ * under a lane mask, which also keeps COLOR_NONE colors and the symbol and
+ * effect words as they were. Results match color_mix bit for bit.
+ */
+static void tc_blend_row(TcPixel *row, int count, Color color, unsigned weight, TcColorSlot slots) {
+    int i = 0;
+    bool bg = (slots & Slot_Background) != 0;
+    bool fg = (slots & Slot_Foreground) != 0;
+
+    #if defined(TC_SIMD_AVX2)
+    __m256i zero   = _mm256_setzero_si256();
+    __m256i none   = _mm256_set1_epi32((int)COLOR_NONE.color);
+    __m256i lanes  = _mm256_set_epi32(0, 0, fg ? -1 : 0, bg ? -1 : 0, 0, 0, fg ? -1 : 0, bg ? -1 : 0);
+    __m256i inv    = _mm256_set1_epi16((short)(256 - weight));
+    __m256i target = _mm256_mullo_epi16(_mm256_unpacklo_epi8(_mm256_set1_epi32((int)color.color), zero),
+                                        _mm256_set1_epi16((short)weight));
+    for (; i + 2 <= count; i += 2) {
+        __m256i *at = (__m256i *)(void *)(row + i);
+        __m256i px   = _mm256_loadu_si256(at);
+        __m256i mask = _mm256_andnot_si256(_mm256_cmpeq_epi32(px, none), lanes);
+        __m256i mix  = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(px, zero), inv),
+                                                          target), 8);
+        mix = _mm256_packus_epi16(mix, zero);
+        _mm256_storeu_si256(at, _mm256_or_si256(_mm256_and_si256(mask, mix), _mm256_andnot_si256(mask, px)));
+    }
+    #elif defined(TC_SIMD_SSE2)
+    __m128i zero   = _mm_setzero_si128();
+    __m128i none   = _mm_set1_epi32((int)COLOR_NONE.color);
+    __m128i lanes  = _mm_set_epi32(0, 0, fg ? -1 : 0, bg ? -1 : 0);
+    __m128i inv    = _mm_set1_epi16((short)(256 - weight));
+    __m128i target = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32((int)color.color), zero),
+                                     _mm_set1_epi16((short)weight));
+    for (; i < count; i++) {
+        __m128i *at = (__m128i *)(void *)(row + i);
+        __m128i px   = _mm_loadu_si128(at);
+        __m128i mask = _mm_andnot_si128(_mm_cmpeq_epi32(px, none), lanes);
+        __m128i mix  = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(px, zero), inv), target), 8);
+        mix = _mm_packus_epi16(mix, zero);
+        _mm_storeu_si128(at, _mm_or_si128(_mm_and_si128(mask, mix), _mm_andnot_si128(mask, px)));
+    }
+    #elif defined(TC_SIMD_NEON)
+    uint32x4_t none   = vdupq_n_u32(COLOR_NONE.color);
+    uint32x4_t lanes  = (uint32x4_t){bg ? 0xFFFFFFFFu : 0, fg ? 0xFFFFFFFFu : 0, 0, 0};
+    uint16x8_t inv    = vdupq_n_u16((uint16_t)(256 - weight));
+    uint16x8_t target = vmulq_n_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(color.color))), (uint16_t)weight);
+    for (; i < count; i++) {
+        uint32_t *at = (uint32_t *)(void *)(row + i);
+        uint32x4_t px   = vld1q_u32(at);
+        uint32x4_t mask = vbicq_u32(lanes, vceqq_u32(px, none));
+        uint16x8_t wide = vmovl_u8(vget_low_u8(vreinterpretq_u8_u32(px)));
+        uint8x8_t  mix  = vshrn_n_u16(vmlaq_u16(target, wide, inv), 8);
+        uint32x4_t out  = vreinterpretq_u32_u8(vcombine_u8(mix, vget_high_u8(vreinterpretq_u8_u32(px))));
+        vst1q_u32(at, vbslq_u32(mask, out, px));
+    }
+    #endif
+
+    for (; i < count; i++) {
+        TcPixel *px = &row[i];
+        if (bg && !is_none(px->background)) px->background = color_mix(px->background, color, weight);
+        if (fg && !is_none(px->foreground)) px->foreground = color_mix(px->foreground, color, weight);
+    }
+}
+
+/*
+ * Blends the selected colors of a rectangle towards color
+ * (alpha 0 keeps them, 255 replaces them). Fades are a series of these with
+ * a growing alpha over a copy of the original pixels.
+ */
+void tc_blend_area(TermCanvas *canvas, int y, int x, int height, int width,
+                   Color color, uint8_t alpha, TcColorSlot slots) {
+    if (!canvas || !(slots & Slot_Both) || is_none(color)) return;
+    if (!tc_clip_rect(canvas->width, canvas->height, &y, &x, &height, &width, NULL, NULL)) return;
+
+    unsigned weight = color_alpha_weight(alpha);
+    if (weight == 0) return;
+
+    for (int row = y; row < y + height; row++) {
+        tc_blend_row(canvas->pixels[row] + x, width, color, weight, slots);
+        tc_dirty_row(canvas, row, x, x + width);
+    }
+}
+
+/*
+ * Darkens the selected colors of a rectangle towards black.
+ */
+void tc_darken_area(TermCanvas *canvas, int y, int x, int height, int width, uint8_t amount, TcColorSlot slots) {
+    tc_blend_area(canvas, y, x, height, width, COLOR_BLACK, amount, slots);
+}
+
+/*
+ * Sets the selected colors of a rectangle to a linear gradient from `from`
+ * (first row or column) to `to` (last one), left to right or top to bottom.
+ * Symbols and effects are kept. COLOR_NONE cells are overwritten as well.
+ */
+void tc_gradient_area(TermCanvas *canvas, int y, int x, int height, int width,
+                      Color from, Color to, bool vertical, TcColorSlot slots) {
+    if (!canvas || !(slots & Slot_Both)) return;
+
+    // Positions along the gradient come from the unclipped rectangle
+    int steps  = (vertical ? height : width) - 1;
+    int origin = vertical ? y : x;
+    if (!tc_clip_rect(canvas->width, canvas->height, &y, &x, &height, &width, NULL, NULL)) return;
+
+    bool bg = (slots & Slot_Background) != 0;
+    bool fg = (slots & Slot_Foreground) != 0;
+
+    Color stack[256];
+    Color *colors = stack;
+    if (!vertical && width > (int)(sizeof(stack) / sizeof(stack[0]))) {
+        colors = (Color *)malloc(sizeof(Color) * (size_t)(width));
+        if (!colors) return;
+    }
+
+    // Horizontal gradients: every row gets the same colors, computed once
+    if (!vertical) {
+        for (int i = 0; i < width; i++) {
+            unsigned weight = steps > 0 ? (unsigned)((x + i - origin) * 256 / steps) : 0;
+            colors[i] = color_mix(from, to, weight);
+        }
+    }
+
+    for (int row = y; row < y + height; row++) {
+        TcPixel *line = canvas->pixels[row] + x;
+        if (vertical) {
+            Color color = color_mix(from, to, steps > 0 ? (unsigned)((row - origin) * 256 / steps) : 0);
+            for (int i = 0; i < width; i++) {
+                if (bg) line[i].background = color;
+                if (fg) line[i].foreground = color;
+            }
+        } else {
+            for (int i = 0; i < width; i++) {
+                if (bg) line[i].background = colors[i];
+                if (fg) line[i].foreground = colors[i];
+            }
+        }
+        tc_dirty_row(canvas, row, x, x + width);
+    }
+
+    if (colors != stack) free(colors);
+}
+
+
+
+// -----------------------------------------------------------------------------
+//  Compositing
+// -----------------------------------------------------------------------------
+/*
+ * One layer of a compositor.
+ */
+typedef struct {
+    TermCanvas *canvas;
+    Coords      position; // Top-left corner in the target, z orders the layers
+    bool        visible;
+    int         order;    // Insertion order, keeps layers with equal z stable
+    int         width;    // Layer size at the last update (tc_resize is noticed)
+    int         height;
+} TcLayer;
+
+/*
+ * Compositor state.
+ * Only damaged target cells are recomposited: cells under layers that
+ * changed (their dirty spans), moved, were resized, shown or hidden.
+ */
+struct TcCompositor {
+    TermCanvas  *target;
+    TcLayer     *layers;     // Sorted by z, bottom first
+    int          count;
+    int          capacity;
+    int          next_order;
+    TcDirtySpan *damage;     // Per target row: columns to recomposite
+    int          width;      // Target size damage is sized for
+    int          height;
+};
+
+/*
+ * Follows a tc_resize of the target: resizes the damage rows and damages
+ * the whole target. If memory runs out the old size is kept (and damage
+ * stays clipped to it) until the next try.
+ */
+static void tc_compositor_sync(TcCompositor *compositor) {
+    TermCanvas *target = compositor->target;
+    if (compositor->width == target->width && compositor->height == target->height) return;
+
+    TcDirtySpan *damage = (TcDirtySpan *)tc_realloc(target, compositor->damage,
+                                                    sizeof(TcDirtySpan) * (size_t)(target->height));
+    if (!damage) return;
+
+    compositor->damage = damage;
+    compositor->width  = target->width;
+    compositor->height = target->height;
+    for (int y = 0; y < target->height; y++) compositor->damage[y] = (TcDirtySpan){0, target->width};
+}
+
+/*
+ * Marks a target rectangle for recompositing (clipped to the target).
+ */
+static void tc_compositor_damage(TcCompositor *compositor, int y, int x, int height, int width) {
+    tc_compositor_sync(compositor);
+    if (!tc_clip_rect(compositor->width, compositor->height, &y, &x, &height, &width, NULL, NULL)) return;
+
+    for (int row = y; row < y + height; row++) {
+        TcDirtySpan *span = &compositor->damage[row];
+        if (x < span->x0)         span->x0 = x;
+        if (x + width > span->x1) span->x1 = x + width;
+    }
+}
+
+static inline void tc_layer_damage(TcCompositor *compositor, const TcLayer *layer) {
+    if (layer->visible) {
+        tc_compositor_damage(compositor, layer->position.y, layer->position.x, layer->height, layer->width);
+    }
+}
+
+static inline bool tc_layer_below(const TcLayer *a, const TcLayer *b) {
+    return a->position.z < b->position.z || (a->position.z == b->position.z && a->order < b->order);
+}
+
+/*
+ * Moves the layer at index i to its place in the z order.
+ */
+static void tc_compositor_resort(TcCompositor *compositor, int i) {
+    TcLayer *layers = compositor->layers;
+    TcLayer layer = layers[i];
+
+    while (i > 0 && tc_layer_below(&layer, &layers[i - 1])) {
+        layers[i] = layers[i - 1];
+        i--;
+    }
+    while (i < compositor->count - 1 && tc_layer_below(&layers[i + 1], &layer)) {
+        layers[i] = layers[i + 1];
+        i++;
+    }
+    layers[i] = layer;
+}
+
+static TcLayer *tc_compositor_find(TcCompositor *compositor, const TermCanvas *canvas) {
+    for (int i = 0; i < compositor->count; i++) {
+        if (compositor->layers[i].canvas == canvas) return &compositor->layers[i];
+    }
+    return NULL;
+}
+
+/*
+ * Creates a compositor that renders into target (presented with tc_show as usual).
+ * Its memory comes from the target canvas (and its arena, if any). The target
+ * may be resized with tc_resize; the next update recomposites all of it.
+ */
+TcCompositor *tc_compositor_create(TermCanvas *target) {
+    if (!target) return NULL;
+
+    TcCompositor *compositor = (TcCompositor *)tc_alloc(target, sizeof(TcCompositor));
+    if (!compositor) return NULL;
+    *compositor = (TcCompositor){0};
+    compositor->target = target;
+
+    compositor->width  = target->width;
+    compositor->height = target->height;
+
+    compositor->damage = (TcDirtySpan *)tc_alloc(target, sizeof(TcDirtySpan) * (size_t)(target->height));
+    if (!compositor->damage) {
+        tc_free(compositor);
+        return NULL;
+    }
+    for (int y = 0; y < target->height; y++) compositor->damage[y] = (TcDirtySpan){target->width, 0};
+
+    return compositor;
+}
+
+/*
+ * Frees the compositor. The layer canvases and the target are left alone.
+ */
+void tc_compositor_destroy(TcCompositor *compositor) {
+    if (!compositor) return;
+
+    tc_free(compositor->layers);
+    tc_free(compositor->damage);
+    tc_free(compositor);
+}
+
+/*
+ * Adds a visible layer. Returns false if it is already there or memory runs out.
+ */
+bool tc_compositor_add(TcCompositor *compositor, TermCanvas *layer, Coords position) {
+    if (!compositor || !layer || tc_compositor_find(compositor, layer)) return false;
+
+    if (compositor->count == compositor->capacity) {
+        int capacity = compositor->capacity ? compositor->capacity * 2 : 8;
+        TcLayer *layers = (TcLayer *)tc_realloc(compositor->target, compositor->layers,
+                                                sizeof(TcLayer) * (size_t)(capacity));
+        if (!layers) return false;
+        compositor->layers   = layers;
+        compositor->capacity = capacity;
+    }
+
+    TcLayer *added = &compositor->layers[compositor->count++];
+    *added = (TcLayer){
+        .canvas   = layer,
+        .position = position,
+        .visible  = true,
+        .order    = compositor->next_order++,
+        .width    = layer->width,
+        .height   = layer->height,
+    };
+    tc_layer_damage(compositor, added);
+    tc_mark_dirty(layer, 0, 0, layer->height, layer->width); // The dirty spans so far are meaningless here
+    tc_compositor_resort(compositor, compositor->count - 1);
+    return true;
+}
+
+/*
+ * Removes a layer; what it covered is recomposited on the next update.
+ */
+void tc_compositor_remove(TcCompositor *compositor, TermCanvas *layer) {
+    if (!compositor) return;
+
+    TcLayer *found = tc_compositor_find(compositor, layer);
+    if (!found) return;
+
+    tc_layer_damage(compositor, found);
+    int index = (int)(found - compositor->layers);
+    memmove(found, found + 1, sizeof(TcLayer) * (size_t)(compositor->count - index - 1));
+    compositor->count--;
+}
+
+/*
+ * Moves a layer and/or changes its z order.
+ */
+void tc_compositor_move(TcCompositor *compositor, TermCanvas *layer, Coords position) {
+    if (!compositor) return;
+
+    TcLayer *found = tc_compositor_find(compositor, layer);
+    if (!found) return;
+    if (found->position.y == position.y && found->position.x == position.x && found->position.z == position.z) return;
+
+    tc_layer_damage(compositor, found); // Where it was
+    found->position = position;
+    tc_layer_damage(compositor, found); // Where it is now
+    tc_compositor_resort(compositor, (int)(found - compositor->layers));
+}
+
+/*
+ * Shows or hides a layer without removing it.
+ */
+void tc_compositor_set_visible(TcCompositor *compositor, TermCanvas *layer, bool visible) {
+    if (!compositor) return;
+
+    TcLayer *found = tc_compositor_find(compositor, layer);
+    if (!found || found->visible == visible) return;
+
+    found->visible = true;
+    tc_layer_damage(compositor, found);
+    found->visible = visible;
+}
+
+/*
+ * Resolves one target cell from the layers covering it, topmost first.
+ * The symbol, foreground and effect come from the topmost layer whose cell is
+ * not a transparent blank (a space on a COLOR_NONE background); the
+ * background from the topmost layer whose background is not COLOR_NONE.
+ * Whatever no layer provides comes from the target's fill pixel.
+ */
+static TcPixel tc_composite_cell(const TcCompositor *compositor, const TcLayer *const *stack, int count, int y, int x) {
+    TcPixel fill = compositor->target->fill;
+    wchar_t  symbol = (wchar_t)fill.symbol;
+    Color    fg     = fill.foreground;
+    TcEffect effect = (TcEffect)fill.effect;
+    Color    bg     = fill.background;
+    bool     have_symbol = false;
+
+    for (int i = 0; i < count; i++) {
+        const TcLayer *layer = stack[i];
+        int ly = y - layer->position.y;
+        int lx = x - layer->position.x;
+        if (lx < 0 || lx >= layer->width) continue;
+
+        TcPixel px = layer->canvas->pixels[ly][lx];
+        if (!have_symbol && !(px.symbol == L' ' && is_none(px.background))) {
+            symbol = (wchar_t)px.symbol;
+            fg     = px.foreground;
+            effect = (TcEffect)px.effect;
+            have_symbol = true;
+        }
+        if (!is_none(px.background)) {
+            bg = px.background;
+            break;
+        }
+    }
+    return tc_pixel(bg, fg, symbol, effect);
+}
+
+/*
+ * Recomposites every damaged cell into the target and marks it dirty there,
+ * so the next tc_show only sends what the layers actually changed.
+ */
+void tc_compositor_update(TcCompositor *compositor) {
+    if (!compositor) return;
+    TermCanvas *target = compositor->target;
+    tc_compositor_sync(compositor);
+
+    // Collect damage: resized layers and the dirty spans of every layer
+    for (int i = 0; i < compositor->count; i++) {
+        TcLayer *layer = &compositor->layers[i];
+        TermCanvas *canvas = layer->canvas;
+
+        if (layer->width != canvas->width || layer->height != canvas->height) {
+            tc_layer_damage(compositor, layer);
+            layer->width  = canvas->width;
+            layer->height = canvas->height;
+            tc_mark_dirty(canvas, 0, 0, canvas->height, canvas->width);
+        }
+
+        for (int ly = 0; ly < canvas->height; ly++) {
+            TcDirtySpan span = canvas->dirty[ly];
+            canvas->dirty[ly] = (TcDirtySpan){canvas->width, 0};
+            if (layer->visible && span.x0 < span.x1) {
+                tc_compositor_damage(compositor, layer->position.y + ly, layer->position.x + span.x0,
+                                     1, span.x1 - span.x0);
+            }
+        }
+    }
+
+    const TcLayer *stack[64];
+    const TcLayer **rows = stack;
+    if (compositor->count > (int)(sizeof(stack) / sizeof(stack[0]))) {
+        rows = (const TcLayer **)malloc(sizeof(TcLayer *) * (size_t)(compositor->count));
+        if (!rows) return; // Damage is kept for the next update
+    }
+
+    // After a failed sync the damage may still be sized for the old target
+    int height = compositor->height < target->height ? compositor->height : target->height;
+    int width  = compositor->width  < target->width  ? compositor->width  : target->width;
+
+    for (int y = 0; y < height; y++) {
+        TcDirtySpan span = compositor->damage[y];
+        if (span.x0 >= span.x1) continue;
+        compositor->damage[y] = (TcDirtySpan){compositor->width, 0};
+        if (span.x1 > width) span.x1 = width;
+        if (span.x0 >= span.x1) continue;
+
+        // Visible layers covering this row and span, topmost first
+        int count = 0;
+        for (int i = compositor->count - 1; i >= 0; i--) {
+            const TcLayer *layer = &compositor->layers[i];
+            if (!layer->visible) continue;
+            if (y < layer->position.y || y >= layer->position.y + layer->height) continue;
+            if (span.x1 <= layer->position.x || span.x0 >= layer->position.x + layer->width) continue;
+            rows[count++] = layer;
+        }
+
+        TcPixel *row = target->pixels[y];
+        for (int x = span.x0; x < span.x1; x++) row[x] = tc_composite_cell(compositor, rows, count, y, x);
+        tc_dirty_row(target, y, span.x0, span.x1);
+    }
+
+    if (rows != stack) free(rows);
+}
+
+
+// -----------------------------------------------------------------------------
+//  Recording and Playback
+// -----------------------------------------------------------------------------
+/*
+ * Recording format (host byte order, checked through byte_order).
+ * A TcRecHeader, then one record per presented frame: a TcRecFrame and its
+ * runs, padded to a multiple of 8 bytes so every record header is aligned
+ * in a mapped file. Keyframes hold every cell, deltas only the cells that
+ * changed since the previous frame.
+ *
+ * A run is varint(gap) varint(count << 1 | repeat) and its cells (a single
+ * one if it repeats). gap is the number of cells skipped (row-major) since
+ * the end of the previous run. An ASCII cell with the attributes of the
+ * previous cell of the record is its symbol byte; any other cell is a
+ * 0x80 | Rec_* flag byte, the style (an id, or the attributes themselves),
+ * and the symbol in 1 or 3 bytes. Styles (background, foreground, effect)
+ * get ids in the order they are defined, starting over at every keyframe,
+ * so a frame can be decoded from the keyframe before it.
+ */
+#define TC_REC_MAGIC             "TCREC\0\0\2" // Last byte is the format version
+#define TC_REC_BYTE_ORDER        0x01020304u
+#define TC_REC_KEYFRAME_INTERVAL 300 // Default frames between keyframes
+#define TC_REC_MIN_REPEAT        3   // Identical cells are stored once from this many on
+#define TC_REC_STYLE_MAX         4096 // Styles defined per keyframe interval (then written in full)
+#define TC_REC_STYLE_INDEX       8192 // Hash slots of the recorder (power of two)
+#define TC_REC_CELL_MAX          13   // Longest encoded cell
+#define TC_REC_RUN_MAX           20   // Longest run header
+
+enum {
+    Rec_Style      = 1 << 0, // Cell flags: varint style id follows
+    Rec_Define     = 1 << 1, // Attributes follow (background, foreground, effect), they get the next id
+    Rec_Literal    = 1 << 2, // Attributes follow, without an id (the style table is full)
+    Rec_WideSymbol = 1 << 3, // Symbol takes 3 bytes instead of 1
+};
+
+typedef struct {
+    char     magic[8];
+    uint32_t byte_order;
+    uint32_t keyframe_interval;
+} TcRecHeader;
+
+enum {
+    Rec_Keyframe = 1,
+    Rec_Delta    = 2,
+};
+
+typedef struct {
+    uint32_t size;     // Record size in bytes, this header included (multiple of 8)
+    uint16_t type;     // Rec_Keyframe or Rec_Delta
+    uint16_t reserved;
+    uint16_t width;    // Canvas size of the frame
+    uint16_t height;
+    uint32_t runs;     // Number of runs that follow
+    uint64_t time_ns;  // Time since the recording started
+} TcRecFrame;
+
+_Static_assert(sizeof(TcRecHeader) == 16 && sizeof(TcRecFrame) == 24, "recording headers must not contain padding");
+
+/*
+ * A style: background, foreground and effect of a cell.
+ */
+typedef struct {
+    uint32_t background;
+    uint32_t foreground;
+    uint32_t effect;
+} TcRecAttrs;
+
+static inline bool tc_rec_attrs_equal(TcRecAttrs a, TcRecAttrs b) {
+    return a.background == b.background && a.foreground == b.foreground && a.effect == b.effect;
+}
+
+#define TC_REC_ATTRS_START ((TcRecAttrs){COLOR_NONE.color, COLOR_NONE.color, Effect_None})
+
+/*
+ * Recorder state.
+ */
+struct TcRecorder {
+    int       fd;
+    int       keyframe_interval;
+    int       since_keyframe;  // Frames recorded since the last keyframe
+    long long start_ns;
+    int       width;           // Size of last
+    int       height;
+    TcPixel  *last;            // Frame recorded last
+    char     *buffer;          // Record being built
+    size_t    len;
+    size_t    cap;
+    bool      failed;          // A write or allocation failed, nothing more is recorded
+    size_t    position;        // Cell index (row-major) where the last run ended
+    TcRecAttrs attrs;          // Attributes of the last encoded cell
+    TcRecAttrs *styles;        // Styles defined since the last keyframe (TC_REC_STYLE_MAX)
+    int        style_count;
+    uint16_t  *style_index;    // Hash of styles, id + 1 (0: empty)
+};
+
+static bool tc_rec_reserve(TermCanvas *canvas, TcRecorder *rec, size_t bytes) {
+    if (rec->len + bytes <= rec->cap) return true;
+
+    size_t cap = rec->cap ? rec->cap : 4096;
+    while (cap < rec->len + bytes) cap *= 2;
+    char *buffer = (char *)tc_realloc(canvas, rec->buffer, cap);
+    if (!buffer) {
+        rec->failed = true;
+        return false;
+    }
+    rec->buffer = buffer;
+    rec->cap    = cap;
+    return true;
+}
+
+static inline int tc_rec_put_varint(unsigned char *out, size_t value) {
+    int len = 0;
+    while (value >= 0x80) {
+        out[len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (unsigned char)value;
+    return len;
+}
+
+static inline int tc_rec_put_u32(unsigned char *out, uint32_t value) {
+    memcpy(out, &value, sizeof(value));
+    return (int)sizeof(value);
+}
+
+/*
+ * Looks up the id of a style, defining it if new.
+ * Returns -1 (and sets *defined) accordingly: *defined is true when the
+ * style was just given an id, the id is -1 when the table is full.
+ */
+static int tc_rec_style_id(TcRecorder *rec, TcRecAttrs attrs, bool *defined) {
+    uint32_t h = attrs.background * 0x9E3779B1u ^ attrs.foreground * 0x85EBCA77u ^ attrs.effect * 0xC2B2AE3Du;
+    uint32_t slot = (h ^ (h >> 15)) & (TC_REC_STYLE_INDEX - 1);
+    *defined = false;
+
+    for (;;) {
+        uint16_t entry = rec->style_index[slot];
+        if (entry == 0) break;
+        if (tc_rec_attrs_equal(rec->styles[entry - 1], attrs)) return entry - 1;
+        slot = (slot + 1) & (TC_REC_STYLE_INDEX - 1);
+    }
+    if (rec->style_count == TC_REC_STYLE_MAX) return -1;
+
+    int id = rec->style_count++;
+    rec->styles[id] = attrs;
+    rec->style_index[slot] = (uint16_t)(id + 1);
+    *defined = true;
+    return id;
+}
+
+static inline int tc_rec_put_attrs(unsigned char *out, TcRecAttrs attrs) {
+    int len = tc_rec_put_u32(out, attrs.background);
+    len += tc_rec_put_u32(out + len, attrs.foreground);
+    out[len++] = (unsigned char)attrs.effect;
+    return len;
+}
+
+/*
+ * Encodes one cell against the previous one (TC_REC_CELL_MAX bytes at most).
+ */
+static int tc_rec_put_cell(TcRecorder *rec, unsigned char *out, TcPixel px) {
+    uint32_t symbol = (uint32_t)px.symbol & 0xFFFFFF;
+    const TcCluster *cluster = tc_cluster_of(symbol);
+    if (cluster) symbol = (uint32_t)cluster->base; // Cluster ids only mean something in this process
+    TcRecAttrs attrs = {px.background.color, px.foreground.color, (uint32_t)px.effect};
+    bool same = tc_rec_attrs_equal(attrs, rec->attrs);
+
+    if (same && symbol < 0x80) {
+        out[0] = (unsigned char)symbol;
+        return 1;
+    }
+
+    unsigned char flags = 0x80;
+    int len = 1;
+    if (!same) {
+        bool defined;
+        int id = tc_rec_style_id(rec, attrs, &defined);
+        if (id < 0) {
+            flags |= Rec_Literal;
+            len += tc_rec_put_attrs(out + len, attrs);
+        }
+        else if (defined) {
+            flags |= Rec_Define;
+            len += tc_rec_put_attrs(out + len, attrs);
+        }
+        else {
+            flags |= Rec_Style;
+            len += tc_rec_put_varint(out + len, (size_t)(id));
+        }
+        rec->attrs = attrs;
+    }
+    if (symbol < 0x80) out[len++] = (unsigned char)symbol;
+    else {
+        flags |= Rec_WideSymbol;
+        out[len++] = (unsigned char)(symbol >> 16);
+        out[len++] = (unsigned char)(symbol >> 8);
+        out[len++] = (unsigned char)symbol;
+    }
+    out[0] = flags;
+    return len;
+}
+
+static inline int tc_rec_same_run(const TcPixel *cells, int i, int count) {
+    int same = 1;
+    while (i + same < count && tc_pixel_equal(cells[i + same], cells[i])) same++;
+    return same;
+}
+
+/*
+ * Appends the runs for count changed cells starting at cell index `start`:
+ * repeats of TC_REC_MIN_REPEAT or more identical cells, literal runs between them.
+ */
+static void tc_rec_encode_span(TermCanvas *canvas, TcRecorder *rec, size_t start,
+                               const TcPixel *cells, int count, uint32_t *runs) {
+    for (int i = 0; i < count; ) {
+        int same = tc_rec_same_run(cells, i, count);
+        int end  = i + same;
+        bool repeat = same >= TC_REC_MIN_REPEAT;
+        if (!repeat) {
+            while (end < count) {
+                int next = tc_rec_same_run(cells, end, count);
+                if (next >= TC_REC_MIN_REPEAT) break;
+                end += next;
+            }
+        }
+
+        int stored = repeat ? 1 : end - i;
+        if (!tc_rec_reserve(canvas, rec, TC_REC_RUN_MAX + TC_REC_CELL_MAX * (size_t)(stored))) return;
+
+        unsigned char *out = (unsigned char *)rec->buffer + rec->len;
+        int len = tc_rec_put_varint(out, start + (size_t)(i) - rec->position);
+        len += tc_rec_put_varint(out + len, (size_t)(end - i) << 1 | (repeat ? 1u : 0u));
+        for (int k = 0; k < stored; k++) len += tc_rec_put_cell(rec, out + len, cells[i + k]);
+        rec->len += (size_t)(len);
+
+        rec->position = start + (size_t)(end);
+        (*runs)++;
+        i = end;
+    }
+}
+
+/*
+ * Records the frame tc_show is about to present.
+ */
+static void tc_record_frame(TermCanvas *canvas) {
+    TcRecorder *rec = canvas->recorder;
+    if (rec->failed) return;
+
+    bool key = rec->since_keyframe == 0;
+    if (rec->width != canvas->width || rec->height != canvas->height) {
+        tc_free(rec->last);
+        rec->last = (TcPixel *)tc_alloc(canvas, sizeof(TcPixel) * (size_t)(canvas->width) * (size_t)(canvas->height));
+        if (!rec->last) {
+            rec->failed = true;
+            return;
+        }
+        rec->width  = canvas->width;
+        rec->height = canvas->height;
+        key = true;
+    }
+
+    rec->len = 0;
+    if (!tc_rec_reserve(canvas, rec, sizeof(TcRecFrame))) return;
+    rec->len = sizeof(TcRecFrame);
+    rec->position = 0;
+    rec->attrs = TC_REC_ATTRS_START;
+    if (key) {
+        rec->style_count = 0;
+        memset(rec->style_index, 0, sizeof(uint16_t) * TC_REC_STYLE_INDEX);
+    }
+
+    uint32_t runs = 0;
+    for (int y = 0; y < canvas->height && !rec->failed; y++) {
+        const TcPixel *row = canvas->pixels[y];
+        TcPixel *last = rec->last + (size_t)(y) * (size_t)(canvas->width);
+
+        for (int x = 0; x < canvas->width; ) {
+            if (!key) {
+                while (x < canvas->width && tc_pixel_equal(row[x], last[x])) x++;
+                if (x == canvas->width) break;
+            }
+            int end = x + 1;
+            if (key) end = canvas->width;
+            else while (end < canvas->width && !tc_pixel_equal(row[end], last[end])) end++;
+
+            size_t start = (size_t)(y) * (size_t)(canvas->width) + (size_t)(x);
+            tc_rec_encode_span(canvas, rec, start, row + x, end - x, &runs);
+            memcpy(last + x, row + x, (size_t)(end - x) * sizeof(TcPixel));
+            x = end;
+        }
+    }
+
+    size_t padded = (rec->len + 7) & ~(size_t)7;
+    if (rec->failed || padded > UINT32_MAX || !tc_rec_reserve(canvas, rec, padded - rec->len)) {
+        rec->failed = true;
+        return;
+    }
+    memset(rec->buffer + rec->len, 0, padded - rec->len);
+    rec->len = padded;
+
+    TcRecFrame frame = {
+        .size    = (uint32_t)padded,
+        .type    = key ? Rec_Keyframe : Rec_Delta,
+        .width   = (uint16_t)canvas->width,
+        .height  = (uint16_t)canvas->height,
+        .runs    = runs,
+        .time_ns = (uint64_t)(tc_now_ns() - rec->start_ns),
+    };
+    memcpy(rec->buffer, &frame, sizeof(frame));
+
+    if (!tc_write_all(rec->fd, rec->buffer, rec->len)) rec->failed = true;
+    rec->since_keyframe = (rec->since_keyframe + 1) % rec->keyframe_interval;
+}
+
+/*
+ * Starts recording every frame tc_show presents to fd (a file, usually).
+ * A keyframe is written every keyframe_interval frames (0 for the default)
+ * and whenever the canvas size changes, so playback can seek.
+ * The fd is not closed by the recorder. Returns false if already recording,
+ * the canvas is too large for the format or the header can't be written.
+ */
+bool tc_record_start(TermCanvas *canvas, int fd, int keyframe_interval) {
+    if (!canvas || canvas->recorder || fd < 0) return false;
+    if (canvas->width > UINT16_MAX || canvas->height > UINT16_MAX) return false;
+
+    TcRecorder *rec = (TcRecorder *)tc_alloc(canvas, sizeof(TcRecorder));
+    if (!rec) return false;
+    *rec = (TcRecorder){0};
+    rec->fd = fd;
+    rec->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : TC_REC_KEYFRAME_INTERVAL;
+    rec->start_ns = tc_now_ns();
+    rec->styles      = (TcRecAttrs *)tc_alloc(canvas, sizeof(TcRecAttrs) * TC_REC_STYLE_MAX);
+    rec->style_index = (uint16_t *)tc_alloc(canvas, sizeof(uint16_t) * TC_REC_STYLE_INDEX);
+
+    TcRecHeader header = {TC_REC_MAGIC, TC_REC_BYTE_ORDER, (uint32_t)rec->keyframe_interval};
+    if (!rec->styles || !rec->style_index || !tc_write_all(fd, (const char *)&header, sizeof(header))) {
+        tc_free(rec->style_index);
+        tc_free(rec->styles);
+        tc_free(rec);
+        return false;
+    }
+
+    canvas->recorder = rec;
+    return true;
+}
+
+/*
+ * Stops recording. Returns false if part of the recording was lost
+ * (a write or an allocation failed along the way).
+ */
+bool tc_record_stop(TermCanvas *canvas) {
+    if (!canvas || !canvas->recorder) return false;
+
+    TcRecorder *rec = canvas->recorder;
+    bool ok = !rec->failed;
+    tc_free(rec->buffer);
+    tc_free(rec->last);
+    tc_free(rec->style_index);
+    tc_free(rec->styles);
+    tc_free(rec);
+    canvas->recorder = NULL;
+    return ok;
+}
+
+/*
+ * Player state: the mapped recording and the offset of every record.
+ */
+struct TcPlayer {
+    const unsigned char *data;
+    size_t  size;
+    size_t *frames;  // Offset of every frame record
+    int     count;
+    int     next;    // Frame tc_player_step applies next
+    TcRecAttrs *styles; // Styles defined since the last keyframe applied
+    int     style_count;
+};
+
+static inline TcRecFrame tc_player_frame(const TcPlayer *player, int index) {
+    TcRecFrame frame;
+    memcpy(&frame, player->data + player->frames[index], sizeof(frame));
+    return frame;
+}
+
+/*
+ * Bounds-checked reading of one record.
+ */
+typedef struct {
+    const unsigned char *data;
+    size_t pos;
+    size_t end;
+    bool   ok;
+} TcRecReader;
+
+static size_t tc_rec_get_varint(TcRecReader *in) {
+    size_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in->pos >= in->end) break;
+        unsigned char byte = in->data[in->pos++];
+        value |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    in->ok = false;
+    return 0;
+}
+
+static inline const unsigned char *tc_rec_get(TcRecReader *in, size_t bytes) {
+    if (bytes > in->end - in->pos) {
+        in->ok = false;
+        return NULL;
+    }
+    const unsigned char *at = in->data + in->pos;
+    in->pos += bytes;
+    return at;
+}
+
+static TcRecAttrs tc_rec_get_attrs(TcRecReader *in) {
+    TcRecAttrs attrs = TC_REC_ATTRS_START;
+    const unsigned char *at = tc_rec_get(in, 9);
+    if (at) {
+        memcpy(&attrs.background, at, 4);
+        memcpy(&attrs.foreground, at + 4, 4);
+        attrs.effect = at[8];
+    }
+    return attrs;
+}
+
+/*
+ * Decodes one cell; attrs holds the attributes of the previous one.
+ */
+static TcPixel tc_rec_get_cell(TcPlayer *player, TcRecReader *in, TcRecAttrs *attrs) {
+    const unsigned char *at = tc_rec_get(in, 1);
+    uint32_t symbol = L' ';
+
+    if (at && *at < 0x80) symbol = *at;
+    else if (at) {
+        unsigned char flags = *at;
+        if (flags & Rec_Style) {
+            size_t id = tc_rec_get_varint(in);
+            if (id < (size_t)(player->style_count)) *attrs = player->styles[id];
+            else in->ok = false;
+        }
+        else if (flags & Rec_Define) {
+            *attrs = tc_rec_get_attrs(in);
+            if (player->style_count < TC_REC_STYLE_MAX) player->styles[player->style_count++] = *attrs;
+        }
+        else if (flags & Rec_Literal) *attrs = tc_rec_get_attrs(in);
+
+        if (!(flags & Rec_WideSymbol)) {
+            if ((at = tc_rec_get(in, 1))) symbol = *at;
+        }
+        else if ((at = tc_rec_get(in, 3))) symbol = (uint32_t)at[0] << 16 | (uint32_t)at[1] << 8 | at[2];
+    }
 
-    canvas->pixels = (TcPixel **)blob;
+    return tc_pixel((Color){attrs->background}, (Color){attrs->foreground}, (wchar_t)symbol, (TcEffect)attrs->effect);
+}
 
-    TcPixel pixel = (TcPixel) {background, foreground, symbol, Effect_None};
-    for (int i = 0; i < height; i++) {
-        canvas->pixels[i] = (TcPixel *)(void *)((char *)blob + sizeof(TcPixel *) * (size_t)(height) + (size_t)(i) * (size_t)(width) * sizeof(TcPixel));
-        for (int j = 0; j < width; j++) {
-            canvas->pixels[i][j] = pixel;
+/*
+ * Maps a recording made by tc_record_start and indexes its frames.
+ * Returns NULL if the file can't be read or is not a recording. A recording
+ * cut short (the recorder was killed) plays up to its last whole frame, and
+ * indexing stops the same way at the first frame with a bad size or geometry.
+ */
+TcPlayer *tc_player_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(TcRecHeader)) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    TcPlayer *player = (TcPlayer *)malloc(sizeof(TcPlayer));
+    if (!player) {
+        munmap(data, (size_t)st.st_size);
+        return NULL;
+    }
+    *player = (TcPlayer){0};
+    player->data = (const unsigned char *)data;
+    player->size = (size_t)st.st_size;
+    player->styles = (TcRecAttrs *)malloc(sizeof(TcRecAttrs) * TC_REC_STYLE_MAX);
+    if (!player->styles) {
+        tc_player_close(player);
+        return NULL;
+    }
+
+    TcRecHeader header;
+    memcpy(&header, player->data, sizeof(header));
+    if (memcmp(header.magic, TC_REC_MAGIC, sizeof(header.magic)) != 0 || header.byte_order != TC_REC_BYTE_ORDER) {
+        tc_player_close(player);
+        return NULL;
+    }
+
+    int capacity = 0;
+    size_t offset = sizeof(TcRecHeader);
+    while (offset + sizeof(TcRecFrame) <= player->size) {
+        TcRecFrame frame;
+        memcpy(&frame, player->data + offset, sizeof(frame));
+        if (frame.size < sizeof(TcRecFrame) || frame.size % 8 != 0 || frame.size > player->size - offset) break;
+        if (frame.width == 0 || frame.height == 0) break; // Run positions are split into rows by width
+
+        if (player->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            size_t *frames = (size_t *)realloc(player->frames, sizeof(size_t) * (size_t)(capacity));
+            if (!frames) break;
+            player->frames = frames;
         }
+        player->frames[player->count++] = offset;
+        offset += frame.size;
     }
-    
-    canvas->buffer_size = ((15) * canvas->width * canvas->height + 8 + canvas->height) / 20;
 
-    #ifdef USE_ARENA
-    canvas->buffer = (wchar_t *)arena_alloc(arena, sizeof(wchar_t) * (size_t)(canvas->buffer_size));
-    #else
-    canvas->buffer = (wchar_t *)malloc(sizeof(wchar_t) * (size_t)(canvas->buffer_size));
-    #endif
+    return player;
+}
 
-    setlocale(LC_ALL, "");
-    tc_hide_cursor();
-    tc_swich_to_buffer();
+/*
+ * Unmaps the recording and frees the player.
+ */
+void tc_player_close(TcPlayer *player) {
+    if (!player) return;
 
-    return canvas;
+    munmap((void *)player->data, player->size);
+    free(player->styles);
+    free(player->frames);
+    free(player);
+}
+
+int tc_player_frame_count(const TcPlayer *player) {
+    return player ? player->count : 0;
 }
 
 /*
- * Shuts down the canvas.
- * Restores from buffer and clears the canvas.
+ * Writes one frame into the canvas (and marks what it touched dirty).
+ * Keyframes of a different size resize the canvas first; if that fails the
+ * frame is clipped. Stops at the first malformed run.
  */
-void tc_destroy(TermCanvas *canvas) {
-    if (!canvas) return;
+static void tc_player_apply(TcPlayer *player, TermCanvas *canvas, int index) {
+    TcRecFrame frame = tc_player_frame(player, index);
+    TcRecReader in = {player->data + player->frames[index], sizeof(TcRecFrame), frame.size, true};
+    TcRecAttrs attrs = TC_REC_ATTRS_START;
 
-    #ifdef USE_ARENA
-    arena_free_block(canvas->buffer);  // free buffer
-    arena_free_block(canvas->pixels);  // free pixels
-    arena_free_block(canvas);
+    if (frame.type == Rec_Keyframe) {
+        player->style_count = 0;
+        if (frame.width != canvas->width || frame.height != canvas->height) tc_resize(canvas, frame.width, frame.height);
+    }
+
+    size_t position = 0;
+    size_t cells = (size_t)(frame.width) * (size_t)(frame.height);
+    for (uint32_t i = 0; i < frame.runs && in.ok; i++) {
+        position += tc_rec_get_varint(&in);
+        size_t word  = tc_rec_get_varint(&in);
+        size_t count = word >> 1;
+        bool repeat  = word & 1;
+        if (!in.ok || position > cells || count > cells - position) break;
+
+        TcPixel px = tc_pixel(COLOR_NONE, COLOR_NONE, L' ', Effect_None);
+        if (repeat) px = tc_rec_get_cell(player, &in, &attrs);
+
+        // Runs never cross a row of the recorded frame
+        int y = (int)(position / frame.width);
+        int x = (int)(position % frame.width);
+        bool visible = y < canvas->height;
+        for (size_t k = 0; k < count && in.ok; k++) {
+            if (!repeat) px = tc_rec_get_cell(player, &in, &attrs);
+            if (visible && x + (int)(k) < canvas->width) canvas->pixels[y][x + (int)(k)] = px;
+        }
+        if (visible && x < canvas->width) {
+            int x1 = x + (int)(count) > canvas->width ? canvas->width : x + (int)(count);
+            tc_dirty_row(canvas, y, x, x1);
+        }
+        position += count;
+    }
+}
+
+/*
+ * Puts the canvas in the state of the given frame, starting from the
+ * keyframe before it. The next tc_player_step continues after it.
+ */
+bool tc_player_seek(TcPlayer *player, TermCanvas *canvas, int frame) {
+    if (!player || !canvas || frame < 0 || frame >= player->count) return false;
+
+    int key = frame;
+    while (key > 0 && tc_player_frame(player, key).type != Rec_Keyframe) key--;
+    for (int i = key; i <= frame; i++) tc_player_apply(player, canvas, i);
+
+    player->next = frame + 1;
+    return true;
+}
+
+/*
+ * Applies the next frame to the canvas. delay_ns (optional) gets how long
+ * after the previous frame it was presented when it was recorded.
+ * Returns false at the end of the recording.
+ */
+bool tc_player_step(TcPlayer *player, TermCanvas *canvas, long long *delay_ns) {
+    if (!player || !canvas || player->next >= player->count) return false;
+
+    int index = player->next++;
+    if (delay_ns) {
+        *delay_ns = index > 0 ? (long long)(tc_player_frame(player, index).time_ns -
+                                            tc_player_frame(player, index - 1).time_ns) : 0;
+    }
+    tc_player_apply(player, canvas, index);
+    return true;
+}
+
+/*
+ * Plays the rest of the recording through tc_show, speed times as fast as
+ * it was recorded (0 for as fast as possible). Returns the frames played.
+ */
+int tc_player_play(TcPlayer *player, TermCanvas *canvas, double speed) {
+    int played = 0;
+    long long delay = 0;
+
+    while (tc_player_step(player, canvas, &delay)) {
+        if (speed > 0.0 && delay > 0) {
+            long long ns = (long long)((double)delay / speed);
+            struct timespec wait = {(time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL)};
+            while (nanosleep(&wait, &wait) == -1 && errno == EINTR) {}
+        }
+        tc_show(canvas);
+        played++;
+    }
+    return played;
+}
+
+
+// -----------------------------------------------------------------------------
+//  Broadcast
+// -----------------------------------------------------------------------------
+#define TC_BROADCAST_MODES 3 // Color_Base, Color_256 and Color_RGB
+
+#define TC_BROADCAST_SETUP   "\033[?25l\033[?1049h"             // Same as tc_create
+#define TC_BROADCAST_RESTORE "\033[0m\033[H\033[J\033[?1049l\033[?25h" // Same as tc_destroy
+#define TC_BROADCAST_CLEAR   "\033[0m\033[H\033[J"              // In front of every keyframe
+
+/*
+ * A viewer. pending holds what its fd did not take of the last thing it
+ * was sent; that has to go out before anything else, or the client would
+ * see half an escape sequence.
+ */
+typedef struct {
+    int     fd;
+    int     fd_flags;    // File status flags before tc_broadcast_add, restored when the client leaves
+    TcTerminalColorMode mode;
+    bool    socket;      // Written with send(MSG_NOSIGNAL); other fds with SIGPIPE blocked
+    bool    keyframe;    // Missed a frame (or just joined), gets a full redraw next
+    bool    failed;      // Write error; dropped by tc_broadcast_present
+    char   *pending;
+    size_t  pending_pos; // Bytes of pending already written
+    size_t  pending_len;
+    size_t  pending_cap;
+} TcBroadcastClient;
+
+/*
+ * Broadcast state. Each encoder is a headless canvas with a memory sink
+ * that holds what every in-sync client of its mode has on screen, so one
+ * tc_show on it produces the delta all of them need.
+ */
+struct TcBroadcast {
+    TermCanvas        *source;
+    TermCanvas        *encoders[TC_BROADCAST_MODES]; // Created when the first client of a mode needs a frame
+    TcBroadcastClient *clients;
+    int                count;
+    int                capacity;
+};
+
+/*
+ * write() to a pipe or tty whose reader went away, without the SIGPIPE
+ * that would kill the process: the signal is blocked for this thread
+ * and, if the write raised it, taken before it is unblocked again. A
+ * SIGPIPE that was already pending is left alone.
+ */
+static ssize_t tc_write_nosignal(int fd, const void *data, size_t len) {
+    sigset_t pipe_set, old_set, pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+
+    #ifdef TC_USE_THREADS
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
     #else
-    free(canvas->buffer);  // free buffer
-    free(canvas->pixels);  // free pixels
-    free(canvas);
+    sigprocmask(SIG_BLOCK, &pipe_set, &old_set);
     #endif
 
-    tc_clear();           // Clear the canvas
-    tc_swich_from_buffer();
-    tc_show_cursor();     // Show the cursor
+    ssize_t n = write(fd, data, len);
+    int error = errno;
+    if (n < 0 && error == EPIPE && !was_pending) {
+        struct timespec now = {0, 0};
+        while (sigtimedwait(&pipe_set, NULL, &now) < 0 && errno == EINTR) {}
+    }
+
+    #ifdef TC_USE_THREADS
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    #else
+    sigprocmask(SIG_SETMASK, &old_set, NULL);
+    #endif
+    errno = error;
+    return n;
 }
 
+/*
+ * Writes to a client without blocking.
+ * Returns the bytes written (possibly 0 when the fd is full), or -1 on error.
+ */
+static ssize_t tc_broadcast_write(TcBroadcastClient *client, const char *data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = client->socket ? send(client->fd, data + done, len - done, MSG_NOSIGNAL)
+                                   : tc_write_nosignal(client->fd, data + done, len - done);
+        if (n > 0) {
+            done += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
 
-static void tc_show_too_small(TermCanvas *canvas) {
-    if (!canvas) return;
+        client->failed = true;
+        return -1;
+    }
+    return (ssize_t)done;
+}
 
-    tc_gotoxy(0, 0);
-    wchar_t buffer[1024];
-    int buf_idx = 0;
+/*
+ * Keeps bytes the fd did not take. Only called with nothing pending,
+ * so a client never holds more than one frame.
+ */
+static bool tc_broadcast_keep(TcBroadcast *broadcast, TcBroadcastClient *client, const char *data, size_t len) {
+    if (len > client->pending_cap) {
+        char *pending = (char *)tc_realloc(broadcast->source, client->pending, len);
+        if (!pending) {
+            client->failed = true;
+            return false;
+        }
+        client->pending     = pending;
+        client->pending_cap = len;
+    }
 
-    char buffer1[6];
-    char buffer2[6];
+    memcpy(client->pending, data, len);
+    client->pending_pos = 0;
+    client->pending_len = len;
+    return true;
+}
 
-    int str1_len = snprintf(buffer1, 6, "%i", canvas->terminal_w);
-    int str2_len = snprintf(buffer2, 6, "%i", canvas->terminal_h);
-    int half_off_str_len = (str1_len + str2_len) / 2;
-    
-    int base_y_offset = canvas->terminal_h / 2;
-    int base_x_offset = canvas->terminal_w / 2 - 1;
+/*
+ * Sends data to a client, keeping whatever does not fit right now.
+ */
+static void tc_broadcast_send(TcBroadcast *broadcast, TcBroadcastClient *client, const char *data, size_t len) {
+    ssize_t written = tc_broadcast_write(client, data, len);
+    if (written >= 0 && (size_t)written < len) {
+        tc_broadcast_keep(broadcast, client, data + written, len - (size_t)written);
+    }
+}
 
-    for (int y = 0; y < canvas->terminal_h; ++y) {
-        if (y == base_y_offset) {
-            for (int x = 0; x < (base_x_offset-half_off_str_len); ++x) {
-                buffer[buf_idx++] = L' '; 
-            }
-            buf_idx += swprintf(buffer + buf_idx, MAX_ANSI_LENGTH, L"\033[0m%s%s%s",
-                get_effect_ansi(Effect_None),
-                get_color_ansi(canvas->terminal_w < canvas->width ? COLOR_RED : COLOR_GREEN, COLOR_BLACK, canvas->mode),
-                &buffer1
-            );
-            buf_idx += swprintf(buffer + buf_idx, 36, L"\033[0m%s%sx",
-                get_effect_ansi(Effect_None),
-                get_color_ansi(COLOR_WHITE, COLOR_BLACK, canvas->mode)
-            );
-            buf_idx += swprintf(buffer + buf_idx, MAX_ANSI_LENGTH, L"\033[0m%s%s%s",
-                get_effect_ansi(Effect_None),
-                get_color_ansi(canvas->terminal_h < canvas->height ? COLOR_RED : COLOR_GREEN, COLOR_BLACK, canvas->mode),
-                &buffer2
-            );
-            buf_idx += swprintf(buffer + buf_idx, 9, L"\033[0m\033[K\n");
+/*
+ * Writes as much of a client's pending bytes as its fd takes.
+ * Returns true once nothing is pending.
+ */
+static bool tc_broadcast_drain(TcBroadcastClient *client) {
+    if (client->pending_pos == client->pending_len) return true;
+
+    ssize_t written = tc_broadcast_write(client, client->pending + client->pending_pos,
+                                         client->pending_len - client->pending_pos);
+    if (written < 0) return false;
+
+    client->pending_pos += (size_t)written;
+    if (client->pending_pos < client->pending_len) return false;
+
+    client->pending_pos = client->pending_len = 0;
+    return true;
+}
+
+static int tc_broadcast_find(const TcBroadcast *broadcast, int fd) {
+    for (int i = 0; i < broadcast->count; i++) {
+        if (broadcast->clients[i].fd == fd) return i;
+    }
+    return -1;
+}
+
+/*
+ * Drops a client. With restore, the terminal gets its normal screen back
+ * if the fd takes it right away. Either way the fd gets its own flags back.
+ */
+static void tc_broadcast_drop(TcBroadcast *broadcast, int index, bool restore) {
+    TcBroadcastClient *client = &broadcast->clients[index];
+    if (restore && !client->failed && tc_broadcast_drain(client)) {
+        tc_broadcast_write(client, TC_BROADCAST_RESTORE, strlen(TC_BROADCAST_RESTORE));
+    }
+
+    fcntl(client->fd, F_SETFL, client->fd_flags);
+    tc_free(client->pending);
+    broadcast->clients[index] = broadcast->clients[--broadcast->count];
+}
+
+/*
+ * Returns the encoder for a mode, matching the source size. A new encoder
+ * has nothing on screen yet, so its first frame is a full redraw; fresh
+ * tells that the clients need a keyframe, since after a resize their
+ * screens still show parts of the old size that the redraw won't cover.
+ */
+static TermCanvas *tc_broadcast_encoder(TcBroadcast *broadcast, TcTerminalColorMode mode, bool *fresh) {
+    TermCanvas *source  = broadcast->source;
+    TermCanvas *encoder = broadcast->encoders[mode];
+
+    if (encoder && (encoder->width != source->width || encoder->height != source->height)) {
+        tc_destroy(encoder);
+        encoder = NULL;
+    }
+
+    *fresh = !encoder;
+    if (!encoder) {
+        TcOptions options = TC_OPTIONS_HEADLESS;
+        options.mode = mode;
+        #ifdef USE_ARENA
+        encoder = tc_create_ex(source->arena, source->width, source->height, L' ', COLOR_WHITE, COLOR_BLACK, &options);
+        #else
+        encoder = tc_create_ex(source->width, source->height, L' ', COLOR_WHITE, COLOR_BLACK, &options);
+        #endif
+    }
+
+    if (encoder) encoder->caps = source->caps;
+    broadcast->encoders[mode] = encoder;
+    return encoder;
+}
+
+/*
+ * Creates a broadcast of the source canvas. The source itself is not
+ * presented by it; tc_show still sends it to its own sink, if wanted.
+ */
+TcBroadcast *tc_broadcast_create(TermCanvas *source) {
+    if (!source) return NULL;
+
+    TcBroadcast *broadcast = (TcBroadcast *)tc_alloc(source, sizeof(TcBroadcast));
+    if (!broadcast) return NULL;
+    *broadcast = (TcBroadcast){0};
+    broadcast->source = source;
+    return broadcast;
+}
+
+/*
+ * Restores every client's terminal (as far as it takes it without blocking)
+ * and frees the broadcast. The fds are not closed.
+ */
+void tc_broadcast_destroy(TcBroadcast *broadcast) {
+    if (!broadcast) return;
+
+    while (broadcast->count > 0) tc_broadcast_drop(broadcast, broadcast->count - 1, true);
+    for (int m = 0; m < TC_BROADCAST_MODES; m++) tc_destroy(broadcast->encoders[m]);
+    tc_free(broadcast->clients);
+    tc_free(broadcast);
+}
+
+/*
+ * Adds a client terminal on fd, which is switched to non-blocking mode
+ * while it is a client (its flags are restored when it is removed or
+ * dropped). Color_Auto can't be detected for a remote terminal and is
+ * rejected. The client gets a full redraw with the next
+ * tc_broadcast_present. Returns false if fd is already a client or can't
+ * be set up.
+ */
+bool tc_broadcast_add(TcBroadcast *broadcast, int fd, TcTerminalColorMode mode) {
+    if (!broadcast || fd < 0 || mode < Color_Base || mode > Color_RGB) return false;
+    if (tc_broadcast_find(broadcast, fd) >= 0) return false;
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) return false;
+
+    if (broadcast->count == broadcast->capacity) {
+        int capacity = broadcast->capacity ? broadcast->capacity * 2 : 8;
+        TcBroadcastClient *clients = (TcBroadcastClient *)tc_realloc(broadcast->source, broadcast->clients,
+                                                                     sizeof(TcBroadcastClient) * (size_t)(capacity));
+        if (!clients) return false;
+        broadcast->clients  = clients;
+        broadcast->capacity = capacity;
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return false;
+
+    struct stat info;
+    TcBroadcastClient *client = &broadcast->clients[broadcast->count++];
+    *client = (TcBroadcastClient){0};
+    client->fd       = fd;
+    client->fd_flags = flags;
+    client->mode     = mode;
+    client->socket   = fstat(fd, &info) == 0 && S_ISSOCK(info.st_mode);
+    client->keyframe = true;
+
+    tc_broadcast_send(broadcast, client, TC_BROADCAST_SETUP, strlen(TC_BROADCAST_SETUP));
+    return true;
+}
+
+/*
+ * Removes a client and restores its terminal if the fd takes it without
+ * blocking. The fd is not closed.
+ */
+void tc_broadcast_remove(TcBroadcast *broadcast, int fd) {
+    if (!broadcast) return;
+
+    int index = tc_broadcast_find(broadcast, fd);
+    if (index >= 0) tc_broadcast_drop(broadcast, index, true);
+}
+
+/*
+ * Whether fd is still a client. tc_broadcast_present drops clients whose
+ * writes fail (the viewer went away), so this tells when to close the fd.
+ */
+bool tc_broadcast_connected(const TcBroadcast *broadcast, int fd) {
+    return broadcast && tc_broadcast_find(broadcast, fd) >= 0;
+}
+
+/*
+ * Sends the source canvas to every client.
+ * Each color mode in use is encoded once: clients that took the whole
+ * previous frame get the delta, the others skip this frame and get a full
+ * redraw (a keyframe) once they have caught up. After the source was
+ * resized every client gets a keyframe. Nothing blocks; call
+ * tc_broadcast_flush when fds become writable to catch up in between.
+ * Returns how many clients were sent this frame.
+ */
+int tc_broadcast_present(TcBroadcast *broadcast) {
+    if (!broadcast) return 0;
+
+    TermCanvas *source = broadcast->source;
+    bool used[TC_BROADCAST_MODES]     = {false};
+    bool delta[TC_BROADCAST_MODES]    = {false};
+    bool keyframe[TC_BROADCAST_MODES] = {false};
+
+    // Only a client with nothing pending can take this frame
+    for (int i = 0; i < broadcast->count; i++) {
+        TcBroadcastClient *client = &broadcast->clients[i];
+        if (!tc_broadcast_drain(client)) {
+            client->keyframe = true;
+            continue;
         }
-        else {
-            buf_idx += swprintf(buffer + buf_idx, 9, L"\033[0m\033[K\n");
+        used[client->mode] = true;
+        if (client->keyframe) keyframe[client->mode] = true;
+        else                  delta[client->mode]    = true;
+    }
+
+    // Encode once per mode: the delta for clients in sync, then a keyframe behind it if any client needs one.
+    // A new encoder (the source was resized) has no delta to give, so every client of its mode gets the keyframe
+    bool        fresh[TC_BROADCAST_MODES]      = {false};
+    const char *output[TC_BROADCAST_MODES]     = {NULL};
+    size_t      delta_len[TC_BROADCAST_MODES]  = {0};
+    size_t      output_len[TC_BROADCAST_MODES] = {0};
+    for (int m = 0; m < TC_BROADCAST_MODES; m++) {
+        if (!used[m]) continue;
+
+        TermCanvas *encoder = tc_broadcast_encoder(broadcast, (TcTerminalColorMode)m, &fresh[m]);
+        if (!encoder) {
+            used[m] = false;
+            continue;
+        }
+        if (fresh[m]) {
+            delta[m]    = false;
+            keyframe[m] = true;
+        }
+
+        tc_sink_memory_clear(encoder);
+        tc_blit(encoder, 0, 0, source, 0, 0, source->height, source->width);
+        if (delta[m]) {
+            tc_show(encoder);
+            tc_sink_memory(encoder, &delta_len[m]);
+        }
+
+        if (keyframe[m]) {
+            tc_sink_write_str(encoder, TC_BROADCAST_CLEAR);
+            tc_invalidate(encoder);
+            tc_show(encoder);
+        }
+        output[m] = tc_sink_memory(encoder, &output_len[m]);
+    }
+
+    int sent = 0;
+    for (int i = 0; i < broadcast->count; i++) {
+        TcBroadcastClient *client = &broadcast->clients[i];
+        if (client->failed || client->pending_len > 0) continue;
+
+        int m = client->mode;
+        if (!used[m]) {
+            client->keyframe = true; // Its encoder could not be created, try again next frame
+            continue;
+        }
+
+        if (client->keyframe || fresh[m]) {
+            tc_broadcast_send(broadcast, client, output[m] + delta_len[m], output_len[m] - delta_len[m]);
         }
+        else tc_broadcast_send(broadcast, client, output[m], delta_len[m]);
+        client->keyframe = false;
+        if (!client->failed) sent++;
     }
 
+    // Viewers that went away
+    for (int i = broadcast->count - 1; i >= 0; i--) {
+        if (broadcast->clients[i].failed) tc_broadcast_drop(broadcast, i, false);
+    }
 
-    buffer[--buf_idx] = L'\0'; 
-    wprintf(L"%ls\033[0m", buffer);
+    return sent;
 }
 
+/*
+ * Writes pending bytes to clients whose fds take them now (from a poll
+ * loop, for instance). Returns how many clients still have bytes pending.
+ */
+int tc_broadcast_flush(TcBroadcast *broadcast) {
+    if (!broadcast) return 0;
 
-void tc_show(TermCanvas *canvas) {
-    if (!canvas) return;
+    int waiting = 0;
+    for (int i = broadcast->count - 1; i >= 0; i--) {
+        TcBroadcastClient *client = &broadcast->clients[i];
+        if (!tc_broadcast_drain(client) && !client->failed) waiting++;
+        if (client->failed) tc_broadcast_drop(broadcast, i, false);
+    }
+    return waiting;
+}
 
-    tc_get_terminal_size(canvas);
-    if (canvas->width > canvas->terminal_w || canvas->height > canvas->terminal_h) {
-        tc_show_too_small(canvas);
-        canvas->enough_space = false;
-        return;
+
+// -----------------------------------------------------------------------------
+//  Raster Surfaces
+// -----------------------------------------------------------------------------
+#define TC_HALF_UPPER 0x2580 // ▀ upper half block
+#define TC_HALF_LOWER 0x2584 // ▄ lower half block
+#define TC_BRAILLE    0x2800 // Blank braille pattern, dots are added as bits
+
+/*
+ * Raster state. Braille dots are a bitmap, one bit per dot and whole
+ * 64-bit words per dot row, so plotting is a single OR and a cell row is
+ * converted a word (32 cells) at a time. Half blocks keep a color per
+ * pixel. Either way the canvas cells are only written by tc_raster_present.
+ */
+struct TcRaster {
+    TermCanvas   *canvas;
+    TcRasterMode  mode;
+    int           y;          // Cell position on the canvas
+    int           x;
+    int           height;     // Size in cells
+    int           width;
+    Color         background; // Cells (or pixels) where nothing is set
+    uint64_t     *bits;       // Braille: rows of words dots
+    int           words;      // Braille: words per dot row
+    Color        *colors;     // Braille: dot color per cell; half blocks: color per pixel
+    TcDirtySpan  *dirty;      // Cells changed since the last tc_raster_present, per cell row
+};
+
+// Braille bits of one cell, indexed by its four dot rows of two bits each (left dot in bit 0)
+static uint8_t tc_braille_lut[256];
+static bool    tc_braille_ready = false;
+
+static void tc_init_braille_lut(void) {
+    if (tc_braille_ready) return;
+
+    // Dots 1-3 and 7 are the left column (top to bottom), 4-6 and 8 the right one
+    static const uint8_t left[4]  = {0x01, 0x02, 0x04, 0x40};
+    static const uint8_t right[4] = {0x08, 0x10, 0x20, 0x80};
+    for (int index = 0; index < 256; index++) {
+        uint8_t dots = 0;
+        for (int row = 0; row < 4; row++) {
+            if (index & (1 << (2 * row)))     dots |= left[row];
+            if (index & (1 << (2 * row + 1))) dots |= right[row];
+        }
+        tc_braille_lut[index] = dots;
     }
-    
-    int buf_idx = 0;
-    
-    if (!canvas->enough_space) {
-        int half = canvas->terminal_h / 2 + 2;
-        for (int y = 0; y < half; ++y) {
-            buf_idx += swprintf(canvas->buffer + buf_idx, MAX_ANSI_LENGTH, L"\033[%d;0H\033[K", y);
+    tc_braille_ready = true;
+}
+
+static inline void tc_raster_damage(TcRaster *raster, int cell_y, int cell_x) {
+    TcDirtySpan *span = &raster->dirty[cell_y];
+    if (cell_x < span->x0)     span->x0 = cell_x;
+    if (cell_x + 1 > span->x1) span->x1 = cell_x + 1;
+}
+
+/*
+ * Creates a raster over a height x width cell rectangle of the canvas.
+ * Braille gives 2 x 4 dots per cell, half blocks 1 x 2 pixels; background
+ * (COLOR_NONE for the terminal default) shows wherever nothing is set.
+ * Parts of the rectangle outside the canvas are simply not presented.
+ */
+TcRaster *tc_raster_create(TermCanvas *canvas, int y, int x, int height, int width, TcRasterMode mode,
+                           Color background) {
+    if (!canvas || height <= 0 || width <= 0) return NULL;
+
+    TcRaster *raster = (TcRaster *)tc_alloc(canvas, sizeof(TcRaster));
+    if (!raster) return NULL;
+    *raster = (TcRaster){0};
+    raster->canvas     = canvas;
+    raster->mode       = mode;
+    raster->y          = y;
+    raster->x          = x;
+    raster->height     = height;
+    raster->width      = width;
+    raster->background = background;
+
+    size_t cells = (size_t)(height) * (size_t)(width);
+    if (mode == Raster_Braille) {
+        tc_init_braille_lut();
+        raster->words  = (2 * width + 63) / 64;
+        raster->bits   = (uint64_t *)tc_alloc(canvas, sizeof(uint64_t) * (size_t)(4 * height) * (size_t)(raster->words));
+        raster->colors = (Color *)tc_alloc(canvas, sizeof(Color) * cells);
+    }
+    else {
+        raster->colors = (Color *)tc_alloc(canvas, sizeof(Color) * 2 * cells);
+    }
+    raster->dirty = (TcDirtySpan *)tc_alloc(canvas, sizeof(TcDirtySpan) * (size_t)(height));
+
+    if ((mode == Raster_Braille && !raster->bits) || !raster->colors || !raster->dirty) {
+        tc_raster_destroy(raster);
+        return NULL;
+    }
+
+    tc_raster_clear(raster);
+    return raster;
+}
+
+/*
+ * Frees the raster. What it presented stays on the canvas.
+ */
+void tc_raster_destroy(TcRaster *raster) {
+    if (!raster) return;
+
+    tc_free(raster->dirty);
+    tc_free(raster->colors);
+    tc_free(raster->bits);
+    tc_free(raster);
+}
+
+/*
+ * Size in raster pixels (dots for braille).
+ */
+int tc_raster_width(const TcRaster *raster) {
+    if (!raster) return 0;
+    return raster->mode == Raster_Braille ? 2 * raster->width : raster->width;
+}
+
+int tc_raster_height(const TcRaster *raster) {
+    if (!raster) return 0;
+    return raster->mode == Raster_Braille ? 4 * raster->height : 2 * raster->height;
+}
+
+/*
+ * Clears every pixel; the whole raster is presented again.
+ */
+void tc_raster_clear(TcRaster *raster) {
+    if (!raster) return;
+
+    size_t cells = (size_t)(raster->height) * (size_t)(raster->width);
+    if (raster->mode == Raster_Braille) {
+        memset(raster->bits, 0, sizeof(uint64_t) * (size_t)(4 * raster->height) * (size_t)(raster->words));
+        for (size_t i = 0; i < cells; i++) raster->colors[i] = COLOR_NONE;
+    }
+    else {
+        for (size_t i = 0; i < 2 * cells; i++) raster->colors[i] = COLOR_NONE;
+    }
+    for (int row = 0; row < raster->height; row++) raster->dirty[row] = (TcDirtySpan){0, raster->width};
+}
+
+/*
+ * Sets one pixel. For half blocks color is the pixel color (COLOR_NONE for
+ * the background). For braille any color sets the dot and becomes the
+ * color of its cell, COLOR_NONE clears the dot.
+ */
+void tc_raster_plot(TcRaster *raster, int py, int px, Color color) {
+    if (!raster || py < 0 || px < 0 || px >= tc_raster_width(raster) || py >= tc_raster_height(raster)) return;
+
+    if (raster->mode == Raster_Braille) {
+        uint64_t *word = &raster->bits[(size_t)(py) * (size_t)(raster->words) + (size_t)(px >> 6)];
+        uint64_t  bit  = 1ull << (px & 63);
+        if (color.color == COLOR_NONE.color) *word &= ~bit;
+        else {
+            *word |= bit;
+            raster->colors[(size_t)(py >> 2) * (size_t)(raster->width) + (size_t)(px >> 1)] = color;
         }
-        canvas->enough_space = true;
+        tc_raster_damage(raster, py >> 2, px >> 1);
     }
+    else {
+        raster->colors[(size_t)(py) * (size_t)(raster->width) + (size_t)(px)] = color;
+        tc_raster_damage(raster, py >> 1, px);
+    }
+}
 
-    // Move cursor to the top-left corner (home position)
-    buf_idx += swprintf(canvas->buffer + buf_idx, MAX_ANSI_LENGTH, L"\033[0;0H");
-
-    // Initialize last colors/effect to a value that won't match any real pixel
-    Color last_bg = COLOR_NONE;
-    Color last_fg = COLOR_NONE;
-    TcEffect last_effect = Effect_None;
-
-    for (int y = 0; y < canvas->height && y < canvas->terminal_h; ++y) {
-        buf_idx += swprintf(canvas->buffer + buf_idx, MAX_ANSI_LENGTH,
-            L"\033[0m%s%s",
-            get_effect_ansi(last_effect),
-            get_color_ansi(last_fg, last_bg, canvas->mode)
-        );
-        
-        for (int x = 0; x < canvas->width; ++x) {
-            TcPixel px = canvas->pixels[y][x];
-
-            // Buffer overflow check
-            if ((int)buf_idx > canvas->buffer_size - MAX_ANSI_LENGTH) {
-                canvas->buffer[buf_idx] = L'\0'; // Null-terminate the string
-                wprintf(L"%ls", canvas->buffer); // Print the buffer
-                buf_idx = 0;                     // Reset the index
-            }
+/*
+ * Plots a line from (y0, x0) to (y1, x1), both ends included.
+ */
+void tc_raster_line(TcRaster *raster, int y0, int x0, int y1, int x1, Color color) {
+    if (!raster) return;
 
-            // Check if colors or effect have changed
-            if (px.background.color != last_bg.color ||
-                px.foreground.color != last_fg.color ||
-                px.effect != last_effect) {
-
-                // Combine reset, effect, and color setting into one escape sequence
-                buf_idx += swprintf(canvas->buffer + buf_idx, MAX_ANSI_LENGTH,
-                                    L"\033[0m%s%s", // Reset and then set new attributes
-                                    get_effect_ansi(px.effect),
-                                    get_color_ansi(px.foreground, px.background, canvas->mode)
-                );
-                // Update last known colors/effect
-                last_bg = px.background;
-                last_fg = px.foreground;
-                last_effect = px.effect;
-            }
+    int dx = x1 > x0 ? x1 - x0 : x0 - x1;
+    int dy = y1 > y0 ? y0 - y1 : y1 - y0;
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int error = dx + dy;
+
+    for (;;) {
+        tc_raster_plot(raster, y0, x0, color);
+        if (x0 == x1 && y0 == y1) break;
+
+        int twice = 2 * error;
+        if (twice >= dy) {
+            error += dy;
+            x0 += sx;
+        }
+        if (twice <= dx) {
+            error += dx;
+            y0 += sy;
+        }
+    }
+}
 
-            // Add the character to the buffer
-            canvas->buffer[buf_idx++] = px.symbol;
+/*
+ * Converts cells [x0, x1) of braille cell row cy into out (cell x0 first).
+ */
+static void tc_raster_braille_row(const TcRaster *raster, int cy, int x0, int x1, TcPixel *out) {
+    const uint64_t *rows[4];
+    for (int r = 0; r < 4; r++) rows[r] = raster->bits + (size_t)(4 * cy + r) * (size_t)(raster->words);
+    const Color *colors = raster->colors + (size_t)(cy) * (size_t)(raster->width);
+
+    for (int cx = x0; cx < x1; ) {
+        // A word holds the dots of 32 cells; take what is left of it in one go
+        int word  = (2 * cx) >> 6;
+        int shift = (2 * cx) & 63;
+        int count = (64 - shift) / 2;
+        if (count > x1 - cx) count = x1 - cx;
+
+        uint64_t w0 = rows[0][word] >> shift;
+        uint64_t w1 = rows[1][word] >> shift;
+        uint64_t w2 = rows[2][word] >> shift;
+        uint64_t w3 = rows[3][word] >> shift;
+        for (int i = 0; i < count; i++, cx++) {
+            unsigned index = (unsigned)((w0 & 3) | (w1 & 3) << 2 | (w2 & 3) << 4 | (w3 & 3) << 6);
+            w0 >>= 2;
+            w1 >>= 2;
+            w2 >>= 2;
+            w3 >>= 2;
+
+            if (index == 0) *out++ = tc_pixel(raster->background, COLOR_NONE, L' ', Effect_None);
+            else *out++ = tc_pixel(raster->background, colors[cx], (wchar_t)(TC_BRAILLE + tc_braille_lut[index]), Effect_None);
         }
-        // canvas->buffer[buf_idx++] = L'\n'; // Add a newline at the end of each row
-        buf_idx += swprintf(canvas->buffer + buf_idx, 9, L"\033[0m\033[K\n");
     }
-    canvas->buffer[--buf_idx] = L'\0';      // Null-terminate the string
-    wprintf(L"%ls\033[0m", canvas->buffer); // Print the entire buffer and reset
 }
 
+/*
+ * Converts cells [x0, x1) of half block cell row cy into out (cell x0 first).
+ */
+static void tc_raster_half_row(const TcRaster *raster, int cy, int x0, int x1, TcPixel *out) {
+    const Color *upper = raster->colors + (size_t)(2 * cy) * (size_t)(raster->width);
+    const Color *lower = upper + raster->width;
+    uint32_t none = COLOR_NONE.color;
+
+    for (int cx = x0; cx < x1; cx++) {
+        Color top    = upper[cx].color == none ? raster->background : upper[cx];
+        Color bottom = lower[cx].color == none ? raster->background : lower[cx];
+
+        // The default color can only be a background, so the half that has it is drawn by the other one
+        if (top.color == bottom.color)  *out++ = tc_pixel(top, COLOR_NONE, L' ', Effect_None);
+        else if (top.color == none)     *out++ = tc_pixel(top, bottom, (wchar_t)TC_HALF_LOWER, Effect_None);
+        else                            *out++ = tc_pixel(bottom, top, (wchar_t)TC_HALF_UPPER, Effect_None);
+    }
+}
+
+/*
+ * Writes the cells changed since the last call to the canvas, a cell row
+ * span at a time, and marks them dirty; tc_show then sends whatever
+ * differs from the terminal.
+ */
+void tc_raster_present(TcRaster *raster) {
+    if (!raster) return;
+    TermCanvas *canvas = raster->canvas;
 
+    for (int cy = 0; cy < raster->height; cy++) {
+        TcDirtySpan span = raster->dirty[cy];
+        raster->dirty[cy] = (TcDirtySpan){raster->width, 0};
 
+        // Clip the span against the canvas
+        int row = raster->y + cy;
+        if (span.x0 >= span.x1 || row < 0 || row >= canvas->height) continue;
+        if (raster->x + span.x0 < 0)             span.x0 = -raster->x;
+        if (raster->x + span.x1 > canvas->width) span.x1 = canvas->width - raster->x;
+        if (span.x0 >= span.x1) continue;
 
+        TcPixel *out = canvas->pixels[row] + raster->x + span.x0;
+        if (raster->mode == Raster_Braille) tc_raster_braille_row(raster, cy, span.x0, span.x1, out);
+        else                                tc_raster_half_row(raster, cy, span.x0, span.x1, out);
+        tc_dirty_row(canvas, row, raster->x + span.x0, raster->x + span.x1);
+    }
+}
 
 
 #endif // TERMCANVAS_IMPLEMENTATION
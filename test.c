@@ -0,0 +1,2445 @@
+/*
+ * TermCanvas tests
+ * Headless checks of the parts that are easy to get subtly wrong:
+ *   palette   the 256/16 color lookup tables give the same index as the
+ *             direct computations, for every RGB color
+ *   resize    the SIGWINCH handler chains to the one it replaced (plain and
+ *             SA_SIGINFO) and a watched size is only read again when notified
+ *   terminfo  max_colors is read from hand-built compiled entries in both
+ *             number formats and both directory layouts, and missing,
+ *             cancelled or cut short ones give -1
+ *   sinks     memory, callback and fd sinks get the same bytes, every frame
+ *             in a single write, and a new sink starts with a full redraw
+ *   sgr       a minimal SGR transition leaves a terminal in the same state
+ *             as the full reset-then-set sequence, and is never longer
+ *   terminal  the stream tc_show emits, replayed through a small VT model,
+ *             gives the same screen as a plain full redraw (and the canvas
+ *             text), for every Cap_* flag, color mode and with dirty
+ *             tracking on and off, with scrolled bands in between
+ *   pacing    Cap_Sync frames are wrapped in the synchronized update markers
+ *             (empty ones stay empty), Pacing_Skip keeps skipped changes for
+ *             the next frame and Pacing_Sleep keeps the frame rate
+ *   stats     the counters agree with what reached the sink, the overlay
+ *             shows the previous frame's stats and goes away without a trace
+ *   compositor every update matches a naive recomposite of all layers,
+ *             across moves, z changes, hiding, layer and target resizes
+ *   kernels   tc_blend_area, tc_darken_area and tc_gradient_area give the
+ *             color.h results bit for bit on every cell, clipped rectangles
+ *             included (make test runs them with and without SIMD)
+ *   styles    interned styles and cached transitions are the sequences the
+ *             encoder would build, also across collisions, a full table and
+ *             a color mode change
+ *   headless  no bytes on create and destroy, the "terminal" follows the
+ *             canvas size, and tc_dump_text / tc_dump_cells give the canvas
+ *   recorder  frames recorded by tc_show come back identical through the
+ *             player (seek and step), and malformed files are refused or
+ *             cut short instead of crashing
+ *   broadcast every viewer shows what a full redraw in its color mode
+ *             would, also one that joins late, one that stalls and catches
+ *             up and all of them after the source shrinks; closed viewers
+ *             (pipes too, without SIGPIPE) are dropped and removed ones
+ *             restored, fd flags included
+ *   scroll    tc_scroll moves the rows of clipped bands as a copy would and
+ *             Cap_Scroll sends a scrolled screen as the new line only
+ *   clusters  glyph widths, interning of combining clusters and how
+ *             tc_draw_text and tc_dump_text lay out wide glyphs and marks
+ *   overflow  the too-small notice is written once per size and nothing in
+ *             between; cropped frames show the part that fits, as a full
+ *             redraw of it would, through terminal resizes
+ *   rasters   braille and half-block rasters present the cells a plain
+ *             per-pixel model gives, clipped to the canvas and only where
+ *             plots changed them; lines are gapless and hit both ends
+ *
+ * Usage: test [-v] [-j threads]
+ *   -v  print every case, not only failures
+ *   -j  encode in row bands on that many threads (tc_set_encode_threads,
+ *       needs -DTC_USE_THREADS -pthread)
+ */
+#define TERMCANVAS_IMPLEMENTATION
+#include "termcanvas.h"
+
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+static bool test_verbose  = false;
+static int  test_threads  = 0; // -j: band encoding threads
+static int  test_failures = 0;
+
+#define TEST_COUNT(arr) ((int)(sizeof(arr) / sizeof((arr)[0])))
+
+/*
+ * Records a failure (and keeps going, so one run shows everything broken).
+ */
+#define TEST_CHECK(cond, ...)                                 \
+    do {                                                      \
+        if (!(cond)) {                                        \
+            test_failures++;                                  \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);       \
+            printf(__VA_ARGS__);                              \
+            printf("\n");                                     \
+        }                                                     \
+    } while (0)
+
+/*
+ * Small deterministic PRNG (xorshift32), so failures are reproducible.
+ */
+static uint32_t test_rng = 0x2545F491u;
+static inline uint32_t test_rand(void) {
+    test_rng ^= test_rng << 13;
+    test_rng ^= test_rng >> 17;
+    test_rng ^= test_rng << 5;
+    return test_rng;
+}
+
+static inline int test_range(int n) {
+    return (int)(test_rand() % (uint32_t)(n));
+}
+
+static const Color test_colors[] = {
+    COLOR_NONE, COLOR_BLACK, COLOR_RED, COLOR_GREEN,
+    COLOR_BLUE, COLOR_YELLOW, COLOR_WHITE, COLOR_ORANGE,
+};
+
+static const TcEffect test_effects[] = {
+    Effect_None, Effect_None, Effect_Bold, Effect_Underline, Effect_Reverse,
+};
+
+static inline Color test_color(void) {
+    return test_colors[test_range(TEST_COUNT(test_colors))];
+}
+
+static inline TcEffect test_effect(void) {
+    return test_effects[test_range(TEST_COUNT(test_effects))];
+}
+
+static inline TcPixel test_cell(const wchar_t *symbols, int count) {
+    return tc_pixel(test_color(), test_color(), symbols[test_range(count)], test_effect());
+}
+
+/*
+ * A headless canvas presenting into the given sink.
+ */
+static TermCanvas *test_canvas_ex(int width, int height, TcTerminalColorMode mode, TcSink sink) {
+    TcOptions options = TC_OPTIONS_HEADLESS;
+    options.mode = mode;
+    options.sink = sink;
+    return tc_create_ex(width, height, L' ', COLOR_WHITE, COLOR_BLACK, &options);
+}
+
+static TermCanvas *test_canvas(int width, int height, TcTerminalColorMode mode) {
+    return test_canvas_ex(width, height, mode, TC_SINK_MEMORY);
+}
+
+/*
+ * Random drawing: single cells, uniform runs (REP/ECH material), text with
+ * wide glyphs (which also leaves orphaned halves behind) and, if allowed,
+ * combining clusters.
+ */
+static void test_scribble(TermCanvas *canvas, bool clusters) {
+    static const wchar_t symbols[] = {L' ', L' ', L'a', L'b', L'#', L'.', 0x4E2D, 0x2588, 0x28FF};
+    static const wchar_t *texts[]  = {L"hello", L"\x4E2D\x6587 ok", L"  ", L"\x2580\x2584\x2580"};
+
+    int cells = 1 + test_range(canvas->width * canvas->height / 8);
+    for (int i = 0; i < cells; i++) {
+        tc_set_pixel(canvas, test_range(canvas->height), test_range(canvas->width),
+                     test_cell(symbols, TEST_COUNT(symbols)));
+    }
+
+    for (int i = test_range(3); i > 0; i--) {
+        TcPixel px = test_cell(symbols, 3);
+        tc_fill_area(canvas, test_range(canvas->height), test_range(canvas->width), 1 + test_range(2),
+                     1 + test_range(canvas->width), (wchar_t)px.symbol, px.foreground, px.background,
+                     (TcEffect)px.effect);
+    }
+
+    for (int i = test_range(3); i > 0; i--) {
+        tc_draw_text(canvas, test_range(canvas->height), test_range(canvas->width) - 2,
+                     texts[test_range(TEST_COUNT(texts))], test_color(), test_color(), test_effect());
+    }
+
+    if (clusters && test_range(2)) {
+        static const wchar_t acute[] = {0x0301};
+        static const wchar_t marks[] = {0x0323, 0x0302};
+        wchar_t text[4] = {tc_cluster(L'e', acute, 1), tc_cluster(L'a', marks, 2), 0x0301, 0};
+        tc_draw_text(canvas, test_range(canvas->height), test_range(canvas->width), text,
+                     test_color(), test_color(), test_effect());
+    }
+}
+
+static bool test_same_cells(const TcPixel *a, const TcPixel *b, size_t count) {
+    return memcmp(a, b, sizeof(TcPixel) * count) == 0;
+}
+
+
+// -----------------------------------------------------------------------------
+//  Palette
+// -----------------------------------------------------------------------------
+/*
+ * The 256-color mapping as it was computed before the lookup tables:
+ * a grayscale ramp entry close to all three channels, else the color cube.
+ */
+static int test_256_index(Color color) {
+    int r = get_red(color);
+    int g = get_green(color);
+    int b = get_blue(color);
+
+    float gray_step = 255.0f / 24.0f;
+    for (int i = 0; i < 24; i++) {
+        int gray = 8 + i * 10;
+        if (fabsf((float)(r - gray)) <= gray_step && fabsf((float)(g - gray)) <= gray_step &&
+            fabsf((float)(b - gray)) <= gray_step) {
+            return 232 + i;
+        }
+    }
+
+    int r_6 = (int)lroundf((float)r / 255.0f * 5.0f);
+    int g_6 = (int)lroundf((float)g / 255.0f * 5.0f);
+    int b_6 = (int)lroundf((float)b / 255.0f * 5.0f);
+    return 16 + 36 * r_6 + 6 * g_6 + b_6;
+}
+
+static void test_palette(void) {
+    tc_init_color_luts(Color_Base);
+
+    int wrong_256 = 0, wrong_base = 0;
+    for (uint32_t rgb = 0; rgb < (1u << 24); rgb++) {
+        Color color = (Color){rgb};
+        if (rgb_to_256_index(color) != test_256_index(color)) wrong_256++;
+        if (tc_color_to_base(color) != rgb_to_base_index(color)) wrong_base++;
+    }
+    TEST_CHECK(wrong_256 == 0, "palette: %d colors map to another 256-color index", wrong_256);
+    TEST_CHECK(wrong_base == 0, "palette: %d colors map to another 16-color index", wrong_base);
+    if (test_verbose) printf("palette: %u colors\n", 1u << 24);
+}
+
+
+// -----------------------------------------------------------------------------
+//  Resize Watching
+// -----------------------------------------------------------------------------
+static volatile sig_atomic_t test_winch_calls = 0;
+static volatile sig_atomic_t test_winch_signo = 0;
+
+static void test_winch_handler(int sig) {
+    test_winch_calls++;
+    test_winch_signo = sig;
+}
+
+static void test_winch_action(int sig, siginfo_t *info, void *context) {
+    (void)context;
+    test_winch_calls++;
+    test_winch_signo = info && info->si_signo == sig ? sig : -1;
+}
+
+/*
+ * Installs an application SIGWINCH handler, then tc_watch_resize on top of
+ * it, and raises the signal. Runs in a child process, since tc_watch_resize
+ * installs its handler once per process. Returns true if both handlers saw
+ * the signal exactly once.
+ */
+static bool test_resize_chain(bool siginfo) {
+    pid_t pid = fork();
+    if (pid < 0) return false;
+
+    if (pid == 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        if (siginfo) {
+            sa.sa_sigaction = test_winch_action;
+            sa.sa_flags     = SA_SIGINFO;
+        }
+        else sa.sa_handler = test_winch_handler;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGWINCH, &sa, NULL) != 0 || !tc_watch_resize(true)) _exit(2);
+
+        int serial = tc_resize_serial;
+        raise(SIGWINCH);
+        _exit(test_winch_calls == 1 && test_winch_signo == SIGWINCH && tc_resize_serial == serial + 1 ? 0 : 1);
+    }
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void test_resize(void) {
+    TEST_CHECK(test_resize_chain(false), "resize: plain SIGWINCH handler not chained");
+    TEST_CHECK(test_resize_chain(true), "resize: SA_SIGINFO SIGWINCH handler not chained");
+
+    // Once watched, the cached size stays until a notification comes in
+    TermCanvas canvas;
+    memset(&canvas, 0, sizeof(canvas));
+    TEST_CHECK(tc_watch_resize(false), "resize: tc_watch_resize failed");
+    tc_poll_terminal_size(&canvas);
+    TEST_CHECK(canvas.size_valid, "resize: size not read on the first poll");
+
+    canvas.size_w = -1; // Whatever a read gives, it isn't this
+    TEST_CHECK(!tc_poll_terminal_size(&canvas) && canvas.size_w == -1, "resize: size read again without a notification");
+    tc_notify_resize();
+    tc_poll_terminal_size(&canvas);
+    TEST_CHECK(canvas.size_w != -1, "resize: size not read again after tc_notify_resize");
+    if (test_verbose) printf("resize: ok\n");
+}
+
+
+// -----------------------------------------------------------------------------
+//  Terminfo
+// -----------------------------------------------------------------------------
+typedef struct {
+    const char *name;
+    bool        hex_dir;  // <dir>/<hex of the first letter>/<name> (macOS layout)
+    bool        extended; // 32-bit numbers
+    int         bools;    // Boolean count (decides whether the numbers need an alignment byte)
+    int         numbers;  // Number count (max_colors is number 13)
+    long        colors;   // max_colors (-1: absent, -2: cancelled)
+    int         cut;      // Bytes missing at the end of the file
+    int         expected; // What tc_terminfo_colors has to give
+} TestTerminfo;
+
+static const TestTerminfo test_terminfo_entries[] = {
+    {"tc-test-16",        false, false, 3, 15, 256,       0, 256},
+    {"tc-test-16-even",   false, false, 5, 14, 88,        0, 88},
+    {"tc-test-32",        false, true,  3, 15, 1L << 24,  0, 1 << 24},
+    {"tc-test-32-even",   false, true,  1, 40, 256,       0, 256},
+    {"tc-test-hex",       true,  false, 3, 15, 16,        0, 16},
+    {"tc-test-absent",    false, false, 3, 15, -1,        0, -1},
+    {"tc-test-cancelled", false, false, 3, 15, -2,        0, -1},
+    {"tc-test-32-absent", false, true,  3, 15, -1,        0, -1},
+    {"tc-test-few",       false, false, 3, 13, 256,       0, -1},
+    {"tc-test-cut",       false, false, 3, 15, 256,       5, -1},
+};
+
+/*
+ * Writes a compiled terminfo entry (header, names, booleans, numbers, no
+ * strings) below dir. Returns false if it can't be written.
+ */
+static bool test_terminfo_write(const char *dir, const TestTerminfo *entry, char *path, size_t size) {
+    unsigned char data[512];
+    int num_size = entry->extended ? 4 : 2;
+    char names[64];
+    snprintf(names, sizeof(names), "%s|termcanvas test entry", entry->name);
+
+    int names_size = (int)strlen(names) + 1;
+    int header[6]  = {entry->extended ? 01036 : 0432, names_size, entry->bools, entry->numbers, 0, 0};
+    int len = 0;
+    for (int i = 0; i < 6; i++) {
+        data[len++] = (unsigned char)(header[i] & 0xFF);
+        data[len++] = (unsigned char)(header[i] >> 8);
+    }
+    memcpy(data + len, names, (size_t)(names_size));
+    len += names_size;
+    for (int i = 0; i < entry->bools; i++) data[len++] = 1;
+    if (len & 1) data[len++] = 0;
+    for (int i = 0; i < entry->numbers; i++) {
+        uint32_t value = i == 13 ? (uint32_t)entry->colors : (uint32_t)(i + 1);
+        for (int b = 0; b < num_size; b++) data[len++] = (unsigned char)(value >> (8 * b));
+    }
+    len -= entry->cut;
+
+    if (entry->hex_dir) snprintf(path, size, "%s/%02x", dir, (unsigned char)entry->name[0]);
+    else snprintf(path, size, "%s/%c", dir, entry->name[0]);
+    mkdir(path, 0700);
+    size_t at = strlen(path);
+    snprintf(path + at, size - at, "/%s", entry->name);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    bool ok = fwrite(data, 1, (size_t)(len), fp) == (size_t)(len);
+    return fclose(fp) == 0 && ok;
+}
+
+static int test_terminfo_colors(const char *term) {
+    if (term) setenv("TERM", term, 1);
+    else unsetenv("TERM");
+    return tc_terminfo_colors();
+}
+
+static void test_terminfo(void) {
+    char dir[] = "/tmp/termcanvas-terminfo-XXXXXX";
+    char empty[] = "/tmp/termcanvas-terminfo-XXXXXX";
+    TEST_CHECK(mkdtemp(dir) && mkdtemp(empty), "terminfo: no temporary directory");
+
+    // The environment is put back afterwards
+    const char *names[] = {"TERM", "TERMINFO", "TERMINFO_DIRS"};
+    char *saved[3];
+    for (int i = 0; i < 3; i++) {
+        const char *value = getenv(names[i]);
+        saved[i] = value ? strdup(value) : NULL;
+    }
+
+    char paths[TEST_COUNT(test_terminfo_entries)][256];
+    for (int i = 0; i < TEST_COUNT(test_terminfo_entries); i++) {
+        TEST_CHECK(test_terminfo_write(dir, &test_terminfo_entries[i], paths[i], sizeof(paths[i])),
+                   "terminfo: can't write %s", test_terminfo_entries[i].name);
+    }
+
+    setenv("TERMINFO", dir, 1);
+    unsetenv("TERMINFO_DIRS");
+    for (int i = 0; i < TEST_COUNT(test_terminfo_entries); i++) {
+        const TestTerminfo *entry = &test_terminfo_entries[i];
+        int colors = test_terminfo_colors(entry->name);
+        TEST_CHECK(colors == entry->expected, "terminfo %s: %d colors, expected %d", entry->name, colors,
+                   entry->expected);
+    }
+    TEST_CHECK(test_terminfo_colors("tc-test-missing") == -1, "terminfo: missing entry gave colors");
+    TEST_CHECK(test_terminfo_colors("../t/tc-test-16") == -1, "terminfo: TERM with a path accepted");
+    TEST_CHECK(test_terminfo_colors(NULL) == -1, "terminfo: unset TERM gave colors");
+
+    // Not in $TERMINFO, found further down the search path
+    setenv("TERMINFO", empty, 1);
+    char dirs[128];
+    snprintf(dirs, sizeof(dirs), "/nonexistent:%s", dir);
+    setenv("TERMINFO_DIRS", dirs, 1);
+    TEST_CHECK(test_terminfo_colors("tc-test-16") == 256, "terminfo: entry in $TERMINFO_DIRS not found");
+
+    for (int i = 0; i < 3; i++) {
+        if (saved[i]) setenv(names[i], saved[i], 1);
+        else unsetenv(names[i]);
+        free(saved[i]);
+    }
+    for (int i = 0; i < TEST_COUNT(test_terminfo_entries); i++) {
+        unlink(paths[i]);
+        *strrchr(paths[i], '/') = '\0';
+        rmdir(paths[i]);
+    }
+    rmdir(dir);
+    rmdir(empty);
+    if (test_verbose) printf("terminfo: %d entries\n", TEST_COUNT(test_terminfo_entries));
+}
+
+
+// -----------------------------------------------------------------------------
+//  Sinks
+// -----------------------------------------------------------------------------
+typedef struct {
+    char  *data;
+    size_t len;
+    int    calls;
+} TestCapture;
+
+static void test_capture_append(TestCapture *capture, const void *data, size_t len) {
+    capture->data = (char *)realloc(capture->data, capture->len + len);
+    memcpy(capture->data + capture->len, data, len);
+    capture->len += len;
+}
+
+static void test_capture_write(const struct iovec *iov, int count, void *user_data) {
+    TestCapture *capture = (TestCapture *)user_data;
+    capture->calls++;
+    for (int i = 0; i < count; i++) test_capture_append(capture, iov[i].iov_base, iov[i].iov_len);
+}
+
+static void test_capture_fd(TestCapture *capture, int fd) {
+    char data[4096];
+    ssize_t n;
+    while ((n = read(fd, data, sizeof(data))) > 0) test_capture_append(capture, data, (size_t)(n));
+}
+
+static void test_sinks(void) {
+    static const wchar_t symbols[] = {L' ', L'a', L'#', 0x2588};
+    int width = 40, height = 12, frames = 12;
+
+    int fds[2];
+    TEST_CHECK(pipe(fds) == 0, "sinks: no pipe");
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    TestCapture callback = {0}, piped = {0};
+    TermCanvas *canvases[3] = {
+        test_canvas_ex(width, height, Color_RGB, TC_SINK_MEMORY),
+        test_canvas_ex(width, height, Color_RGB, (TcSink){Sink_Callback, -1, test_capture_write, &callback}),
+        test_canvas_ex(width, height, Color_RGB, (TcSink){Sink_Fd, fds[1], NULL, NULL}),
+    };
+
+    for (int f = 0; f < frames; f++) {
+        // The same cells on every canvas; frame 5 changes every cell's attributes
+        int cells = f == 5 ? width * height : test_range(width * height / 4);
+        for (int i = 0; i < cells; i++) {
+            int y = f == 5 ? i / width : test_range(height);
+            int x = f == 5 ? i % width : test_range(width);
+            TcPixel px = test_cell(symbols, TEST_COUNT(symbols));
+            if (f == 5) px.foreground = (Color){(uint32_t)(i) * 2654435761u & 0xFFFFFF};
+            for (int c = 0; c < 3; c++) canvases[c]->pixels[y][x] = px;
+        }
+
+        int calls = callback.calls;
+        size_t len = callback.len;
+        for (int c = 0; c < 3; c++) tc_show(canvases[c]);
+        test_capture_fd(&piped, fds[0]);
+        TEST_CHECK(callback.calls - calls == (callback.len > len ? 1 : 0), "sinks: frame %d took %d callbacks", f,
+                   callback.calls - calls);
+    }
+
+    size_t len = 0;
+    const char *memory = tc_sink_memory(canvases[0], &len);
+    TEST_CHECK(len > 0 && callback.len == len && memcmp(callback.data, memory, len) == 0,
+               "sinks: callback sink got other bytes than the memory sink");
+    TEST_CHECK(len > 0 && piped.len == len && memcmp(piped.data, memory, len) == 0,
+               "sinks: fd sink got other bytes than the memory sink");
+
+    // A new sink has to get the whole picture
+    TEST_CHECK(tc_set_sink(canvases[0], TC_SINK_MEMORY), "sinks: tc_set_sink failed");
+    tc_sink_memory_clear(canvases[0]);
+    tc_show(canvases[0]);
+    const TcStats *stats = tc_get_stats(canvases[0]);
+    TEST_CHECK(stats->full_redraw && stats->cells_emitted == width * height,
+               "sinks: %d cells sent after tc_set_sink", stats->cells_emitted);
+
+    for (int c = 0; c < 3; c++) tc_destroy(canvases[c]);
+    close(fds[0]);
+    close(fds[1]);
+    free(callback.data);
+    free(piped.data);
+    if (test_verbose) printf("sinks: %d frames\n", frames);
+}
+
+
+// -----------------------------------------------------------------------------
+//  SGR
+// -----------------------------------------------------------------------------
+/*
+ * Text attributes, as a terminal keeps them.
+ */
+typedef struct {
+    uint32_t fg;    // 0: default, otherwise kind << 24 | value
+    uint32_t bg;
+    uint32_t flags; // Bit n: SGR n is on
+} TestAttrs;
+
+/*
+ * Applies SGR parameters the way xterm does.
+ * Returns the number of parameters it doesn't know.
+ */
+static int test_sgr_apply(TestAttrs *attrs, const int *p, int count) {
+    if (count == 0) {
+        *attrs = (TestAttrs){0};
+        return 0;
+    }
+
+    int unknown = 0;
+    for (int i = 0; i < count; i++) {
+        int v = p[i];
+        if (v == 0) *attrs = (TestAttrs){0};
+        else if (v >= 1 && v <= 9) attrs->flags |= 1u << v;
+        else if (v == 22) attrs->flags &= ~(1u << 1 | 1u << 2);
+        else if (v >= 23 && v <= 29 && v != 26) attrs->flags &= ~(1u << (v - 20));
+        else if ((v >= 30 && v <= 37) || (v >= 90 && v <= 97)) attrs->fg = 1u << 24 | (uint32_t)(v);
+        else if ((v >= 40 && v <= 47) || (v >= 100 && v <= 107)) attrs->bg = 1u << 24 | (uint32_t)(v - 10);
+        else if (v == 39) attrs->fg = 0;
+        else if (v == 49) attrs->bg = 0;
+        else if ((v == 38 || v == 48) && i + 2 < count && p[i + 1] == 5) {
+            uint32_t color = 2u << 24 | (uint32_t)(p[i + 2]);
+            if (v == 38) attrs->fg = color;
+            else attrs->bg = color;
+            i += 2;
+        }
+        else if ((v == 38 || v == 48) && i + 4 < count && p[i + 1] == 2) {
+            uint32_t color = 3u << 24 | (uint32_t)(p[i + 2] << 16 | p[i + 3] << 8 | p[i + 4]);
+            if (v == 38) attrs->fg = color;
+            else attrs->bg = color;
+            i += 4;
+        }
+        else unknown++;
+    }
+    return unknown;
+}
+
+/*
+ * Applies a string of SGR sequences. Returns the number of parameters or
+ * bytes that aren't part of a known SGR sequence.
+ */
+static int test_sgr_feed(TestAttrs *attrs, const char *data, int len) {
+    int unknown = 0;
+    int i = 0;
+    while (i < len) {
+        if (i + 1 >= len || data[i] != '\033' || data[i + 1] != '[') {
+            unknown++;
+            i++;
+            continue;
+        }
+        i += 2;
+
+        int p[16], count = 0, value = -1;
+        while (i < len && ((data[i] >= '0' && data[i] <= '9') || data[i] == ';')) {
+            if (data[i] == ';') {
+                if (count < 16) p[count++] = value < 0 ? 0 : value;
+                value = -1;
+            }
+            else value = (value < 0 ? 0 : value * 10) + (data[i] - '0');
+            i++;
+        }
+        if (value >= 0 || count > 0) {
+            if (count < 16) p[count++] = value < 0 ? 0 : value;
+        }
+        if (i >= len || data[i++] != 'm') {
+            unknown++;
+            continue;
+        }
+        unknown += test_sgr_apply(attrs, p, count);
+    }
+    return unknown;
+}
+
+static const struct {
+    const char *name;
+    TcTerminalColorMode mode;
+} test_modes[] = {
+    {"rgb",  Color_RGB},
+    {"256",  Color_256},
+    {"base", Color_Base},
+};
+
+static void test_sgr(void) {
+    static const TcEffect effects[] = {
+        Effect_None, Effect_Bold, Effect_Italic, Effect_Underline, Effect_Blink, Effect_Reverse, Effect_Conceal,
+    };
+    int pairs = 4000;
+
+    for (int m = 0; m < TEST_COUNT(test_modes); m++) {
+        TcTerminalColorMode mode = test_modes[m].mode;
+        tc_init_color_luts(mode);
+
+        int failures = test_failures;
+        for (int i = 0; i < pairs && failures == test_failures; i++) {
+            // Palette colors repeat often (unchanged channels), random ones cover the color encodings
+            Color colors[4];
+            for (int c = 0; c < 4; c++) colors[c] = test_range(3) ? test_color() : (Color){test_rand() & 0xFFFFFF};
+            TcEffect from_effect = effects[test_range(TEST_COUNT(effects))];
+            TcEffect effect      = test_range(3) ? effects[test_range(TEST_COUNT(effects))] : from_effect;
+            if (test_range(4) == 0) colors[2] = colors[0];
+            if (test_range(4) == 0) colors[3] = colors[1];
+
+            char from[MAX_ANSI_LENGTH], full[MAX_ANSI_LENGTH], step[2 * MAX_ANSI_LENGTH];
+            int from_len = tc_encode_sgr(from, colors[0], colors[1], from_effect, mode);
+            int full_len = tc_encode_sgr(full, colors[2], colors[3], effect, mode);
+            int step_len = tc_encode_sgr_transition(step, colors[0], colors[1], from_effect,
+                                                    colors[2], colors[3], effect, mode);
+
+            TestAttrs expected = {0}, got = {0};
+            int unknown = test_sgr_feed(&expected, full, full_len);
+            unknown += test_sgr_feed(&got, from, from_len);
+            unknown += test_sgr_feed(&got, step, step_len);
+
+            bool same = colors[0].color == colors[2].color && colors[1].color == colors[3].color &&
+                        from_effect == effect;
+            TEST_CHECK(memcmp(&got, &expected, sizeof(TestAttrs)) == 0 && unknown == 0,
+                       "sgr %s: \"%.*s\" after \"%.*s\" doesn't give \"%.*s\"", test_modes[m].name, step_len - 1,
+                       step + 1, from_len - 1, from + 1, full_len - 1, full + 1);
+            TEST_CHECK(step_len <= full_len, "sgr %s: transition longer than the full sequence", test_modes[m].name);
+            TEST_CHECK((step_len == 0) == same, "sgr %s: %d bytes for %s attributes", test_modes[m].name, step_len,
+                       same ? "the same" : "different");
+        }
+        if (test_verbose && failures == test_failures) printf("sgr %s: %d pairs\n", test_modes[m].name, pairs);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+//  Terminal Model
+// -----------------------------------------------------------------------------
+/*
+ * Just enough of a VT/xterm to replay what tc_show emits: cursor
+ * positioning, SGR, EL/ED/ECH, CUF, REP, DECSTBM with SU/SD, wide glyphs
+ * and combining marks, no autowrap. Anything else is reported as unknown,
+ * so a new sequence in the encoder can't slip by unchecked.
+ */
+#define TEST_VT_TEXT 24
+
+typedef struct {
+    char      text[TEST_VT_TEXT]; // UTF-8 of the glyph and its marks
+    uint8_t   len;
+    bool      cont;               // Right half of the wide glyph before it
+    TestAttrs attrs;
+} TestVtCell;
+
+typedef struct {
+    int         width;
+    int         height;
+    TestVtCell *cells;
+    int         cy, cx;
+    int         top, bottom;      // Scroll region, inclusive
+    TestAttrs   attrs;
+    uint32_t    last;             // Last printed symbol (REP)
+    int         last_y, last_x;   // Cell the last symbol went to (combining marks join it)
+    int         unknown;          // Sequences the model doesn't know
+} TestVt;
+
+static TestVtCell *test_vt_at(TestVt *vt, int y, int x) {
+    return &vt->cells[(size_t)(y) * (size_t)(vt->width) + (size_t)(x)];
+}
+
+static void test_vt_blank(TestVt *vt, int y, int x) {
+    TestVtCell *cell = test_vt_at(vt, y, x);
+    *cell = (TestVtCell){.text = " ", .len = 1, .attrs = vt->attrs};
+}
+
+/*
+ * Erases [x0, x1) of a row. Like a real terminal, a wide glyph cut in half
+ * loses its other half too.
+ */
+static void test_vt_erase(TestVt *vt, int y, int x0, int x1) {
+    if (x1 > vt->width) x1 = vt->width;
+    if (x0 >= x1) return;
+    if (test_vt_at(vt, y, x0)->cont && x0 > 0) test_vt_blank(vt, y, x0 - 1);
+    if (x1 < vt->width && test_vt_at(vt, y, x1)->cont) test_vt_blank(vt, y, x1);
+    for (int x = x0; x < x1; x++) test_vt_blank(vt, y, x);
+}
+
+static void test_vt_reset(TestVt *vt, int width, int height) {
+    free(vt->cells);
+    *vt = (TestVt){.width = width, .height = height, .bottom = height - 1};
+    vt->cells = (TestVtCell *)calloc((size_t)(width) * (size_t)(height), sizeof(TestVtCell));
+    for (int y = 0; y < height; y++) test_vt_erase(vt, y, 0, width);
+}
+
+static void test_vt_print(TestVt *vt, uint32_t cp, const char *utf8, int len) {
+    int width = tc_char_width((wchar_t)cp);
+    if (width == 0) {
+        TestVtCell *cell = test_vt_at(vt, vt->last_y, vt->last_x);
+        if (cell->len + len <= TEST_VT_TEXT) {
+            memcpy(cell->text + cell->len, utf8, (size_t)(len));
+            cell->len = (uint8_t)(cell->len + len);
+        }
+        return;
+    }
+    if (vt->cx + width > vt->width) {
+        vt->cx = vt->width; // No autowrap: what doesn't fit is dropped
+        return;
+    }
+
+    test_vt_erase(vt, vt->cy, vt->cx, vt->cx + width);
+    TestVtCell *cell = test_vt_at(vt, vt->cy, vt->cx);
+    memcpy(cell->text, utf8, (size_t)(len));
+    cell->len = (uint8_t)(len);
+    if (width == 2) *test_vt_at(vt, vt->cy, vt->cx + 1) = (TestVtCell){.cont = true, .attrs = vt->attrs};
+
+    vt->last   = cp;
+    vt->last_y = vt->cy;
+    vt->last_x = vt->cx;
+    vt->cx    += width;
+}
+
+static void test_vt_scroll(TestVt *vt, int lines) {
+    int rows = vt->bottom - vt->top + 1;
+    int n = lines < 0 ? -lines : lines;
+    if (n > rows) n = rows;
+
+    size_t stride = sizeof(TestVtCell) * (size_t)(vt->width);
+    TestVtCell *top = test_vt_at(vt, vt->top, 0);
+    if (lines > 0) {
+        memmove(top, top + (size_t)(n) * (size_t)(vt->width), stride * (size_t)(rows - n));
+        for (int y = vt->bottom - n + 1; y <= vt->bottom; y++) test_vt_erase(vt, y, 0, vt->width);
+    }
+    else {
+        memmove(top + (size_t)(n) * (size_t)(vt->width), top, stride * (size_t)(rows - n));
+        for (int y = vt->top; y < vt->top + n; y++) test_vt_erase(vt, y, 0, vt->width);
+    }
+}
+
+static void test_vt_feed(TestVt *vt, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c = (unsigned char)data[i];
+
+        if (c == 0x1B) {
+            if (i + 1 >= len || data[i + 1] != '[') {
+                vt->unknown++;
+                i++;
+                continue;
+            }
+            i += 2;
+            bool private_mode = i < len && data[i] == '?';
+            if (private_mode) i++;
+
+            int p[16], count = 0, value = -1;
+            while (i < len && ((data[i] >= '0' && data[i] <= '9') || data[i] == ';')) {
+                if (data[i] == ';') {
+                    if (count < 16) p[count++] = value < 0 ? 0 : value;
+                    value = -1;
+                }
+                else value = (value < 0 ? 0 : value * 10) + (data[i] - '0');
+                i++;
+            }
+            if (value >= 0 || count > 0) {
+                if (count < 16) p[count++] = value < 0 ? 0 : value;
+            }
+            if (i >= len) {
+                vt->unknown++;
+                break;
+            }
+            char final = data[i++];
+            int n = count > 0 && p[0] > 0 ? p[0] : 1;
+
+            if (private_mode) {
+                if (final != 'h' && final != 'l') vt->unknown++;
+                continue; // Cursor visibility, alternate screen, synchronized updates
+            }
+            switch (final) {
+                case 'H':
+                    vt->cy = (count > 0 && p[0] > 0 ? p[0] : 1) - 1;
+                    vt->cx = (count > 1 && p[1] > 0 ? p[1] : 1) - 1;
+                    if (vt->cy >= vt->height) vt->cy = vt->height - 1;
+                    if (vt->cx >= vt->width)  vt->cx = vt->width - 1;
+                    break;
+                case 'm': vt->unknown += test_sgr_apply(&vt->attrs, p, count); break;
+                case 'K': test_vt_erase(vt, vt->cy, vt->cx, vt->width); break;
+                case 'J':
+                    if (count > 0 && p[0] == 2) for (int y = 0; y < vt->height; y++) test_vt_erase(vt, y, 0, vt->width);
+                    else {
+                        test_vt_erase(vt, vt->cy, vt->cx, vt->width);
+                        for (int y = vt->cy + 1; y < vt->height; y++) test_vt_erase(vt, y, 0, vt->width);
+                    }
+                    break;
+                case 'X': test_vt_erase(vt, vt->cy, vt->cx, vt->cx + n); break;
+                case 'C':
+                    vt->cx += n;
+                    if (vt->cx >= vt->width) vt->cx = vt->width - 1;
+                    break;
+                case 'b': {
+                    char utf8[4];
+                    int bytes = tc_put_utf8(utf8, (wchar_t)vt->last);
+                    for (int k = 0; k < n; k++) test_vt_print(vt, vt->last, utf8, bytes);
+                    break;
+                }
+                case 'r':
+                    vt->top    = (count > 0 && p[0] > 0 ? p[0] : 1) - 1;
+                    vt->bottom = (count > 1 && p[1] > 0 ? p[1] : vt->height) - 1;
+                    vt->cy = vt->cx = 0;
+                    break;
+                case 'S': test_vt_scroll(vt, n); break;
+                case 'T': test_vt_scroll(vt, -n); break;
+                default:  vt->unknown++; break;
+            }
+            continue;
+        }
+
+        if (c == '\r') vt->cx = 0;
+        else if (c == '\n') vt->cy = vt->cy + 1 < vt->height ? vt->cy + 1 : vt->cy;
+        else if (c < 0x20 || c == 0x7F) vt->unknown++;
+        else {
+            int bytes = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+            if (i + (size_t)(bytes) > len) break;
+            uint32_t cp = bytes == 1 ? c : (uint32_t)(c & (0x7F >> bytes));
+            for (int k = 1; k < bytes; k++) cp = cp << 6 | ((unsigned char)data[i + (size_t)(k)] & 0x3F);
+            test_vt_print(vt, cp, data + i, bytes);
+            i += (size_t)(bytes);
+            continue;
+        }
+        i++;
+    }
+}
+
+static void test_vt_take(TestVt *vt, TermCanvas *canvas) {
+    size_t len = 0;
+    const char *data = tc_sink_memory(canvas, &len);
+    test_vt_feed(vt, data, len);
+    tc_sink_memory_clear(canvas);
+}
+
+/*
+ * Compares two model screens; returns the first differing cell (y * width + x) or -1.
+ */
+static int test_vt_diff(const TestVt *a, const TestVt *b) {
+    for (int i = 0; i < a->width * a->height; i++) {
+        const TestVtCell *ca = &a->cells[i], *cb = &b->cells[i];
+        if (ca->cont != cb->cont || ca->len != cb->len || memcmp(ca->text, cb->text, ca->len) != 0 ||
+            memcmp(&ca->attrs, &cb->attrs, sizeof(TestAttrs)) != 0) return i;
+    }
+    return -1;
+}
+
+/*
+ * Checks the model screen has the canvas text (as tc_dump_text gives it).
+ */
+static bool test_vt_text_matches(const TestVt *vt, const TermCanvas *canvas) {
+    size_t size = tc_dump_text(canvas, NULL, 0) + 1;
+    char *expected = (char *)malloc(size);
+    char *screen   = (char *)malloc((size_t)(vt->width + 1) * (size_t)(vt->height) * TEST_VT_TEXT + 1);
+    tc_dump_text(canvas, expected, size);
+
+    size_t len = 0;
+    for (int y = 0; y < vt->height; y++) {
+        for (int x = 0; x < vt->width; x++) {
+            const TestVtCell *cell = &vt->cells[y * vt->width + x];
+            if (cell->cont) continue;
+            memcpy(screen + len, cell->text, cell->len);
+            len += cell->len;
+        }
+        screen[len++] = '\n';
+    }
+    screen[len] = '\0';
+
+    bool same = strcmp(expected, screen) == 0;
+    free(expected);
+    free(screen);
+    return same;
+}
+
+static const struct {
+    const char *name;
+    unsigned    caps;
+} test_caps[] = {
+    {"none",   0},
+    {"rep",    Cap_Rep},
+    {"ech",    Cap_Ech},
+    {"cuf",    Cap_Cuf},
+    {"sync",   Cap_Sync},
+    {"scroll", Cap_Scroll},
+    {"all",    TC_CAPS_ALL},
+};
+
+#define TEST_VT_FRAMES 80
+
+/*
+ * Incremental frames against a full redraw of the same canvas (no caps,
+ * fresh terminal), frame by frame.
+ */
+static void test_terminal_case(unsigned caps, const char *caps_name, TcTerminalColorMode mode,
+                               const char *mode_name, bool dirty) {
+    int width = 34, height = 12;
+    TermCanvas *canvas = test_canvas(width, height, mode);
+    TermCanvas *plain  = test_canvas(width, height, mode);
+    tc_set_caps(canvas, caps);
+    tc_set_caps(plain, 0);
+    tc_set_dirty_tracking(canvas, dirty);
+    #ifdef TC_USE_THREADS
+    tc_set_encode_threads(canvas, test_threads);
+    #endif
+
+    TestVt vt = {0}, reference = {0};
+    test_vt_reset(&vt, width, height);
+
+    int failed_frame = -1;
+    for (int f = 0; f < TEST_VT_FRAMES && failed_frame < 0; f++) {
+        test_scribble(canvas, true);
+        if (f % 3 == 1) {
+            int y = test_range(height - 2);
+            tc_scroll(canvas, y, 2 + test_range(height - y - 1), test_range(7) - 3);
+        }
+        if (f % 4 == 0) tc_scroll(canvas, 0, height, 1);
+        if (f == TEST_VT_FRAMES / 2) tc_invalidate(canvas);
+
+        tc_show(canvas);
+        test_vt_take(&vt, canvas);
+
+        for (int y = 0; y < height; y++) memcpy(plain->pixels[y], canvas->pixels[y], sizeof(TcPixel) * (size_t)(width));
+        tc_invalidate(plain);
+        tc_show(plain);
+        test_vt_reset(&reference, width, height);
+        test_vt_take(&reference, plain);
+
+        int cell = test_vt_diff(&vt, &reference);
+        bool text = test_vt_text_matches(&vt, canvas);
+        if (cell >= 0 || !text || vt.unknown || reference.unknown) {
+            failed_frame = f;
+            TEST_CHECK(false, "terminal %s/%s%s: frame %d: %s (cell %d,%d), %d unknown sequences",
+                       caps_name, mode_name, dirty ? "/dirty" : "", f,
+                       !text ? "text differs from the canvas" : "screen differs from a full redraw",
+                       cell < 0 ? -1 : cell / width, cell < 0 ? -1 : cell % width, vt.unknown + reference.unknown);
+            if (cell >= 0) {
+                const TestVtCell *got = &vt.cells[cell], *want = &reference.cells[cell];
+                printf("  got  \"%.*s\"%s fg %08x bg %08x sgr %03x\n", got->len, got->text, got->cont ? " (right half)" : "",
+                       got->attrs.fg, got->attrs.bg, got->attrs.flags);
+                printf("  want \"%.*s\"%s fg %08x bg %08x sgr %03x\n", want->len, want->text,
+                       want->cont ? " (right half)" : "", want->attrs.fg, want->attrs.bg, want->attrs.flags);
+            }
+        }
+    }
+
+    free(vt.cells);
+    free(reference.cells);
+    tc_destroy(plain);
+    tc_destroy(canvas);
+    if (test_verbose && failed_frame < 0) printf("terminal %s/%s%s: ok\n", caps_name, mode_name, dirty ? "/dirty" : "");
+}
+
+/*
+ * The longest frames the encoder can make: every other cell changed, each
+ * with its own colors and effect and a cluster of three 3-byte symbols.
+ * Row bands (-j) are sized for this and must not flush mid-frame.
+ */
+static void test_terminal_worst(void) {
+    static const wchar_t marks[] = {0x20D0, 0x20D1};
+    int width = 60, height = 12;
+    TermCanvas *canvas = test_canvas(width, height, Color_RGB);
+    TermCanvas *plain  = test_canvas(width, height, Color_RGB);
+    tc_set_caps(plain, 0);
+    #ifdef TC_USE_THREADS
+    tc_set_encode_threads(canvas, test_threads);
+    #endif
+
+    TestVt vt = {0}, reference = {0};
+    test_vt_reset(&vt, width, height);
+    for (int f = 0; f < 4; f++) {
+        for (int y = 0; y < height; y++) {
+            for (int x = (f + y) % 2; x < width; x += f == 0 ? 1 : 2) {
+                Color fg = create_color_rgb(test_range(256), test_range(256), test_range(256));
+                Color bg = create_color_rgb(test_range(256), test_range(256), test_range(256));
+                wchar_t symbol = tc_cluster((wchar_t)(0x2580 + test_range(16)), marks, 2);
+                tc_set_pixel(canvas, y, x, tc_pixel(fg, bg, symbol, test_effect()));
+            }
+        }
+        tc_show(canvas);
+        test_vt_take(&vt, canvas);
+        int flushes = tc_get_stats(canvas)->flushes;
+
+        for (int y = 0; y < height; y++) memcpy(plain->pixels[y], canvas->pixels[y], sizeof(TcPixel) * (size_t)(width));
+        tc_invalidate(plain);
+        tc_show(plain);
+        test_vt_reset(&reference, width, height);
+        test_vt_take(&reference, plain);
+
+        int cell = test_vt_diff(&vt, &reference);
+        TEST_CHECK(flushes == 0 && cell < 0 && vt.unknown == 0,
+                   "terminal worst case: frame %d: %d flushes, cell %d differs, %d unknown sequences",
+                   f, flushes, cell, vt.unknown);
+    }
+
+    free(vt.cells);
+    free(reference.cells);
+    tc_destroy(plain);
+    tc_destroy(canvas);
+}
+
+static void test_terminal(void) {
+    for (int c = 0; c < TEST_COUNT(test_caps); c++) {
+        for (int m = 0; m < TEST_COUNT(test_modes); m++) {
+            for (int dirty = 0; dirty < 2; dirty++) {
+                test_terminal_case(test_caps[c].caps, test_caps[c].name, test_modes[m].mode, test_modes[m].name,
+                                   dirty);
+            }
+        }
+    }
+    test_terminal_worst();
+}
+
+
+// -----------------------------------------------------------------------------
+//  Pacing
+// -----------------------------------------------------------------------------
+static void test_pacing(void) {
+    TermCanvas *canvas = test_canvas(20, 6, Color_RGB);
+    size_t len = 0;
+
+    // Synchronized output: markers around every frame that sends something
+    tc_set_caps(canvas, Cap_Sync);
+    tc_set_pixel(canvas, 1, 1, tc_pixel(COLOR_BLUE, COLOR_WHITE, L'x', Effect_None));
+    tc_show(canvas);
+    const char *data = tc_sink_memory(canvas, &len);
+    size_t begin = strlen(TC_SYNC_BEGIN), end = strlen(TC_SYNC_END);
+    TEST_CHECK(data && len > begin + end && memcmp(data, TC_SYNC_BEGIN, begin) == 0 &&
+               memcmp(data + len - end, TC_SYNC_END, end) == 0, "pacing: frame not wrapped in sync markers");
+    tc_sink_memory_clear(canvas);
+    tc_show(canvas);
+    tc_sink_memory(canvas, &len);
+    TEST_CHECK(len == 0, "pacing: a frame without changes sent %zu bytes", len);
+
+    // Pacing_Skip: calls before the frame is due return right away, the changes go out with the next frame
+    tc_set_caps(canvas, 0);
+    tc_set_target_fps(canvas, 1, Pacing_Skip);
+    tc_set_pixel(canvas, 2, 2, tc_pixel(COLOR_RED, COLOR_WHITE, L'y', Effect_None));
+    tc_show(canvas);
+    tc_sink_memory_clear(canvas);
+    for (int i = 0; i < 3; i++) {
+        tc_set_pixel(canvas, 3, 3 + i, tc_pixel(COLOR_GREEN, COLOR_WHITE, L'z', Effect_None));
+        tc_show(canvas);
+    }
+    tc_sink_memory(canvas, &len);
+    TEST_CHECK(len == 0, "pacing: frame presented before it was due");
+
+    canvas->next_frame_ns = 0; // Due now
+    tc_show(canvas);
+    data = tc_sink_memory(canvas, &len);
+    TEST_CHECK(tc_get_stats(canvas)->frames_skipped == 3, "pacing: %d frames skipped, expected 3",
+               tc_get_stats(canvas)->frames_skipped);
+    TEST_CHECK(tc_get_stats(canvas)->cells_emitted == 3 && data && memchr(data, 'z', len),
+               "pacing: skipped changes were not presented");
+
+    // Turning pacing off presents a skipped update right away (main.c does this before tc_destroy)
+    tc_sink_memory_clear(canvas);
+    tc_set_pixel(canvas, 4, 4, tc_pixel(COLOR_GREEN, COLOR_WHITE, L'w', Effect_None));
+    tc_show(canvas);
+    tc_sink_memory(canvas, &len);
+    TEST_CHECK(len == 0, "pacing: frame presented before it was due");
+    tc_set_target_fps(canvas, 0, Pacing_Skip);
+    tc_show(canvas);
+    data = tc_sink_memory(canvas, &len);
+    TEST_CHECK(data && memchr(data, 'w', len), "pacing: update not presented with pacing off");
+
+    // Pacing_Sleep: 100 fps, so five frames take at least 40 ms
+    tc_set_target_fps(canvas, 100, Pacing_Sleep);
+    long long start = tc_now_ns();
+    for (int i = 0; i < 5; i++) tc_show(canvas);
+    long long elapsed = tc_now_ns() - start;
+    TEST_CHECK(elapsed >= 40000000LL, "pacing: five frames at 100 fps took %lld ms", elapsed / 1000000);
+
+    tc_destroy(canvas);
+    if (test_verbose) printf("pacing: ok\n");
+}
+
+
+// -----------------------------------------------------------------------------
+//  Stats
+// -----------------------------------------------------------------------------
+static void test_stats(void) {
+    int width = 90, height = 8, frames = 20;
+    TermCanvas *canvas = test_canvas(width, height, Color_256);
+    TermCanvas *plain  = test_canvas(width, height, Color_256);
+    #ifdef TC_USE_THREADS
+    tc_set_encode_threads(canvas, test_threads);
+    #endif
+
+    TestVt vt = {0}, reference = {0};
+    test_vt_reset(&vt, width, height);
+
+    TcStats previous = {0};
+    for (int f = 0; f < frames; f++) {
+        bool overlay = f >= 5 && f < 12;
+        tc_set_stats_overlay(canvas, overlay);
+        test_scribble(canvas, true);
+        tc_show(canvas);
+
+        const TcStats *stats = tc_get_stats(canvas);
+        size_t len = 0;
+        tc_sink_memory(canvas, &len);
+        TEST_CHECK(stats->bytes_written == (int)len, "stats: frame %d: %d bytes counted, %zu written", f,
+                   stats->bytes_written, len);
+        TEST_CHECK(stats->cells_scanned == width * height && stats->cells_emitted <= stats->cells_scanned &&
+                   stats->runs_emitted <= stats->cells_emitted && stats->flushes == 0,
+                   "stats: frame %d: implausible counters", f);
+        test_vt_take(&vt, canvas);
+
+        // With the overlay on, the top row starts with the stats of the frame before
+        if (overlay) {
+            char text[160];
+            int chars = tc_format_stats(&previous, text, sizeof(text));
+            if (chars > width) chars = width;
+            int same = 0;
+            while (same < chars && test_vt_at(&vt, 0, same)->text[0] == text[same]) same++;
+            TEST_CHECK(same == chars, "stats: frame %d: overlay differs from \"%.*s\" at column %d", f, chars, text,
+                       same);
+        }
+        previous = *stats;
+
+        // Without it, the screen is the canvas again
+        for (int y = 0; y < height; y++) memcpy(plain->pixels[y], canvas->pixels[y], sizeof(TcPixel) * (size_t)(width));
+        tc_invalidate(plain);
+        tc_show(plain);
+        test_vt_reset(&reference, width, height);
+        test_vt_take(&reference, plain);
+        int cell = overlay ? -1 : test_vt_diff(&vt, &reference);
+        TEST_CHECK(cell < 0, "stats: frame %d: cell %d,%d differs from a full redraw", f, cell / width, cell % width);
+    }
+
+    free(vt.cells);
+    free(reference.cells);
+    tc_destroy(plain);
+    tc_destroy(canvas);
+    if (test_verbose) printf("stats: %d frames\n", frames);
+}
+
+
+// -----------------------------------------------------------------------------
+//  Compositor
+// -----------------------------------------------------------------------------
+#define TEST_LAYERS 5
+
+typedef struct {
+    TermCanvas *canvas;
+    Coords      position;
+    bool        added;
+    bool        visible;
+    int         order;
+} TestLayer;
+
+/*
+ * The compositing rule, straight from its definition: for each cell, walk
+ * the layers from the top, the first non-transparent cell gives the symbol,
+ * foreground and effect, the first non-COLOR_NONE background the background.
+ */
+static TcPixel test_recomposite(const TermCanvas *target, const TestLayer *layers, int y, int x) {
+    const TestLayer *stack[TEST_LAYERS];
+    int count = 0;
+    for (int i = 0; i < TEST_LAYERS; i++) {
+        if (layers[i].added && layers[i].visible) stack[count++] = &layers[i];
+    }
+    for (int i = 1; i < count; i++) {
+        for (int j = i; j > 0; j--) {
+            const TestLayer *a = stack[j - 1], *b = stack[j];
+            if (a->position.z < b->position.z || (a->position.z == b->position.z && a->order < b->order)) continue;
+            stack[j - 1] = b;
+            stack[j]     = a;
+        }
+    }
+
+    TcPixel out = target->fill;
+    bool have_symbol = false, have_background = false;
+    for (int i = count - 1; i >= 0 && !have_background; i--) {
+        const TermCanvas *canvas = stack[i]->canvas;
+        int ly = y - stack[i]->position.y;
+        int lx = x - stack[i]->position.x;
+        if (ly < 0 || lx < 0 || ly >= canvas->height || lx >= canvas->width) continue;
+
+        TcPixel px = canvas->pixels[ly][lx];
+        if (!have_symbol && !(px.symbol == L' ' && is_none(px.background))) {
+            out.symbol     = px.symbol;
+            out.foreground = px.foreground;
+            out.effect     = px.effect;
+            have_symbol = true;
+        }
+        if (!is_none(px.background)) {
+            out.background  = px.background;
+            have_background = true;
+        }
+    }
+    return out;
+}
+
+static void test_compositor(void) {
+    static const wchar_t symbols[] = {L' ', L' ', L' ', L'x', L'o', L'#'};
+
+    TermCanvas *target = test_canvas(30, 10, Color_RGB);
+    TcCompositor *compositor = tc_compositor_create(target);
+    TEST_CHECK(compositor != NULL, "compositor: tc_compositor_create failed");
+    if (!compositor) return;
+
+    TestLayer layers[TEST_LAYERS];
+    int next_order = 0;
+    for (int i = 0; i < TEST_LAYERS; i++) {
+        layers[i] = (TestLayer){
+            .canvas   = test_canvas(4 + test_range(14), 2 + test_range(6), Color_RGB),
+            .position = {(short)(test_range(12) - 2), (short)(test_range(34) - 4), (short)(test_range(3))},
+            .visible  = true,
+        };
+        TermCanvas *canvas = layers[i].canvas;
+        for (int y = 0; y < canvas->height; y++) {
+            for (int x = 0; x < canvas->width; x++) canvas->pixels[y][x] = test_cell(symbols, TEST_COUNT(symbols));
+        }
+        layers[i].added = tc_compositor_add(compositor, canvas, layers[i].position);
+        layers[i].order = next_order++;
+        TEST_CHECK(layers[i].added, "compositor: tc_compositor_add failed");
+    }
+    TEST_CHECK(!tc_compositor_add(compositor, layers[0].canvas, layers[0].position), "compositor: layer added twice");
+
+    int steps = 400;
+    for (int step = 0; step < steps; step++) {
+        TestLayer *layer = &layers[test_range(TEST_LAYERS)];
+        TermCanvas *canvas = layer->canvas;
+
+        switch (test_range(8)) {
+            case 0:
+                layer->position = (Coords){(short)(test_range(14) - 3), (short)(test_range(40) - 6),
+                                           (short)(test_range(4) - 1)};
+                tc_compositor_move(compositor, canvas, layer->position);
+                break;
+            case 1:
+                layer->visible = !layer->visible;
+                tc_compositor_set_visible(compositor, canvas, layer->visible);
+                break;
+            case 2:
+                tc_resize(canvas, 2 + test_range(16), 1 + test_range(8));
+                break;
+            case 3:
+                if (layer->added) tc_compositor_remove(compositor, canvas);
+                else {
+                    layer->order   = next_order++;
+                    layer->visible = true;
+                    TEST_CHECK(tc_compositor_add(compositor, canvas, layer->position), "compositor: re-add failed");
+                }
+                layer->added = !layer->added;
+                break;
+            case 4:
+                if (test_range(4) == 0) tc_resize(target, 8 + test_range(40), 3 + test_range(16));
+                break;
+            default:
+                for (int i = test_range(10); i >= 0; i--) {
+                    tc_set_pixel(canvas, test_range(canvas->height), test_range(canvas->width),
+                                 test_cell(symbols, TEST_COUNT(symbols)));
+                }
+                break;
+        }
+
+        // Several changes may pile up before an update
+        if (test_range(3) == 0) continue;
+        tc_compositor_update(compositor);
+
+        int wrong = 0;
+        for (int y = 0; y < target->height; y++) {
+            for (int x = 0; x < target->width; x++) {
+                TcPixel expected = test_recomposite(target, layers, y, x);
+                if (!test_same_cells(&target->pixels[y][x], &expected, 1)) wrong++;
+            }
+        }
+        TEST_CHECK(wrong == 0, "compositor: step %d, %d cells differ from a full recomposite", step, wrong);
+        if (wrong) break;
+    }
+
+    tc_compositor_destroy(compositor);
+    for (int i = 0; i < TEST_LAYERS; i++) tc_destroy(layers[i].canvas);
+    tc_destroy(target);
+    if (test_verbose) printf("compositor: %d steps\n", steps);
+}
+
+
+// -----------------------------------------------------------------------------
+//  Color Kernels
+// -----------------------------------------------------------------------------
+static Color test_kernel_color(void) {
+    return test_range(5) == 0 ? COLOR_NONE : (Color){test_rand() & 0xFFFFFF};
+}
+
+static void test_kernels(void) {
+    static const char *const names[] = {"tc_blend_area", "tc_darken_area", "tc_gradient_area"};
+    static const wchar_t symbols[] = {L' ', L'a', 0x2588};
+    int width = 37, height = 9, rounds = 600; // Odd sizes leave tails behind the vector loops
+
+    TermCanvas *canvas = test_canvas(width, height, Color_RGB);
+    TcPixel *expected = (TcPixel *)malloc(sizeof(TcPixel) * (size_t)(width) * (size_t)(height));
+    int failures = test_failures;
+
+    for (int round = 0; round < rounds && failures == test_failures; round++) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                canvas->pixels[y][x] = tc_pixel(test_kernel_color(), test_kernel_color(),
+                                                symbols[test_range(TEST_COUNT(symbols))], test_effect());
+                expected[y * width + x] = canvas->pixels[y][x];
+            }
+        }
+
+        int kind = test_range(3);
+        int ry = test_range(height + 4) - 2, rx = test_range(width + 8) - 4;
+        int rh = test_range(height + 3), rw = test_range(width + 6);
+        TcColorSlot slots = (TcColorSlot)(test_range(4)); // 0 touches nothing
+        Color color = test_kernel_color(), to = test_kernel_color();
+        uint8_t alpha = (uint8_t)(test_range(4) == 0 ? 255 * test_range(2) : test_range(256));
+        bool vertical = test_range(2);
+
+        switch (kind) {
+            case 0: tc_blend_area(canvas, ry, rx, rh, rw, color, alpha, slots); break;
+            case 1: tc_darken_area(canvas, ry, rx, rh, rw, alpha, slots); break;
+            default: tc_gradient_area(canvas, ry, rx, rh, rw, color, to, vertical, slots); break;
+        }
+
+        // The same, one color at a time; positions along a gradient count from the unclipped rectangle
+        int steps = (vertical ? rh : rw) - 1;
+        for (int y = ry < 0 ? 0 : ry; y < ry + rh && y < height; y++) {
+            for (int x = rx < 0 ? 0 : rx; x < rx + rw && x < width; x++) {
+                TcPixel *px = &expected[y * width + x];
+                Color *slot[2] = {slots & Slot_Background ? &px->background : NULL,
+                                  slots & Slot_Foreground ? &px->foreground : NULL};
+                for (int i = 0; i < 2; i++) {
+                    if (!slot[i]) continue;
+                    if (kind == 2) {
+                        int pos = vertical ? y - ry : x - rx;
+                        *slot[i] = color_mix(color, to, steps > 0 ? (unsigned)(pos * 256 / steps) : 0);
+                    }
+                    else if (!is_none(*slot[i]) && kind == 1) *slot[i] = color_darken(*slot[i], alpha);
+                    else if (!is_none(*slot[i]) && !is_none(color)) *slot[i] = color_blend(*slot[i], color, alpha);
+                }
+            }
+        }
+
+        for (int i = 0; i < width * height; i++) {
+            if (test_same_cells(&canvas->pixels[i / width][i % width], &expected[i], 1)) continue;
+            TEST_CHECK(false, "kernels: round %d: %s(%d, %d, %d, %d) differs at cell %d,%d", round, names[kind], ry, rx,
+                       rh, rw, i / width, i % width);
+            break;
+        }
+    }
+
+    free(expected);
+    tc_destroy(canvas);
+    if (test_verbose && failures == test_failures) printf("kernels: %d rounds\n", rounds);
+}
+
+
+// -----------------------------------------------------------------------------
+//  Style Table
+// -----------------------------------------------------------------------------
+static bool test_style_is(const TcStyleTable *table, uint16_t id, Color fg, Color bg, TcEffect effect) {
+    char sgr[MAX_ANSI_LENGTH];
+    int len = tc_encode_sgr(sgr, fg, bg, effect, table->mode);
+    const TcStyle *style = &table->styles[id];
+    return style->len == len && memcmp(style->sgr, sgr, (size_t)(len)) == 0;
+}
+
+static void test_styles(void) {
+    TermCanvas *canvas = test_canvas(4, 4, Color_256);
+    TcStyleTable *table = tc_style_table_create(canvas, Color_256);
+    TEST_CHECK(table != NULL, "styles: tc_style_table_create failed");
+    if (!table) return;
+
+    // Fill the table: every style gets its own id and its full sequence
+    static uint16_t ids[TC_STYLE_MAX];
+    bool distinct = true, sequences = true;
+    for (int i = 0; i < TC_STYLE_MAX; i++) {
+        Color fg = (Color){(uint32_t)(i) * 0x010305u & 0xFFFFFF};
+        ids[i] = tc_style_intern(table, fg, test_colors[i % 8], test_effects[i % 5]);
+        distinct  = distinct && ids[i] == i;
+        sequences = sequences && test_style_is(table, ids[i], fg, test_colors[i % 8], test_effects[i % 5]);
+    }
+    TEST_CHECK(distinct, "styles: ids are not handed out in order");
+    TEST_CHECK(sequences, "styles: interned sequence differs from tc_encode_sgr");
+
+    bool found = true;
+    for (int i = 0; i < TC_STYLE_MAX; i++) {
+        Color fg = (Color){(uint32_t)(i) * 0x010305u & 0xFFFFFF};
+        found = found && tc_style_intern(table, fg, test_colors[i % 8], test_effects[i % 5]) == ids[i];
+    }
+    TEST_CHECK(found, "styles: interning a known style gave another id");
+    TEST_CHECK(tc_style_intern(table, COLOR_WHITE, COLOR_WHITE, Effect_Blink) == TC_STYLE_NONE,
+               "styles: style interned into a full table");
+
+    // Transitions: many pairs share a cache slot, every answer has to be right anyway
+    int wrong = 0;
+    for (int i = 0; i < 4000; i++) {
+        uint16_t from = (uint16_t)(test_range(64)), to = (uint16_t)(test_range(64));
+        const TcStyle *a = &table->styles[from], *b = &table->styles[to];
+        char got[TC_STYLE_SGR_BYTES], want[2 * MAX_ANSI_LENGTH];
+        int len = tc_style_transition(table, got, from, to);
+        int want_len = tc_encode_sgr_transition(want, a->fg, a->bg, a->effect, b->fg, b->bg, b->effect, table->mode);
+        if (len != want_len || memcmp(got, want, (size_t)(len)) != 0) wrong++;
+    }
+    TEST_CHECK(wrong == 0, "styles: %d cached transitions differ from tc_encode_sgr_transition", wrong);
+
+    // A full table starts over with the next frame, as does a mode change
+    tc_style_table_begin(table, Color_256);
+    TEST_CHECK(table->count == 0 && tc_style_intern(table, COLOR_RED, COLOR_NONE, Effect_Bold) == 0,
+               "styles: full table not reset for the next frame");
+    tc_style_table_begin(table, Color_256);
+    TEST_CHECK(table->count == 1, "styles: table reset although not full");
+    tc_style_table_begin(table, Color_RGB);
+    uint16_t id = tc_style_intern(table, COLOR_RED, COLOR_NONE, Effect_Bold);
+    TEST_CHECK(id == 0 && test_style_is(table, id, COLOR_RED, COLOR_NONE, Effect_Bold),
+               "styles: sequence not rebuilt for the new color mode");
+
+    tc_free(table);
+    tc_destroy(canvas);
+    if (test_verbose) printf("styles: %d styles\n", TC_STYLE_MAX);
+}
+
+
+// -----------------------------------------------------------------------------
+//  Headless
+// -----------------------------------------------------------------------------
+static void test_headless(void) {
+    TestCapture capture = {0};
+    TcOptions options = TC_OPTIONS_HEADLESS;
+    options.mode = Color_Auto;
+    options.sink = (TcSink){Sink_Callback, -1, test_capture_write, &capture};
+    TermCanvas *canvas = tc_create_ex(12, 3, L'.', COLOR_WHITE, COLOR_BLACK, &options);
+    TEST_CHECK(canvas != NULL, "headless: tc_create_ex failed");
+    if (!canvas) return;
+    TEST_CHECK(capture.len == 0, "headless: %zu bytes written on create", capture.len);
+    TEST_CHECK(canvas->mode == Color_RGB, "headless: Color_Auto gave mode %d", canvas->mode);
+
+    tc_draw_text(canvas, 1, 2, L"hi \x2588", COLOR_RED, COLOR_NONE, Effect_Bold);
+    tc_show(canvas);
+    TEST_CHECK(capture.len > 0 && !tc_get_stats(canvas)->too_small, "headless: frame not presented");
+
+    // There is no terminal to be too small: it grows with the canvas
+    tc_resize(canvas, 30, 5);
+    tc_show(canvas);
+    TEST_CHECK(!tc_get_stats(canvas)->too_small && canvas->size_w == 30 && canvas->size_h == 5,
+               "headless: terminal size %dx%d after a resize to 30x5", canvas->size_w, canvas->size_h);
+
+    char expected[256] = "", text[256];
+    for (int y = 0; y < 5; y++) {
+        strcat(expected, y == 1 ? ".." "hi \xE2\x96\x88" "........................\n" : "..............................\n");
+    }
+    size_t len = tc_dump_text(canvas, text, sizeof(text));
+    TEST_CHECK(len == strlen(expected) && strcmp(text, expected) == 0, "headless: tc_dump_text gave \"%s\"", text);
+    TEST_CHECK(tc_dump_text(canvas, NULL, 0) == len, "headless: tc_dump_text without a buffer gave another length");
+    len = tc_dump_text(canvas, text, 40);
+    TEST_CHECK(len == strlen(expected) && strlen(text) == 39 && strncmp(text, expected, 39) == 0,
+               "headless: cut tc_dump_text gave \"%s\"", text);
+
+    TcPixel cells[150];
+    TEST_CHECK(tc_dump_cells(canvas, cells) == 150, "headless: tc_dump_cells count");
+    bool same = true;
+    for (int y = 0; y < 5; y++) same = same && test_same_cells(cells + y * 30, canvas->pixels[y], 30);
+    TEST_CHECK(same, "headless: tc_dump_cells differs from the canvas");
+
+    len = capture.len;
+    tc_destroy(canvas);
+    TEST_CHECK(capture.len == len, "headless: %zu bytes written on destroy", capture.len - len);
+    free(capture.data);
+    if (test_verbose) printf("headless: ok\n");
+}
+
+
+// -----------------------------------------------------------------------------
+//  Recorder
+// -----------------------------------------------------------------------------
+typedef struct {
+    int      width;
+    int      height;
+    TcPixel *cells;
+} TestFrame;
+
+#define TEST_REC_FRAMES 48
+
+static bool test_player_matches(const TermCanvas *canvas, const TestFrame *frame) {
+    if (canvas->width != frame->width || canvas->height != frame->height) return false;
+
+    TcPixel *cells = (TcPixel *)malloc(sizeof(TcPixel) * (size_t)(frame->width) * (size_t)(frame->height));
+    if (!cells) return false;
+    tc_dump_cells(canvas, cells);
+    bool same = test_same_cells(cells, frame->cells, (size_t)(frame->width) * (size_t)(frame->height));
+    free(cells);
+    return same;
+}
+
+/*
+ * Writes len bytes of data to a fresh temporary file and returns its path.
+ */
+static bool test_write_file(char *path, const void *data, size_t len) {
+    strcpy(path, "/tmp/termcanvas-test-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) return false;
+
+    bool ok = write(fd, data, len) == (ssize_t)len;
+    close(fd);
+    return ok;
+}
+
+static unsigned char *test_read_file(const char *path, size_t *len) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    unsigned char *data = (unsigned char *)malloc((size_t)(st.st_size));
+    if (data && read(fd, data, (size_t)(st.st_size)) != st.st_size) {
+        free(data);
+        data = NULL;
+    }
+    close(fd);
+    *len = (size_t)(st.st_size);
+    return data;
+}
+
+/*
+ * Number of frames the player indexes in the given bytes.
+ */
+static int test_player_count(const void *data, size_t len) {
+    char path[64];
+    if (!test_write_file(path, data, len)) return -1;
+
+    TcPlayer *player = tc_player_open(path);
+    int count = player ? tc_player_frame_count(player) : -1;
+
+    // Whatever was indexed has to play without running off the records
+    TermCanvas *canvas = test_canvas(4, 4, Color_RGB);
+    for (int i = 0; player && canvas && i < count; i++) tc_player_seek(player, canvas, i);
+    tc_destroy(canvas);
+
+    tc_player_close(player);
+    unlink(path);
+    return count;
+}
+
+static void test_recorder(void) {
+    TestFrame frames[TEST_REC_FRAMES];
+    char path[64] = "/tmp/termcanvas-test-XXXXXX";
+    int fd = mkstemp(path);
+    TEST_CHECK(fd >= 0, "recorder: no temporary file");
+    if (fd < 0) return;
+
+    // Record, keeping a copy of every presented frame (clusters are recorded by their base symbol)
+    TermCanvas *canvas = test_canvas(30, 8, Color_RGB);
+    TEST_CHECK(tc_record_start(canvas, fd, 7), "recorder: tc_record_start failed");
+    for (int f = 0; f < TEST_REC_FRAMES; f++) {
+        if (f == 20) tc_resize(canvas, 36, 10);
+        if (f == 33) tc_resize(canvas, 21, 5);
+        if (f % 11 != 10) test_scribble(canvas, false); // Some frames change nothing
+        tc_show(canvas);
+
+        size_t cells = (size_t)(canvas->width) * (size_t)(canvas->height);
+        frames[f] = (TestFrame){canvas->width, canvas->height, (TcPixel *)malloc(sizeof(TcPixel) * cells)};
+        tc_dump_cells(canvas, frames[f].cells);
+    }
+    TEST_CHECK(tc_record_stop(canvas), "recorder: part of the recording was lost");
+    tc_destroy(canvas);
+    close(fd);
+
+    // Play back: seek to every frame, out of order, then step through all of them
+    TcPlayer *player = tc_player_open(path);
+    TEST_CHECK(player != NULL, "recorder: tc_player_open failed");
+    if (player) {
+        TEST_CHECK(tc_player_frame_count(player) == TEST_REC_FRAMES, "recorder: %d frames indexed, %d recorded",
+                   tc_player_frame_count(player), TEST_REC_FRAMES);
+
+        TermCanvas *screen = test_canvas(1, 1, Color_RGB);
+        for (int i = 0; i < 3 * TEST_REC_FRAMES; i++) {
+            int f = i < TEST_REC_FRAMES ? TEST_REC_FRAMES - 1 - i : test_range(TEST_REC_FRAMES);
+            TEST_CHECK(tc_player_seek(player, screen, f) && test_player_matches(screen, &frames[f]),
+                       "recorder: seek to frame %d differs", f);
+        }
+
+        TEST_CHECK(tc_player_seek(player, screen, 0), "recorder: seek to frame 0 failed");
+        for (int f = 1; f < TEST_REC_FRAMES; f++) {
+            TEST_CHECK(tc_player_step(player, screen, NULL) && test_player_matches(screen, &frames[f]),
+                       "recorder: step to frame %d differs", f);
+        }
+        TEST_CHECK(!tc_player_step(player, screen, NULL), "recorder: stepped past the last frame");
+
+        tc_destroy(screen);
+        tc_player_close(player);
+    }
+
+    // Malformed files
+    size_t len = 0;
+    unsigned char *data = test_read_file(path, &len);
+    unlink(path);
+    TEST_CHECK(data != NULL, "recorder: recording can't be read back");
+    if (data) {
+        size_t offsets[TEST_REC_FRAMES];
+        size_t offset = sizeof(TcRecHeader);
+        for (int f = 0; f < TEST_REC_FRAMES; f++) {
+            TcRecFrame frame;
+            memcpy(&frame, data + offset, sizeof(frame));
+            offsets[f] = offset;
+            offset += frame.size;
+        }
+
+        TEST_CHECK(test_player_count(data, len - 3) == TEST_REC_FRAMES - 1, "recorder: truncated file");
+        TEST_CHECK(test_player_count(data, sizeof(TcRecHeader) - 1) == -1, "recorder: file shorter than the header");
+
+        unsigned char *bad = (unsigned char *)malloc(len);
+        memcpy(bad, data, len);
+        bad[0] ^= 0xFF;
+        TEST_CHECK(test_player_count(bad, len) == -1, "recorder: bad magic accepted");
+
+        // A frame without cells ends the index
+        memcpy(bad, data, len);
+        uint16_t zero = 0;
+        memcpy(bad + offsets[25] + offsetof(TcRecFrame, width), &zero, sizeof(zero));
+        TEST_CHECK(test_player_count(bad, len) == 25, "recorder: zero width frame indexed");
+        memcpy(bad, data, len);
+        memcpy(bad + offsets[3] + offsetof(TcRecFrame, height), &zero, sizeof(zero));
+        TEST_CHECK(test_player_count(bad, len) == 3, "recorder: zero height frame indexed");
+
+        // The smallest such file: a keyframe 0 cells wide with one empty run
+        struct {
+            TcRecHeader   header;
+            TcRecFrame    frame;
+            unsigned char runs[8];
+        } empty = {.frame = {.size = sizeof(TcRecFrame) + 8, .type = Rec_Keyframe, .width = 0, .height = 5, .runs = 1}};
+        memcpy(&empty.header, data, sizeof(TcRecHeader));
+        TEST_CHECK(test_player_count(&empty, sizeof(empty)) == 0, "recorder: frame without cells indexed");
+
+        // An odd record size ends the index as well
+        memcpy(bad, data, len);
+        uint32_t odd = 13;
+        memcpy(bad + offsets[10], &odd, sizeof(odd));
+        TEST_CHECK(test_player_count(bad, len) == 10, "recorder: odd record size indexed");
+
+        // Garbage in the runs has to stay inside the records (run it under PROFILE=asan)
+        for (int round = 0; round < 20; round++) {
+            memcpy(bad, data, len);
+            for (int f = 0; f < TEST_REC_FRAMES; f++) {
+                size_t start = offsets[f] + sizeof(TcRecFrame);
+                size_t end   = f + 1 < TEST_REC_FRAMES ? offsets[f + 1] : len;
+                for (size_t i = start; i < end; i++) {
+                    if (test_range(8) == 0) bad[i] = (unsigned char)test_rand();
+                }
+            }
+            TEST_CHECK(test_player_count(bad, len) == TEST_REC_FRAMES, "recorder: corrupt runs changed the index");
+        }
+
+        free(bad);
+        free(data);
+    }
+
+    for (int f = 0; f < TEST_REC_FRAMES; f++) free(frames[f].cells);
+    if (test_verbose) printf("recorder: %d frames\n", TEST_REC_FRAMES);
+}
+
+// -----------------------------------------------------------------------------
+//  Broadcast
+// -----------------------------------------------------------------------------
+/*
+ * A client terminal: the fd handed to the broadcast, the end the viewer
+ * reads and the screen it shows.
+ */
+typedef struct {
+    int                 fd;
+    int                 peer;
+    TcTerminalColorMode mode;
+    TestCapture         stream; // Read but not on screen yet
+    TestVt              vt;
+} TestViewer;
+
+static void test_viewer_open(TestViewer *viewer, TcTerminalColorMode mode, bool socket, int width, int height) {
+    int fds[2];
+    *viewer = (TestViewer){.fd = -1, .peer = -1, .mode = mode};
+    if ((socket ? socketpair(AF_UNIX, SOCK_STREAM, 0, fds) : pipe(fds)) != 0) return;
+
+    viewer->fd   = socket ? fds[0] : fds[1];
+    viewer->peer = socket ? fds[1] : fds[0];
+    fcntl(viewer->peer, F_SETFL, fcntl(viewer->peer, F_GETFL) | O_NONBLOCK);
+    test_vt_reset(&viewer->vt, width, height);
+}
+
+static void test_viewer_close(TestViewer *viewer) {
+    if (viewer->fd >= 0)   close(viewer->fd);
+    if (viewer->peer >= 0) close(viewer->peer);
+    viewer->fd = viewer->peer = -1;
+    free(viewer->stream.data);
+    free(viewer->vt.cells);
+    viewer->stream = (TestCapture){0};
+    viewer->vt     = (TestVt){0};
+}
+
+/*
+ * Puts everything the viewer has read so far on its screen.
+ */
+static void test_viewer_update(TestViewer *viewer) {
+    test_vt_feed(&viewer->vt, viewer->stream.data, viewer->stream.len);
+    viewer->stream.len = 0;
+}
+
+static bool test_viewer_ends_with(const TestViewer *viewer, const char *tail) {
+    size_t len = strlen(tail);
+    return viewer->stream.len >= len && memcmp(viewer->stream.data + viewer->stream.len - len, tail, len) == 0;
+}
+
+/*
+ * Lets every viewer but the stalled one read until nothing is pending.
+ */
+static void test_broadcast_sync(TcBroadcast *broadcast, TestViewer *viewers, int count, int stalled) {
+    for (int round = 0; round < 1000; round++) {
+        for (int v = 0; v < count; v++) {
+            if (v != stalled && viewers[v].peer >= 0) test_capture_fd(&viewers[v].stream, viewers[v].peer);
+        }
+        if (stalled >= 0 || tc_broadcast_flush(broadcast) == 0) break;
+    }
+}
+
+/*
+ * A pipe viewer that went away is dropped, without the SIGPIPE that
+ * would end the process.
+ */
+static void test_broadcast_pipe(void) {
+    TermCanvas *source = test_canvas(20, 4, Color_RGB);
+    TcBroadcast *broadcast = tc_broadcast_create(source);
+    TestViewer viewer;
+    test_viewer_open(&viewer, Color_256, false, 20, 4);
+    int flags = fcntl(viewer.fd, F_GETFL);
+
+    tc_broadcast_add(broadcast, viewer.fd, viewer.mode);
+    test_scribble(source, false);
+    TEST_CHECK(tc_broadcast_present(broadcast) == 1, "broadcast pipe: viewer not sent");
+
+    close(viewer.peer);
+    viewer.peer = -1;
+    test_scribble(source, false);
+    tc_broadcast_present(broadcast);
+
+    sigset_t pending;
+    sigpending(&pending);
+    TEST_CHECK(!tc_broadcast_connected(broadcast, viewer.fd), "broadcast pipe: closed viewer kept");
+    TEST_CHECK(!sigismember(&pending, SIGPIPE), "broadcast pipe: SIGPIPE left pending");
+    TEST_CHECK(fcntl(viewer.fd, F_GETFL) == flags, "broadcast pipe: fd flags not restored");
+
+    tc_broadcast_destroy(broadcast);
+    test_viewer_close(&viewer);
+    tc_destroy(source);
+}
+
+static void test_broadcast(void) {
+    enum { Slow = 3, Late = 4, Gone = 5, Viewers = 6 }; // Viewers 0-2 are one per mode
+    int width = 40, height = 10, frames = 30;
+    int joins = 8, closes = 12, stall = 5, resumes = 15; // Frames where viewers change
+    int shrinks = 20, grows = 25;                         // Frames where the source is resized
+
+    TermCanvas *source = test_canvas(width, height, Color_RGB);
+    TcBroadcast *broadcast = tc_broadcast_create(source);
+    TEST_CHECK(broadcast != NULL, "broadcast: tc_broadcast_create failed");
+    if (!broadcast) {
+        tc_destroy(source);
+        return;
+    }
+
+    // One viewer per mode, a pipe that stalls for a while, one that joins late and one that goes away
+    TestViewer viewers[Viewers];
+    test_viewer_open(&viewers[0], Color_RGB, true, width, height);
+    test_viewer_open(&viewers[1], Color_256, true, width, height);
+    test_viewer_open(&viewers[2], Color_Base, true, width, height);
+    test_viewer_open(&viewers[Slow], Color_RGB, false, width, height);
+    test_viewer_open(&viewers[Late], Color_256, true, width, height);
+    test_viewer_open(&viewers[Gone], Color_Base, true, width, height);
+    #ifdef F_SETPIPE_SZ
+    fcntl(viewers[Slow].fd, F_SETPIPE_SZ, 4096);
+    #endif
+
+    for (int v = 0; v < Viewers; v++) {
+        if (v == Late) continue;
+        TEST_CHECK(tc_broadcast_add(broadcast, viewers[v].fd, viewers[v].mode), "broadcast: viewer %d not added", v);
+    }
+    TEST_CHECK(!tc_broadcast_add(broadcast, viewers[0].fd, Color_RGB), "broadcast: fd added twice");
+    TEST_CHECK(!tc_broadcast_add(broadcast, viewers[Late].fd, Color_Auto), "broadcast: Color_Auto accepted");
+    TEST_CHECK(!tc_broadcast_add(broadcast, -1, Color_RGB), "broadcast: fd -1 accepted");
+
+    TermCanvas *plain[Color_RGB + 1];
+    TestVt reference[Color_RGB + 1] = {{0}};
+    for (int m = Color_Base; m <= Color_RGB; m++) {
+        plain[m] = test_canvas(width, height, (TcTerminalColorMode)m);
+        tc_set_caps(plain[m], 0);
+    }
+
+    int skipped = 0;
+    for (int f = 0; f < frames; f++) {
+        if (f == joins) {
+            TEST_CHECK(tc_broadcast_add(broadcast, viewers[Late].fd, viewers[Late].mode), "broadcast: late viewer not added");
+        }
+        if (f == closes) {
+            close(viewers[Gone].peer);
+            viewers[Gone].peer = -1;
+        }
+        if (f == shrinks) tc_resize(source, width - 9, height - 3);
+        if (f == grows)   tc_resize(source, width, height);
+
+        test_scribble(source, true);
+        int connected = 0;
+        for (int v = 0; v < Viewers; v++) connected += tc_broadcast_connected(broadcast, viewers[v].fd);
+        int sent = tc_broadcast_present(broadcast);
+        bool stalled = f >= stall && f < resumes;
+        if (stalled) skipped += sent < connected;
+
+        test_broadcast_sync(broadcast, viewers, Viewers, stalled ? Slow : -1);
+
+        if (f == closes) {
+            TEST_CHECK(!tc_broadcast_connected(broadcast, viewers[Gone].fd), "broadcast: closed viewer kept");
+            TEST_CHECK(!(fcntl(viewers[Gone].fd, F_GETFL) & O_NONBLOCK), "broadcast: dropped viewer left non-blocking");
+            test_viewer_close(&viewers[Gone]);
+        }
+
+        // The viewers' terminals keep their size: after a shrink, the rest of the screen has to be blank
+        for (int m = Color_Base; m <= Color_RGB; m++) {
+            if (plain[m]->width != source->width) tc_resize(plain[m], source->width, source->height);
+            for (int y = 0; y < source->height; y++) {
+                memcpy(plain[m]->pixels[y], source->pixels[y], sizeof(TcPixel) * (size_t)(source->width));
+            }
+            tc_invalidate(plain[m]);
+            tc_show(plain[m]);
+            test_vt_reset(&reference[m], width, height);
+            test_vt_take(&reference[m], plain[m]);
+        }
+
+        // Compare the viewers that took this frame: the slow one only a frame after it caught up
+        for (int v = 0; v < Viewers; v++) {
+            TestViewer *viewer = &viewers[v];
+            if (viewer->fd < 0 || (v == Late && f < joins) || (v == Slow && stalled)) continue;
+            test_viewer_update(viewer);
+            if (v == Slow && f == resumes) continue;
+
+            int cell = test_vt_diff(&viewer->vt, &reference[viewer->mode]);
+            TEST_CHECK(cell < 0 && viewer->vt.unknown == 0,
+                       "broadcast: frame %d: viewer %d differs from a full redraw (cell %d), %d unknown sequences",
+                       f, v, cell, viewer->vt.unknown);
+        }
+    }
+    TEST_CHECK(skipped > 0, "broadcast: the stalled viewer never skipped a frame");
+
+    // Removed viewers get their terminal back, the fd stays open
+    tc_broadcast_remove(broadcast, viewers[0].fd);
+    test_capture_fd(&viewers[0].stream, viewers[0].peer);
+    TEST_CHECK(!tc_broadcast_connected(broadcast, viewers[0].fd) &&
+               test_viewer_ends_with(&viewers[0], TC_BROADCAST_RESTORE), "broadcast: removed viewer not restored");
+    TEST_CHECK(fcntl(viewers[0].fd, F_GETFD) >= 0, "broadcast: removed viewer's fd closed");
+    TEST_CHECK(!(fcntl(viewers[0].fd, F_GETFL) & O_NONBLOCK), "broadcast: removed viewer left non-blocking");
+
+    tc_broadcast_destroy(broadcast);
+    for (int v = 1; v < Viewers; v++) {
+        if (viewers[v].peer < 0) continue;
+        test_capture_fd(&viewers[v].stream, viewers[v].peer);
+        TEST_CHECK(test_viewer_ends_with(&viewers[v], TC_BROADCAST_RESTORE), "broadcast: viewer %d not restored", v);
+        TEST_CHECK(!(fcntl(viewers[v].fd, F_GETFL) & O_NONBLOCK), "broadcast: viewer %d left non-blocking", v);
+    }
+
+    for (int v = 0; v < Viewers; v++) test_viewer_close(&viewers[v]);
+    for (int m = Color_Base; m <= Color_RGB; m++) {
+        free(reference[m].cells);
+        tc_destroy(plain[m]);
+    }
+    tc_destroy(source);
+    if (test_verbose) printf("broadcast: %d viewers, %d frames, %d skipped\n", Viewers, frames, skipped);
+    test_broadcast_pipe();
+}
+
+// -----------------------------------------------------------------------------
+//  Scroll
+// -----------------------------------------------------------------------------
+/*
+ * tc_scroll against moving copies of the rows, clipped bands included.
+ */
+static void test_scroll(void) {
+    static const wchar_t symbols[] = {L'a', L'b', L'#', 0x2588};
+    int width = 20, height = 9;
+    TermCanvas *canvas = test_canvas(width, height, Color_RGB);
+    TcPixel *expected = (TcPixel *)malloc(sizeof(TcPixel) * (size_t)(width * height));
+    TcPixel *moved    = (TcPixel *)malloc(sizeof(TcPixel) * (size_t)(width * height));
+
+    for (int round = 0; round < 500; round++) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) tc_set_pixel(canvas, y, x, test_cell(symbols, TEST_COUNT(symbols)));
+            memcpy(expected + y * width, canvas->pixels[y], sizeof(TcPixel) * (size_t)(width));
+        }
+
+        int y0    = test_range(height + 4) - 2;
+        int rows  = test_range(height + 2);
+        int lines = test_range(2 * height + 1) - height;
+        tc_scroll(canvas, y0, rows, lines);
+
+        // Row y of the band shows row y + lines of it, or the fill
+        int top = y0 < 0 ? 0 : y0, bottom = y0 + rows < height ? y0 + rows : height;
+        memcpy(moved, expected, sizeof(TcPixel) * (size_t)(width * height));
+        for (int y = top; y < bottom && lines != 0; y++) {
+            int from = y + lines;
+            for (int x = 0; x < width; x++) {
+                moved[y * width + x] = from >= top && from < bottom ? expected[from * width + x] : canvas->fill;
+            }
+        }
+
+        bool same = true;
+        for (int y = 0; y < height; y++) {
+            same = same && test_same_cells(canvas->pixels[y], moved + y * width, (size_t)(width));
+        }
+        TEST_CHECK(same, "scroll: rows %d+%d by %d differ", y0, rows, lines);
+        if (!same) break;
+    }
+
+    // With Cap_Scroll, a scrolled screen costs the new line, not a repaint
+    size_t bytes[2];
+    for (int hardware = 0; hardware < 2; hardware++) {
+        tc_set_caps(canvas, hardware ? Cap_Scroll : 0);
+        tc_show(canvas);
+        tc_sink_memory_clear(canvas);
+        tc_scroll(canvas, 0, height, 1);
+        tc_show(canvas);
+        tc_sink_memory(canvas, &bytes[hardware]);
+        tc_sink_memory_clear(canvas);
+    }
+    TEST_CHECK(bytes[1] * 3 < bytes[0], "scroll: %zu bytes with Cap_Scroll, %zu without", bytes[1], bytes[0]);
+
+    free(expected);
+    free(moved);
+    tc_destroy(canvas);
+    if (test_verbose) printf("scroll: ok\n");
+}
+
+// -----------------------------------------------------------------------------
+//  Clusters
+// -----------------------------------------------------------------------------
+#ifdef TC_USE_THREADS
+#define TEST_CLUSTER_THREADS 4
+#define TEST_CLUSTER_BASES   200
+
+typedef struct {
+    int index;
+    int misses; // Ids (of any thread) that came back without their base's width
+} TestClusterThread;
+
+static wchar_t test_cluster_ids[TEST_CLUSTER_THREADS][TEST_CLUSTER_BASES];
+
+/*
+ * Interns wide and narrow bases with a mark and, without any lock, looks
+ * up the widths of the ids the other threads got so far.
+ */
+static void *test_cluster_thread(void *data) {
+    static const wchar_t mark[] = {0x0323};
+    TestClusterThread *thread = (TestClusterThread *)data;
+
+    for (int i = 0; i < TEST_CLUSTER_BASES; i++) {
+        wchar_t base = i % 2 ? (wchar_t)(0xAC00 + i) : (wchar_t)(0x0100 + i);
+        __atomic_store_n(&test_cluster_ids[thread->index][i], tc_cluster(base, mark, 1), __ATOMIC_RELAXED);
+
+        for (int t = 0; t < TEST_CLUSTER_THREADS; t++) {
+            for (int k = 0; k <= i; k++) {
+                wchar_t id = __atomic_load_n(&test_cluster_ids[t][k], __ATOMIC_RELAXED);
+                if (id && tc_char_width(id) != (k % 2 ? 2 : 1)) thread->misses++;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Threads interning at the same time agree on every id.
+ */
+static void test_clusters_threaded(void) {
+    pthread_t threads[TEST_CLUSTER_THREADS];
+    TestClusterThread state[TEST_CLUSTER_THREADS];
+    for (int t = 0; t < TEST_CLUSTER_THREADS; t++) {
+        state[t] = (TestClusterThread){t, 0};
+        pthread_create(&threads[t], NULL, test_cluster_thread, &state[t]);
+    }
+
+    int misses = 0, disagree = 0;
+    for (int t = 0; t < TEST_CLUSTER_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        misses += state[t].misses;
+    }
+    for (int t = 1; t < TEST_CLUSTER_THREADS; t++) {
+        for (int i = 0; i < TEST_CLUSTER_BASES; i++) disagree += test_cluster_ids[t][i] != test_cluster_ids[0][i];
+    }
+    TEST_CHECK(misses == 0 && disagree == 0, "clusters: threads: %d ids without their width, %d different ids",
+               misses, disagree);
+}
+#endif
+
+static void test_clusters(void) {
+    static const struct {
+        wchar_t symbol;
+        int     width;
+    } widths[] = {
+        {L'a', 1},   {0x02FF, 1},  {0x0300, 0},  {0x0301, 0},  {0x20D0, 0},  {0x2588, 1},  {0x28FF, 1},
+        {0x4E2D, 2}, {0xAC00, 2},  {0xFF21, 2},  {0xFF61, 1},  {0x1F600, 2}, {0x20000, 2},
+    };
+    for (int i = 0; i < TEST_COUNT(widths); i++) {
+        TEST_CHECK(tc_char_width(widths[i].symbol) == widths[i].width, "clusters: U+%04X has width %d, not %d",
+                   (unsigned)widths[i].symbol, tc_char_width(widths[i].symbol), widths[i].width);
+    }
+
+    // The same base and marks are one cluster; marks already attached add up
+    static const wchar_t acute[] = {0x0301}, grave[] = {0x0300}, both[] = {0x0301, 0x0300};
+    wchar_t e_acute = tc_cluster(L'e', acute, 1);
+    TEST_CHECK((uint32_t)e_acute >= TC_CLUSTER_BASE && tc_cluster(L'e', acute, 1) == e_acute,
+               "clusters: e + acute interned twice");
+    TEST_CHECK(tc_cluster(L'e', grave, 1) != e_acute && tc_cluster(L'a', acute, 1) != e_acute,
+               "clusters: different clusters share an id");
+    TEST_CHECK(tc_cluster(e_acute, grave, 1) == tc_cluster(L'e', both, 2), "clusters: marks don't add up");
+    TEST_CHECK(tc_cluster(L'e', NULL, 0) == L'e', "clusters: a symbol without marks became a cluster");
+    TEST_CHECK(tc_char_width(tc_cluster(0x4E2D, acute, 1)) == 2, "clusters: a wide base lost its width");
+
+    // tc_draw_text: marks join the symbol before them, wide glyphs take two cells
+    TermCanvas *canvas = test_canvas(6, 1, Color_RGB);
+    tc_draw_text(canvas, 0, 0, L"e\x0301\x4E2Dz\x4E2D", COLOR_WHITE, COLOR_NONE, Effect_None);
+    uint32_t expected[6] = {(uint32_t)e_acute, 0x4E2D, TC_WIDE_CONT, L'z', 0x4E2D, TC_WIDE_CONT};
+    for (int x = 0; x < 6; x++) {
+        uint32_t symbol = (uint32_t)canvas->pixels[0][x].symbol;
+        TEST_CHECK(symbol == expected[x], "clusters: tc_draw_text cell %d is %x, not %x", x, symbol, expected[x]);
+    }
+
+    char text[64];
+    tc_dump_text(canvas, text, sizeof(text));
+    TEST_CHECK(strcmp(text, "e\xCC\x81\xE4\xB8\xAD" "z\xE4\xB8\xAD\n") == 0, "clusters: tc_dump_text gave \"%s\"", text);
+
+    // Half a glyph left behind shows as a space
+    tc_set_pixel(canvas, 0, 4, tc_pixel(COLOR_WHITE, COLOR_NONE, L'x', Effect_None));
+    tc_dump_text(canvas, text, sizeof(text));
+    TEST_CHECK(strcmp(text, "e\xCC\x81\xE4\xB8\xAD" "zx \n") == 0, "clusters: broken pair gave \"%s\"", text);
+    tc_destroy(canvas);
+
+    #ifdef TC_USE_THREADS
+    test_clusters_threaded();
+    #endif
+
+    // The table is process-wide: fill it up last. Known clusters are still found, new ones lose their marks
+    int added = 0;
+    wchar_t symbol = 0, base = 0;
+    for (int i = 0; i <= TC_CLUSTER_MAX; i++) {
+        base = (wchar_t)(0x4E00 + i);
+        symbol = tc_cluster(base, acute, 1);
+        if (symbol == base) break;
+        added++;
+    }
+    TEST_CHECK(symbol == base && added <= TC_CLUSTER_MAX, "clusters: table took %d clusters", added);
+    TEST_CHECK(tc_cluster(L'e', acute, 1) == e_acute, "clusters: a full table lost a cluster");
+    TEST_CHECK(tc_cluster(L'o', grave, 1) == L'o', "clusters: a full table took a cluster");
+    if (test_verbose) printf("clusters: ok\n");
+}
+
+// -----------------------------------------------------------------------------
+//  Overflow
+// -----------------------------------------------------------------------------
+static TermCanvas *test_small_canvas(int width, int height, int terminal_w, int terminal_h) {
+    TcOptions options = TC_OPTIONS_HEADLESS;
+    options.mode = Color_RGB;
+    options.terminal_w = terminal_w;
+    options.terminal_h = terminal_h;
+    return tc_create_ex(width, height, L' ', COLOR_WHITE, COLOR_BLACK, &options);
+}
+
+/*
+ * The terminal "resizes": a fixed size only changes this way.
+ */
+static void test_set_terminal(TermCanvas *canvas, int width, int height) {
+    canvas->size_w = width;
+    canvas->size_h = height;
+}
+
+/*
+ * Full redraw of the top-left part of the canvas that fits the model terminal.
+ */
+static void test_crop_reference(TestVt *reference, TermCanvas *canvas, int width, int height) {
+    if (width > canvas->width)   width  = canvas->width;
+    if (height > canvas->height) height = canvas->height;
+
+    TermCanvas *plain = test_canvas(width, height, canvas->mode);
+    tc_set_caps(plain, 0);
+    for (int y = 0; y < height; y++) memcpy(plain->pixels[y], canvas->pixels[y], sizeof(TcPixel) * (size_t)(width));
+    tc_show(plain);
+    test_vt_take(reference, plain);
+    tc_destroy(plain);
+}
+
+/*
+ * Resizes the model terminal; like xterm, it keeps the top-left of the screen.
+ */
+static void test_vt_resize(TestVt *vt, int width, int height) {
+    TestVt resized = {0};
+    test_vt_reset(&resized, width, height);
+    for (int y = 0; y < height && y < vt->height; y++) {
+        memcpy(test_vt_at(&resized, y, 0), test_vt_at(vt, y, 0),
+               sizeof(TestVtCell) * (size_t)(width < vt->width ? width : vt->width));
+    }
+    resized.attrs   = vt->attrs;
+    resized.unknown = vt->unknown;
+    free(vt->cells);
+    *vt = resized;
+}
+
+static bool test_vt_has_text(const TestVt *vt, int y, const char *text) {
+    char row[256];
+    size_t len = 0;
+    for (int x = 0; x < vt->width && len + TEST_VT_TEXT < sizeof(row); x++) {
+        const TestVtCell *cell = &vt->cells[y * vt->width + x];
+        memcpy(row + len, cell->text, cell->len);
+        len += cell->len;
+    }
+    row[len] = '\0';
+    return strstr(row, text) != NULL;
+}
+
+/*
+ * Overflow_Notice: the size notice goes out once per size (and after
+ * tc_invalidate), nothing in between, and the canvas comes back in full.
+ */
+static void test_notice(void) {
+    int width = 30, height = 10;
+    TermCanvas *canvas = test_small_canvas(width, height, 20, 8);
+    TestVt vt = {0}, reference = {0};
+    test_vt_reset(&vt, width, height);
+
+    size_t len = 0, first = 0;
+    test_scribble(canvas, true);
+    tc_show(canvas);
+    tc_sink_memory(canvas, &first);
+    test_vt_take(&vt, canvas);
+    TEST_CHECK(tc_get_stats(canvas)->too_small && first > 0 && first < 200, "notice: %zu bytes", first);
+    TEST_CHECK(test_vt_has_text(&vt, 4, "20x8") && vt.unknown == 0, "notice: size not shown");
+
+    for (int i = 0; i < 3; i++) {
+        test_scribble(canvas, true);
+        tc_show(canvas);
+        tc_sink_memory(canvas, &len);
+        tc_sink_memory_clear(canvas);
+        TEST_CHECK(len == 0 && tc_get_stats(canvas)->too_small, "notice: %zu bytes while too small", len);
+    }
+
+    tc_invalidate(canvas);
+    tc_show(canvas);
+    tc_sink_memory(canvas, &len);
+    tc_sink_memory_clear(canvas);
+    TEST_CHECK(len == first, "notice: %zu bytes after tc_invalidate, %zu the first time", len, first);
+
+    test_set_terminal(canvas, 25, 9);
+    tc_show(canvas);
+    test_vt_take(&vt, canvas);
+    TEST_CHECK(test_vt_has_text(&vt, 4, "25x9") && vt.unknown == 0, "notice: new size not shown");
+
+    // Large enough again: the whole canvas, as a full redraw shows it
+    test_set_terminal(canvas, width, height);
+    tc_show(canvas);
+    test_vt_take(&vt, canvas);
+    test_vt_reset(&reference, width, height);
+    test_crop_reference(&reference, canvas, width, height);
+    TEST_CHECK(!tc_get_stats(canvas)->too_small && test_vt_diff(&vt, &reference) < 0 && vt.unknown == 0,
+               "notice: canvas not restored");
+
+    free(vt.cells);
+    free(reference.cells);
+    tc_destroy(canvas);
+}
+
+/*
+ * Overflow_Crop: every frame shows the part of the canvas that fits,
+ * through terminal resizes (also ones that keep the visible part), for
+ * every Cap_* flag.
+ */
+static void test_crop_case(unsigned caps, const char *caps_name) {
+    static const struct {
+        int width, height;
+    } sizes[] = {{18, 6}, {25, 8}, {11, 12}, {40, 12}, {30, 10}};
+    int width = 30, height = 10, frames = 15;
+
+    TermCanvas *canvas = test_small_canvas(width, height, sizes[0].width, sizes[0].height);
+    tc_set_overflow(canvas, Overflow_Crop);
+    tc_set_caps(canvas, caps);
+    #ifdef TC_USE_THREADS
+    tc_set_encode_threads(canvas, test_threads);
+    #endif
+
+    TestVt vt = {0}, reference = {0};
+    bool failed = false;
+    for (int s = 0; s < TEST_COUNT(sizes) && !failed; s++) {
+        int terminal_w = sizes[s].width, terminal_h = sizes[s].height;
+        test_set_terminal(canvas, terminal_w, terminal_h);
+        if (s == 0) test_vt_reset(&vt, terminal_w, terminal_h);
+        else        test_vt_resize(&vt, terminal_w, terminal_h);
+
+        for (int f = 0; f < frames && !failed; f++) {
+            test_scribble(canvas, true);
+            if (f % 3 == 1) tc_scroll(canvas, 0, height, 1 + test_range(2));
+            tc_show(canvas);
+            test_vt_take(&vt, canvas);
+            test_vt_reset(&reference, terminal_w, terminal_h);
+            test_crop_reference(&reference, canvas, terminal_w, terminal_h);
+
+            bool small = terminal_w < width || terminal_h < height;
+            int cell = test_vt_diff(&vt, &reference);
+            failed = cell >= 0 || vt.unknown > 0 || tc_get_stats(canvas)->cropped != small;
+            TEST_CHECK(!failed, "crop %s: %dx%d frame %d: screen differs from the visible part (cell %d,%d), "
+                       "%d unknown sequences, cropped %d", caps_name, terminal_w, terminal_h, f,
+                       cell < 0 ? -1 : cell / terminal_w, cell < 0 ? -1 : cell % terminal_w, vt.unknown,
+                       tc_get_stats(canvas)->cropped);
+        }
+    }
+
+    free(vt.cells);
+    free(reference.cells);
+    tc_destroy(canvas);
+    if (test_verbose && !failed) printf("crop %s: ok\n", caps_name);
+}
+
+static void test_overflow(void) {
+    test_notice();
+    for (int c = 0; c < TEST_COUNT(test_caps); c++) test_crop_case(test_caps[c].caps, test_caps[c].name);
+}
+
+// -----------------------------------------------------------------------------
+//  Rasters
+// -----------------------------------------------------------------------------
+#define TEST_RASTER_W 45 // Cells; a braille dot row takes two words
+#define TEST_RASTER_H 7
+
+/*
+ * A raster kept the plain way: one color per pixel (COLOR_NONE: not set)
+ * and, for braille, the last color each cell was given.
+ */
+typedef struct {
+    TcRasterMode mode;
+    Color        background;
+    Color        pixels[4 * TEST_RASTER_H][2 * TEST_RASTER_W];
+    Color        cells[TEST_RASTER_H][TEST_RASTER_W];
+} TestRaster;
+
+static void test_raster_reset(TestRaster *model) {
+    for (int py = 0; py < 4 * TEST_RASTER_H; py++) {
+        for (int px = 0; px < 2 * TEST_RASTER_W; px++) model->pixels[py][px] = COLOR_NONE;
+    }
+    for (int cy = 0; cy < TEST_RASTER_H; cy++) {
+        for (int cx = 0; cx < TEST_RASTER_W; cx++) model->cells[cy][cx] = COLOR_NONE;
+    }
+}
+
+static void test_raster_plot(TestRaster *model, int py, int px, Color color) {
+    int pw = model->mode == Raster_Braille ? 2 * TEST_RASTER_W : TEST_RASTER_W;
+    int ph = model->mode == Raster_Braille ? 4 * TEST_RASTER_H : 2 * TEST_RASTER_H;
+    if (py < 0 || px < 0 || py >= ph || px >= pw) return;
+
+    model->pixels[py][px] = color;
+    if (model->mode == Raster_Braille && color.color != COLOR_NONE.color) model->cells[py / 4][px / 2] = color;
+}
+
+static TcPixel test_raster_cell(const TestRaster *model, int cy, int cx) {
+    uint32_t none = COLOR_NONE.color;
+    if (model->mode == Raster_Braille) {
+        // Dots 1-3 and 7 down the left column, 4-6 and 8 down the right one
+        static const unsigned dots[4][2] = {{0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+        unsigned pattern = 0;
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 2; c++) {
+                if (model->pixels[4 * cy + r][2 * cx + c].color != none) pattern |= dots[r][c];
+            }
+        }
+        if (!pattern) return tc_pixel(model->background, COLOR_NONE, L' ', Effect_None);
+        return tc_pixel(model->background, model->cells[cy][cx], (wchar_t)(0x2800 + pattern), Effect_None);
+    }
+
+    Color top    = model->pixels[2 * cy][cx];
+    Color bottom = model->pixels[2 * cy + 1][cx];
+    if (top.color == none)    top    = model->background;
+    if (bottom.color == none) bottom = model->background;
+    if (top.color == bottom.color) return tc_pixel(top, COLOR_NONE, L' ', Effect_None);
+    if (top.color == none)         return tc_pixel(top, bottom, (wchar_t)0x2584, Effect_None);
+    return tc_pixel(bottom, top, (wchar_t)0x2580, Effect_None);
+}
+
+/*
+ * Random plots on a raster hanging off the top, left and right of the
+ * canvas. After every present the covered cells are the model's and the
+ * rest of the canvas is untouched; a present with nothing plotted since
+ * writes no cell.
+ */
+static void test_raster_case(TcRasterMode mode, const char *name, Color background) {
+    int width = 40, height = 8, ry = -1, rx = -3;
+    TermCanvas *canvas = test_canvas(width, height, Color_RGB);
+    TcPixel sentinel = tc_pixel(COLOR_RED, COLOR_BLUE, L'@', Effect_Bold);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) canvas->pixels[y][x] = sentinel;
+    }
+
+    static TestRaster model;
+    model.mode       = mode;
+    model.background = background;
+    test_raster_reset(&model);
+
+    TcRaster *raster = tc_raster_create(canvas, ry, rx, TEST_RASTER_H, TEST_RASTER_W, mode, background);
+    int scale_w = mode == Raster_Braille ? 2 : 1, scale_h = mode == Raster_Braille ? 4 : 2;
+    TEST_CHECK(raster && tc_raster_width(raster) == scale_w * TEST_RASTER_W &&
+               tc_raster_height(raster) == scale_h * TEST_RASTER_H, "raster %s: wrong pixel size", name);
+    if (!raster) {
+        tc_destroy(canvas);
+        return;
+    }
+    int pw = tc_raster_width(raster), ph = tc_raster_height(raster);
+
+    bool failed = false;
+    for (int round = 0; round < 300 && !failed; round++) {
+        if (round % 60 == 59) {
+            tc_raster_clear(raster);
+            test_raster_reset(&model);
+        }
+        for (int i = test_range(60); i > 0; i--) {
+            int py = test_range(ph + 4) - 2, px = test_range(pw + 4) - 2;
+            Color color = test_color();
+            tc_raster_plot(raster, py, px, color);
+            test_raster_plot(&model, py, px, color);
+        }
+
+        tc_raster_present(raster);
+
+        for (int y = 0; y < height && !failed; y++) {
+            for (int x = 0; x < width && !failed; x++) {
+                int cy = y - ry, cx = x - rx;
+                bool covered = cy >= 0 && cy < TEST_RASTER_H && cx >= 0 && cx < TEST_RASTER_W;
+                TcPixel want = covered ? test_raster_cell(&model, cy, cx) : sentinel;
+                failed = !test_same_cells(&canvas->pixels[y][x], &want, 1);
+                TEST_CHECK(!failed, "raster %s: round %d: cell %d,%d is %x, not %x", name, round, y, x,
+                           (unsigned)canvas->pixels[y][x].symbol, (unsigned)want.symbol);
+            }
+        }
+
+        // Without plots in between, a present writes nothing
+        int sy = test_range(TEST_RASTER_H + ry), sx = test_range(width);
+        TcPixel kept = canvas->pixels[sy][sx];
+        canvas->pixels[sy][sx] = sentinel;
+        tc_raster_present(raster);
+        TEST_CHECK(test_same_cells(&canvas->pixels[sy][sx], &sentinel, 1), "raster %s: round %d: unchanged cell %d,%d "
+                   "written", name, round, sy, sx);
+        canvas->pixels[sy][sx] = kept;
+    }
+
+    tc_raster_destroy(raster);
+    tc_destroy(canvas);
+    if (test_verbose && !failed) printf("raster %s: ok\n", name);
+}
+
+/*
+ * tc_raster_line: both ends set and exactly one pixel per step along the
+ * longer axis, each next to the one before.
+ */
+static void test_raster_lines(void) {
+    int width = 30, height = 12;
+    TermCanvas *canvas = test_canvas(width, height, Color_RGB);
+    TcRaster *raster = tc_raster_create(canvas, 0, 0, height, width, Raster_HalfBlock, COLOR_NONE);
+    int pw = tc_raster_width(raster), ph = tc_raster_height(raster);
+
+    bool failed = false;
+    for (int round = 0; round < 500 && !failed; round++) {
+        tc_raster_clear(raster);
+        int y0 = test_range(ph), x0 = test_range(pw), y1 = test_range(ph), x1 = test_range(pw);
+        tc_raster_line(raster, y0, x0, y1, x1, COLOR_WHITE);
+
+        bool steep = (y1 > y0 ? y1 - y0 : y0 - y1) > (x1 > x0 ? x1 - x0 : x0 - x1);
+        int from = steep ? y0 : x0, to = steep ? y1 : x1, step = from <= to ? 1 : -1;
+        int last = steep ? x0 : y0, set = 0;
+        for (int py = 0; py < ph; py++) {
+            for (int px = 0; px < pw; px++) set += raster->colors[py * width + px].color == COLOR_WHITE.color;
+        }
+        failed = set != (to - from) * step + 1;
+
+        for (int major = from; !failed; major += step) {
+            int found = -1, count = 0;
+            for (int minor = 0; minor < (steep ? pw : ph); minor++) {
+                int py = steep ? major : minor, px = steep ? minor : major;
+                if (raster->colors[py * width + px].color == COLOR_WHITE.color) {
+                    found = minor;
+                    count++;
+                }
+            }
+            failed = count != 1 || found - last > 1 || last - found > 1;
+            last = found;
+            if (major == to) break;
+        }
+        failed = failed || last != (steep ? x1 : y1);
+        TEST_CHECK(!failed, "raster lines: %d,%d to %d,%d", y0, x0, y1, x1);
+    }
+
+    tc_raster_destroy(raster);
+    tc_destroy(canvas);
+    if (test_verbose && !failed) printf("raster lines: ok\n");
+}
+
+static void test_rasters(void) {
+    test_raster_case(Raster_Braille, "braille", COLOR_NONE);
+    test_raster_case(Raster_Braille, "braille/black", COLOR_BLACK);
+    test_raster_case(Raster_HalfBlock, "half", COLOR_NONE);
+    test_raster_case(Raster_HalfBlock, "half/black", COLOR_BLACK);
+    test_raster_lines();
+}
+
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) test_verbose = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) test_threads = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [-v] [-j threads]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    test_palette();
+    test_resize();
+    test_terminfo();
+    test_sinks();
+    test_sgr();
+    test_terminal();
+    test_pacing();
+    test_stats();
+    test_compositor();
+    test_kernels();
+    test_styles();
+    test_headless();
+    test_recorder();
+    test_broadcast();
+    test_scroll();
+    test_clusters();
+    test_overflow();
+    test_rasters();
+
+    if (test_failures) {
+        printf("%d check(s) failed\n", test_failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}